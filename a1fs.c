@@ -17,21 +17,27 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/mman.h>
 #include <libgen.h>
+#include <unistd.h>
+#include <linux/falloc.h>
 
 // Using 2.9.x FUSE API
 #define FUSE_USE_VERSION 29
 #include <fuse.h>
 
 #include "a1fs.h"
+#include "bitmap.h"
+#include "dirblock.h"
 #include "fs_ctx.h"
 #include "options.h"
 #include "map.h"
+#include "util.h"
 
 //NOTE: All path arguments are absolute paths within the a1fs file system and
 // start with a '/' that corresponds to the a1fs root directory.
@@ -45,6 +51,48 @@
 // FUSE callbacks as "/dir".
 
 
+/**
+ * Fault in the metadata blocks (superblock, group descriptors, bitmaps and
+ * inode table) and lock them into memory, so that the first operations after
+ * mount do not page-fault through them. If they cannot be locked (e.g. the
+ * RLIMIT_MEMLOCK limit is too low) they are only faulted in.
+ */
+static void pin_metadata(fs_ctx *fs)
+{
+	// up to the end of the inode table; not the padding before the data region
+	size_t len = align_up((size_t)fs->sb->inode_table * A1FS_BLOCK_SIZE +
+	                      (size_t)fs->sb->s_inodes_count * fs->inode_size, A1FS_BLOCK_SIZE);
+	if (mlock(fs->image, len) == 0) {
+		return;
+	}
+	perror("mlock");
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(fs->image, len, MADV_POPULATE_WRITE) == 0) {
+		return;
+	}
+#endif
+	// the blocks are written later, but reading them in is most of the work
+	volatile char *p = fs->image;
+	for (size_t off = 0; off < len; off += A1FS_BLOCK_SIZE) {
+		(void)p[off];
+	}
+}
+
+/**
+ * Ask for transparent huge pages for the whole huge pages of the data region.
+ * The image is mapped at a huge page boundary (see map_file()), so these are
+ * the huge pages at aligned offsets of the image file; an image formatted with
+ * mkfs.a1fs -a has its whole data region aligned.
+ */
+static void use_hugepages(fs_ctx *fs)
+{
+	size_t start = align_up((size_t)fs->sb->s_first_data_block * A1FS_BLOCK_SIZE, HUGE_PAGE_SIZE);
+	size_t end = fs->size & ~((size_t)HUGE_PAGE_SIZE - 1);
+	if (start < end && madvise((char*)fs->image + start, end - start, MADV_HUGEPAGE) != 0) {
+		perror("madvise");
+	}
+}
+
 /**
  * Initialize the file system.
  *
@@ -64,12 +112,47 @@ static bool a1fs_init(fs_ctx *fs, a1fs_opts *opts)
 	}
 
 	size_t size;
-	void *image = map_file(opts->img_path, A1FS_BLOCK_SIZE, &size);
-	if (!image) {
-		return false;
+	bcache *cache = NULL;
+	void *image;
+	if (opts->cache_mb) {
+		uint64_t capacity = (uint64_t)opts->cache_mb * 1024 * 1024 / A1FS_BLOCK_SIZE;
+		cache = malloc(sizeof(bcache));
+		image = cache ? bcache_open(cache, opts->img_path, A1FS_BLOCK_SIZE,
+		                            capacity < UINT32_MAX ? capacity : UINT32_MAX, &size) : NULL;
+		if (!image) {
+			free(cache);
+			return false;
+		}
+	} else {
+		image = map_file(opts->img_path, A1FS_BLOCK_SIZE, &size);
+		if (!image) {
+			return false;
+		}
 	}
 
-	return fs_ctx_init(fs, image, size);
+	if (!fs_ctx_init(fs, image, size, cache)) {
+		return false;
+	}
+	fs->detect_zeroes = opts->detect_zeroes;
+	// the block cache keeps the metadata and does its own paging
+	if (opts->pin_meta && !cache) {
+		pin_metadata(fs);
+	}
+	if (opts->hugepages && !cache) {
+		use_hugepages(fs);
+	}
+	if (!dirtymap_start_writeback(&fs->dirty, opts->writeback_ms,
+	                              (uint64_t)opts->writeback_kb * 1024 / A1FS_BLOCK_SIZE)) {
+		fprintf(stderr, "Failed to start the writeback thread\n");
+		return false;
+	}
+	// reads hand out ranges of the image file instead of copies of the data
+	fs->fd = cache ? -1 : open(opts->img_path, O_RDONLY);
+	if (fs->fd < 0 && !cache) {
+		perror(opts->img_path);
+		return false;
+	}
+	return true;
 }
 
 /**
@@ -82,8 +165,24 @@ static void a1fs_destroy(void *ctx)
 {
 	fs_ctx *fs = (fs_ctx*)ctx;
 	if (fs->image) {
-		munmap(fs->image, fs->size);
+		if (dirtymap_flush(&fs->dirty, 0, fs->size / A1FS_BLOCK_SIZE) != 0) {
+			fprintf(stderr, "Failed to write back the image\n");
+		} else if (fs->open_files.nfiles == 0) {
+			// only once everything else is written back; blocks still held
+			// for open files are freed by the next mount instead
+			fs->sb->s_state &= ~A1FS_STATE_MOUNTED;
+			fs_mark_dirty(fs, fs->sb, sizeof(*fs->sb));
+			dirtymap_flush(&fs->dirty, 0, 1);
+		}
+		// stops the writeback thread before the image goes away
 		fs_ctx_destroy(fs);
+		if (fs->cache) {
+			bcache_close(fs->cache);
+			free(fs->cache);
+		} else {
+			close(fs->fd);
+			munmap(fs->image, fs->size);
+		}
 	}
 }
 
@@ -125,104 +224,467 @@ static int a1fs_statfs(const char *path, struct statvfs *st)
 	//Maximum length of the file name
 	st->f_namemax = A1FS_NAME_MAX;
 	//Number of free blocks
-	st->f_bfree = fs->sb->s_free_blocks_count;
+	st->f_bfree = fs_free_blocks(fs);
 	//Num of free blocks for unprivilaged users
-	st->f_bavail = fs->sb->s_free_blocks_count;
+	st->f_bavail = st->f_bfree;
 	//Size of fs in f_frsize units
 	st->f_blocks = fs->sb->size / A1FS_BLOCK_SIZE;
 	//Number of inodes
 	st->f_files = fs->sb->s_inodes_count;
 	//Number of free inodes
-	st->f_ffree = fs->sb->s_free_inodes_count;
+	st->f_ffree = __atomic_load_n(&fs->sb->s_free_inodes_count, __ATOMIC_RELAXED);
 	//Number of free inodes for unprivilaged users
-	st->f_favail = fs->sb->s_free_inodes_count;
+	st->f_favail = st->f_ffree;
 	return 0;
 }
 
 // helper functions
 
+/**
+ * Path from the root of the extents of an inode down to one extent.
+ *
+ * Without an extent tree (A1FS_INODE_EXTENT_TREE) the path has no index levels
+ * and its leaf is the extent array in the inode or in the extent block.
+ */
+typedef struct ext_path {
+	/** Number of index levels above the leaf. */
+	int depth;
+	/** Blocks of the index nodes, from the root down. */
+	a1fs_blk_t blk[A1FS_EXTENT_MAX_DEPTH];
+	/** Position of the entry followed in each index node. */
+	unsigned int at[A1FS_EXTENT_MAX_DEPTH];
+	/** Block holding the leaf; -1 for extents kept in the inode. */
+	a1fs_blk_t block;
+	/** Extents of the leaf. */
+	a1fs_extent *extents;
+	/** Number of extents in the leaf. */
+	uint32_t *count;
+	/** Number of extents the leaf can hold. */
+	uint32_t max;
+	/** Logical block number of the first block of the leaf. */
+	uint64_t first;
+	/** Position of the extent in the leaf. */
+	unsigned int i;
+} ext_path;
+
+/**
+ * Key of the offset index of the extent tree leaf in block blk (see extmap).
+ * Leaves are keyed above the range of inode numbers.
+ */
+uint64_t ext_leaf_key(a1fs_blk_t blk) {
+	return ((uint64_t)1 << 32) + blk;
+}
+
+/**
+ * Key of the offset index of the leaf of a path; the extents of an inode
+ * without an extent tree are indexed by inode number.
+ */
+uint64_t ext_key(a1fs_inode *inode, const ext_path *path) {
+	if (!(inode->flags & A1FS_INODE_EXTENT_TREE)) {
+		return inode->inode_num;
+	}
+	return ext_leaf_key(path->block);
+}
+
+/**
+ * Find the last entry of an index node whose lblk is not greater than lblk.
+ * The first entry has no lower bound and matches every block.
+ */
+unsigned int ext_search(a1fs_extent_node *node, uint64_t lblk) {
+	a1fs_extent_idx *entries = a1fs_extent_index(node);
+	unsigned int lo = 1;
+	unsigned int hi = node->count;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if (entries[mid].lblk <= lblk) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo - 1;
+}
+
+/** Point a path at the leaf in block blk that starts at logical block first. */
+void ext_set_leaf(ext_path *path, a1fs_blk_t blk, uint64_t first, fs_ctx *fs) {
+	a1fs_extent_node *leaf = fs_block(fs, blk);
+	path->block = blk;
+	path->extents = a1fs_extent_leaf(leaf);
+	path->count = &leaf->count;
+	path->max = A1FS_EXTENT_LEAF_LIMIT;
+	path->first = first;
+}
+
+/**
+ * Walk the extents of an inode from the root down to the leaf that covers
+ * logical block lblk (the last leaf if lblk is past the end of the file),
+ * recording the index nodes visited along the way. path->i is not set.
+ */
+void ext_probe(a1fs_inode *inode, uint64_t lblk, ext_path *path, fs_ctx *fs) {
+	path->depth = 0;
+	if (!(inode->flags & A1FS_INODE_EXTENT_TREE)) {
+		path->block = inode->indirect_block == -1 ? (a1fs_blk_t)-1 : inode_extent_block(inode, fs);
+		path->extents = inode_extents(inode, fs);
+		path->count = &inode->count_extent;
+		path->max = inode_max_extents(inode, fs);
+		path->first = 0;
+		return;
+	}
+	a1fs_blk_t blk = inode_extent_block(inode, fs);
+	a1fs_extent_node *node = fs_block(fs, blk);
+	uint64_t first = 0;
+	while (node->levels > 0 && path->depth < A1FS_EXTENT_MAX_DEPTH) {
+		unsigned int at = ext_search(node, lblk);
+		path->blk[path->depth] = blk;
+		path->at[path->depth] = at;
+		path->depth++;
+		first = a1fs_extent_index(node)[at].lblk;
+		blk = a1fs_extent_index(node)[at].block;
+		node = fs_block(fs, blk);
+	}
+	ext_set_leaf(path, blk, first, fs);
+}
+
+/**
+ * Find the extent that holds a logical block of an inode.
+ *
+ * @param inode  the inode.
+ * @param lblk   logical block number.
+ * @param path   receives the path to the extent.
+ * @param first  receives the logical block number of the extent's first block.
+ * @param fs     file system context.
+ * @return       the extent; NULL if lblk is past the last extent.
+ */
+a1fs_extent *extent_find(a1fs_inode *inode, uint64_t lblk, ext_path *path, uint64_t *first, fs_ctx *fs) {
+	if (inode->count_extent == 0) {
+		return NULL;
+	}
+	ext_probe(inode, lblk, path, fs);
+	int i = extmap_find(&fs->extmap, ext_key(inode, path), path->extents, *path->count,
+	                    lblk - path->first, first);
+	if (i < 0) {
+		return NULL;
+	}
+	path->i = i;
+	*first += path->first;
+	return &path->extents[i];
+}
+
+/**
+ * Find the last extent of an inode. Without extents, the path still points
+ * to the (empty) extent array of the inode so that extents can be added to it.
+ *
+ * @return  the extent; NULL if the inode has no extents.
+ */
+a1fs_extent *extent_last(a1fs_inode *inode, ext_path *path, fs_ctx *fs) {
+	ext_probe(inode, UINT64_MAX, path, fs);
+	if (*path->count == 0) {
+		path->i = 0;
+		return NULL;
+	}
+	path->i = *path->count - 1;
+	return &path->extents[path->i];
+}
+
+/**
+ * Start iterating over the extents of an inode in logical order.
+ *
+ * @return  the first extent; NULL if the inode has no extents.
+ */
+a1fs_extent *extent_first(a1fs_inode *inode, ext_path *path, fs_ctx *fs) {
+	if (inode->count_extent == 0) {
+		return NULL;
+	}
+	ext_probe(inode, 0, path, fs);
+	path->i = 0;
+	return &path->extents[0];
+}
+
+/**
+ * Get the extent after the one a path points to, moving the path to the next
+ * leaf when needed.
+ *
+ * @return  the extent; NULL after the last extent.
+ */
+a1fs_extent *extent_next(ext_path *path, fs_ctx *fs) {
+	if (++path->i < *path->count) {
+		return &path->extents[path->i];
+	}
+	// climb to the lowest index node with entries left and go down the next one
+	int level = path->depth - 1;
+	while (level >= 0 &&
+	       path->at[level] + 1 >= ((a1fs_extent_node*)fs_block(fs, path->blk[level]))->count) {
+		level--;
+	}
+	if (level < 0) {
+		return NULL;
+	}
+	path->at[level]++;
+	for (; level < path->depth; level++) {
+		a1fs_extent_idx *entry = &a1fs_extent_index(fs_block(fs, path->blk[level]))[path->at[level]];
+		if (level + 1 < path->depth) {
+			path->blk[level + 1] = entry->block;
+			path->at[level + 1] = 0;
+		} else {
+			ext_set_leaf(path, entry->block, entry->lblk, fs);
+		}
+	}
+	path->i = 0;
+	return &path->extents[0];
+}
+
+/**
+ * Get a pointer to the block at the given logical block number of an inode.
+ *
+ * @param inode  the inode that owns the block.
+ * @param lblk   logical block number within the inode.
+ * @param fs     file system context.
+ * @return       pointer to the block; NULL if lblk is past the last block or
+ *               in a hole.
+ */
+void *inode_block(a1fs_inode *inode, a1fs_blk_t lblk, fs_ctx *fs) {
+	ext_path path;
+	uint64_t first;
+	a1fs_extent *e = extent_find(inode, lblk, &path, &first, fs);
+	if (e == NULL || a1fs_extent_hole(e, fs_64bit(fs))) {
+		return NULL;
+	}
+	return fs_block(fs, a1fs_extent_start(e, fs_64bit(fs)) + (lblk - first));
+}
+
+/**
+ * Return the number of data blocks allocated to an inode (holes excluded).
+ */
+uint64_t inode_nalloc(a1fs_inode *inode, fs_ctx *fs) {
+	uint64_t total = 0;
+	ext_path path;
+	for (a1fs_extent *e = extent_first(inode, &path, fs); e; e = extent_next(&path, fs)) {
+		if (!a1fs_extent_hole(e, fs_64bit(fs))) {
+			total += a1fs_extent_len(e, fs_64bit(fs));
+		}
+	}
+	return total;
+}
+
+/**
+ * Mark an inode dirty after it was modified: its slot in the inode table and
+ * its extent block (the root of its extent tree), if it has one. Other nodes
+ * of an extent tree are marked dirty when they change.
+ */
+void inode_dirty(a1fs_inode *inode, fs_ctx *fs) {
+	fs_mark_dirty(fs, inode, fs->inode_size);
+	if (inode->indirect_block != -1) {
+		fs_mark_blocks_dirty(fs, inode_extent_block(inode, fs), 1);
+	}
+}
+
+/** One level of a path from the root of a directory index down to a leaf. */
+typedef struct dx_frame {
+	/** Index node at this level. */
+	a1fs_dx_node *node;
+	/** Position of the entry that was followed. */
+	unsigned int at;
+} dx_frame;
+
+/**
+ * Find the last entry of an index node whose hash is not greater than hash.
+ * The first entry has no lower bound and matches every hash.
+ */
+unsigned int dx_search(const a1fs_dx_node *node, uint32_t hash) {
+	unsigned int lo = 1;
+	unsigned int hi = node->count;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if (node->entries[mid].hash <= hash) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo - 1;
+}
+
+/**
+ * Walk the index of a directory from its root down to the leaf that covers
+ * the given name hash, recording the nodes visited along the way.
+ *
+ * @param dir     indexed directory inode.
+ * @param hash    name hash.
+ * @param frames  receives the path; frames[0] is the root.
+ * @param fs      file system context.
+ * @return        number of frames filled in.
+ */
+int dx_probe(a1fs_inode *dir, uint32_t hash, dx_frame *frames, fs_ctx *fs) {
+	a1fs_dx_node *node = inode_block(dir, 0, fs);
+	int depth = 0;
+	while (true) {
+		frames[depth].node = node;
+		frames[depth].at = dx_search(node, hash);
+		depth++;
+		if (node->levels == 0 || depth == A1FS_DX_MAX_DEPTH) {
+			return depth;
+		}
+		node = inode_block(dir, node->entries[frames[depth - 1].at].block, fs);
+	}
+}
+
+/** Get the leaf block that the last frame of an index path points to. */
+a1fs_dentry *dx_leaf(a1fs_inode *dir, dx_frame *frame, fs_ctx *fs) {
+	return inode_block(dir, frame->node->entries[frame->at].block, fs);
+}
+
+/**
+ * Look up an entry of a directory with variable length entries.
+ *
+ * @return  the record; NULL if the directory has no such entry.
+ */
+a1fs_dirent *lookup_dirent(a1fs_inode *dir, const char *name, int *inode_num, fs_ctx *fs) {
+	size_t len = strlen(name);
+	uint32_t hash = a1fs_name_hash(name);
+	a1fs_dirent *de = NULL;
+	if (dir->flags & A1FS_INODE_INDEXED) {
+		dx_frame frames[A1FS_DX_MAX_DEPTH];
+		int depth = dx_probe(dir, hash, frames, fs);
+		de = dirblock_find(dx_leaf(dir, &frames[depth - 1], fs), name, len, hash);
+	} else {
+		uint64_t nblocks = dir->size / A1FS_BLOCK_SIZE;
+		for (uint64_t b = 0; b < nblocks && de == NULL; b++) {
+			de = dirblock_find(inode_block(dir, b, fs), name, len, hash);
+		}
+	}
+	if (de != NULL) {
+		*inode_num = de->ino;
+	}
+	return de;
+}
+
 /**
  * Look up the directory entry for the given directory. 
  * 
- * If the dentry is found successfully, return the dentry.
+ * If the dentry is found successfully, return the dentry: an a1fs_dentry, or
+ * an a1fs_dirent if the file system has compact directories.
  * Otherwise return component does not exist error.
  */
-struct a1fs_dentry *lookup_dentry(struct a1fs_inode *dir, char *dir_name, int *inode_num, fs_ctx *fs) {
-	struct a1fs_extent *extent;
-	extent = (struct a1fs_extent*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + dir->indirect_block));
+void *lookup_dentry(struct a1fs_inode *dir, char *dir_name, int *inode_num, fs_ctx *fs) {
+	if (fs_compact_dirs(fs)) {
+		return lookup_dirent(dir, dir_name, inode_num, fs);
+	}
+	// indexed directories only need to look at the one leaf covering the name hash
+	if (dir->flags & A1FS_INODE_INDEXED) {
+		dx_frame frames[A1FS_DX_MAX_DEPTH];
+		int depth = dx_probe(dir, a1fs_name_hash(dir_name), frames, fs);
+		struct a1fs_dentry *dentry = dx_leaf(dir, &frames[depth - 1], fs);
+		for (unsigned int k = 0; k < A1FS_DENTRIES_PER_BLOCK; k++) {
+			if (strcmp(dentry[k].name, dir_name) == 0) {
+				*inode_num = dentry[k].ino;
+				return &dentry[k];
+			}
+		}
+		return NULL;
+	}
 
 	// go into each blocks in the extents and find the drectery entry with dir_name
-	unsigned int size_dir = dir->count_extent;
-	for (unsigned int i = 0; i < size_dir; i++) {
-		unsigned int size_ext = extent[i].start + extent[i].count;
-		for (unsigned int j = extent[i].start; j < size_ext; j++) {
-			struct a1fs_dentry *dentry;
-			dentry = (struct a1fs_dentry*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + j));
-			unsigned int dentry_num = 0;
-			if (i == size_dir - 1 && j == size_ext - 1) {
-				while (dentry_num < dir->size % A1FS_BLOCK_SIZE / sizeof(a1fs_dentry)) {
-					// if the block's dentry name is equal to dir_name, we found the target dentry
-					if (strcmp(dentry[dentry_num].name, dir_name) == 0) {
-						// record the current inode number
-						*inode_num = dentry->ino;
-						return &dentry[dentry_num];
-					}
-					dentry_num++;
-				}  
-			} else {
-				while (dentry_num < A1FS_BLOCK_SIZE / sizeof(a1fs_dentry)) {
-					// if the block's dentry name is equal to dir_name, we found the target dentry
-					if (strcmp(dentry[dentry_num].name, dir_name) == 0) {
-						// record the current inode number
-						*inode_num = dentry->ino;
-						return &dentry[dentry_num];
-					}
-					dentry_num++;
-				}  
+	ext_path path;
+	unsigned int remaining = dir->size / sizeof(a1fs_dentry);
+	for (a1fs_extent *e = extent_first(dir, &path, fs); e; e = extent_next(&path, fs)) {
+		a1fs_blk_t start = a1fs_extent_start(e, fs_64bit(fs));
+		a1fs_blk_t size_ext = start + a1fs_extent_len(e, fs_64bit(fs));
+		for (a1fs_blk_t j = start; j < size_ext && remaining > 0; j++) {
+			struct a1fs_dentry *dentry = fs_block(fs, j);
+			// the last block may only be partially filled
+			unsigned int in_block = remaining < A1FS_DENTRIES_PER_BLOCK ? remaining : A1FS_DENTRIES_PER_BLOCK;
+			for (unsigned int dentry_num = 0; dentry_num < in_block; dentry_num++) {
+				// if the block's dentry name is equal to dir_name, we found the target dentry
+				if (strcmp(dentry[dentry_num].name, dir_name) == 0) {
+					// record the current inode number
+					*inode_num = dentry[dentry_num].ino;
+					return &dentry[dentry_num];
+				}
 			}
+			remaining -= in_block;
 		}
 	}
 	// no such directory entry is found, return NULL
 	return NULL;
 }
 
+/**
+ * Check whether a directory has no entries (other than "." and "..").
+ */
+bool dir_is_empty(a1fs_inode *dir, fs_ctx *fs) {
+	if (dir->flags & A1FS_INODE_INDEXED) {
+		a1fs_dx_node *root = inode_block(dir, 0, fs);
+		return root->nentries == 0;
+	}
+	return dir->size == 0;
+}
+
 /**
  * Look up the inode for given path. If the inode is found successfully, 
  * make the pointer to the inode correctly.
  * 
- * Return 1 if path exists, error otherwise.
+ * Each path component is resolved through the directory entry cache first;
+ * directories are only searched on a cache miss, and the result (including
+ * a missing name) is cached for the next lookup.
+ *
+ * Return 0 if path exists, error otherwise.
  */
 int lookup_inode(const char *path, fs_ctx *fs, a1fs_inode **inode) {
-	// define a copy of path
-	char path_cpy[A1FS_PATH_MAX];
-	strcpy(path_cpy, path);
-	path_cpy[A1FS_PATH_MAX-1] = '\0';
-
 	// search from the root directory
-	struct a1fs_inode *inode_root;
-	inode_root = (struct a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * fs->sb->inode_table);
-	int inode_num = 0;
+	a1fs_ino_t inode_num = 0;
 
 	// split path into single components
-	char *dir_name;
-	const char s[2] = "/";
-	dir_name = strtok(path_cpy, s);
-	while (dir_name != NULL) {
+	char dir_name[A1FS_NAME_MAX];
+	const char *p = path;
+	while (*p != '\0') {
+		if (*p == '/') {
+			p++;
+			continue;
+		}
+		size_t len = strcspn(p, "/");
+		if (len >= A1FS_NAME_MAX) {
+			return -ENAMETOOLONG;
+		}
+		memcpy(dir_name, p, len);
+		dir_name[len] = '\0';
+		p += len;
+
 		// lookup the inode_num stored in the directory entry that has name
-		// to be the first token found in dir_name
-		struct a1fs_inode *curr_inode;
-		curr_inode = &(inode_root[inode_num]);
+		// to be the current component
+		struct a1fs_inode *curr_inode = fs_inode(fs, inode_num);
+		// the directory stays read-locked until the result is cached, so that
+		// a concurrent add_dentry() cannot be overwritten by a stale miss
+		inode_rdlock(fs, inode_num);
+		a1fs_ino_t dir_num = inode_num;
+		int value = 0;
+		a1fs_ino_t child;
 		if((curr_inode->mode & S_IFDIR) != S_IFDIR) {
-			return -ENOTDIR;
+			value = -ENOTDIR;
+		} else switch (dcache_lookup(&fs->dcache, inode_num, dir_name, &child)) {
+		case DCACHE_HIT:
+			inode_num = child;
+			break;
+		case DCACHE_NEGATIVE_HIT:
+			value = -ENOENT;
+			break;
+		case DCACHE_MISS: {
+			int found_num;
+			if (lookup_dentry(curr_inode, dir_name, &found_num, fs) == NULL) {
+				dcache_insert(&fs->dcache, inode_num, dir_name, DCACHE_NEGATIVE);
+				value = -ENOENT;
+				break;
+			}
+			dcache_insert(&fs->dcache, inode_num, dir_name, found_num);
+			inode_num = found_num;
+			break;
 		}
-		struct a1fs_dentry *dentry;
-		dentry = lookup_dentry(curr_inode, dir_name, &inode_num, fs);
-		if (dentry == NULL) {
-			return -ENOENT;
 		}
-		dir_name = strtok(NULL, s);
+		inode_unlock(fs, dir_num);
+		if (value != 0) {
+			return value;
+		}
 	}
-	*inode = &inode_root[inode_num];
+	*inode = fs_inode(fs, inode_num);
 	
 	return 0; 
 }
@@ -230,7 +692,7 @@ int lookup_inode(const char *path, fs_ctx *fs, a1fs_inode **inode) {
 /**
  * Return the round up value of a division.
  */
-int ceiling(int dividend, int divider) {
+uint64_t ceiling(uint64_t dividend, uint64_t divider) {
 	if (dividend % divider == 0) {
 		return dividend / divider;
 	}
@@ -277,107 +739,237 @@ static int a1fs_getattr(const char *path, struct stat *st)
 	
 	int value = lookup_inode(path, fs, &inode);
 	if (value != 0) { 
-		if (value == -ENOTDIR) { 
-			return -ENOTDIR; // path prefix is not a directory
-		} 
-		if (value == -ENOENT) {
-			return -ENOENT; // path does not exist
-		}
+		// -ENOTDIR if a path prefix is not a directory, -ENOENT if the path does
+		// not exist, -ENAMETOOLONG if a component is too long
+		return value;
 	}
 
+	inode_rdlock(fs, inode->inode_num);
 	st->st_mode = inode->mode;
 	st->st_nlink = inode->links;
 	st->st_size = inode->size;
-	st->st_blocks = ceiling(inode->size, A1FS_BLOCK_SIZE) * A1FS_BLOCK_SIZE / 512;
+	// inline files and holes do not use any data blocks
+	if (!(inode->flags & A1FS_INODE_INLINE)) {
+		st->st_blocks = inode_nalloc(inode, fs) * A1FS_BLOCK_SIZE / 512;
+	}
 	st->st_mtim = inode->mtime;
+	inode_unlock(fs, inode->inode_num);
 	return 0;
 }
 
+/** Offset of the first entry in readdir(); "." and ".." are 1 and 2. */
+#define A1FS_DIR_OFF_FIRST 3
+
+/**
+ * Pass a directory entry to filler() along with its inode number and type, so
+ * that the kernel does not need to look the entry up to learn its type.
+ *
+ * @param entry  an a1fs_dentry, or an a1fs_dirent if the file system has
+ *               compact directories (which record the type themselves).
+ * @return       the filler() result: non-zero if the buffer is full.
+ */
+int fill_dentry(void *buf, fuse_fill_dir_t filler, const void *entry, off_t off, fs_ctx *fs) {
+	struct stat st;
+	memset(&st, 0, sizeof(st));
+	if (fs_compact_dirs(fs)) {
+		const a1fs_dirent *de = entry;
+		st.st_ino = de->ino;
+		st.st_mode = (mode_t)de->file_type << 12;
+		return filler(buf, de->name, &st, off);
+	}
+	const a1fs_dentry *dentry = entry;
+	st.st_ino = dentry->ino;
+	// the type of an inode never changes while it is linked
+	st.st_mode = fs_inode(fs, dentry->ino)->mode;
+	return filler(buf, dentry->name, &st, off);
+}
+
+/** An entry of an index leaf with its name hash. */
+typedef struct dx_leaf_entry {
+	uint32_t hash;
+	const char *name;
+	const void *entry;
+} dx_leaf_entry;
+
+/** Order index leaf entries by hash, then by name. */
+int compare_leaf_entry(const void *a, const void *b) {
+	const dx_leaf_entry *x = a;
+	const dx_leaf_entry *y = b;
+	if (x->hash != y->hash) {
+		return x->hash < y->hash ? -1 : 1;
+	}
+	return strcmp(x->name, y->name);
+}
+
+/**
+ * Collect the entries of an index leaf in the order that they are listed.
+ *
+ * @return  number of entries.
+ */
+unsigned int dx_leaf_sorted(void *leaf, dx_leaf_entry *out, fs_ctx *fs) {
+	unsigned int n = 0;
+	if (fs_compact_dirs(fs)) {
+		for (a1fs_dirent *de = leaf; dirent_in_block(leaf, de); de = dirent_next(de)) {
+			if (de->name_len != 0) {
+				out[n++] = (dx_leaf_entry){de->hash, de->name, de};
+			}
+		}
+	} else {
+		a1fs_dentry *dentry = leaf;
+		for (unsigned int k = 0; k < A1FS_DENTRIES_PER_BLOCK; k++) {
+			if (dentry[k].name[0] != '\0') {
+				out[n++] = (dx_leaf_entry){a1fs_name_hash(dentry[k].name), dentry[k].name, &dentry[k]};
+			}
+		}
+	}
+	qsort(out, n, sizeof(dx_leaf_entry), compare_leaf_entry);
+	return n;
+}
+
+/**
+ * Fill the entries of an indexed directory that come after position pos.
+ *
+ * Entries are listed leaf by leaf in hash order. The position of an entry is
+ * its name hash followed by its rank among the names with the same hash (which
+ * always share a leaf), in name order. A listing therefore resumes right after
+ * the last entry returned by walking down the index to that hash, even if
+ * leaves were split in between.
+ *
+ * @param pos  position of the last entry already listed; -1 to list all.
+ */
+void dx_readdir(a1fs_inode *dir, int64_t pos, void *buf, fuse_fill_dir_t filler, fs_ctx *fs) {
+	dx_frame frames[A1FS_DX_MAX_DEPTH];
+	int depth = dx_probe(dir, pos < 0 ? 0 : (uint32_t)(pos >> 8), frames, fs);
+	while (true) {
+		dx_leaf_entry ents[A1FS_DIRENTS_PER_BLOCK_MAX];
+		unsigned int n = dx_leaf_sorted(dx_leaf(dir, &frames[depth - 1], fs), ents, fs);
+		unsigned int rank = 0;
+		for (unsigned int i = 0; i < n; i++) {
+			rank = i > 0 && ents[i - 1].hash == ents[i].hash ? rank + 1 : 0;
+			int64_t p = (int64_t)ents[i].hash << 8 | rank;
+			if (p > pos && fill_dentry(buf, filler, ents[i].entry, p + A1FS_DIR_OFF_FIRST, fs) != 0) {
+				return;
+			}
+		}
+
+		// move on to the next leaf: advance the deepest node that has entries
+		// left and go back down along the first entries of its subtree
+		int level = depth - 1;
+		while (level >= 0 && frames[level].at + 1 >= frames[level].node->count) {
+			level--;
+		}
+		if (level < 0) {
+			return;
+		}
+		frames[level].at++;
+		for (level++; level < depth; level++) {
+			frames[level].node = inode_block(dir, frames[level - 1].node->entries[frames[level - 1].at].block, fs);
+			frames[level].at = 0;
+		}
+	}
+}
+
+/**
+ * Fill the entries of a linear directory with variable length entries that
+ * start at or after byte pos of the directory. The position of an entry is the
+ * offset of its record.
+ */
+void dirent_readdir(a1fs_inode *dir, uint64_t pos, void *buf, fuse_fill_dir_t filler, fs_ctx *fs) {
+	uint64_t nblocks = dir->size / A1FS_BLOCK_SIZE;
+	for (uint64_t b = pos / A1FS_BLOCK_SIZE; b < nblocks; b++) {
+		char *block = inode_block(dir, b, fs);
+		for (a1fs_dirent *de = (a1fs_dirent*)block; dirent_in_block(block, de); de = dirent_next(de)) {
+			uint64_t p = b * A1FS_BLOCK_SIZE + ((char*)de - block);
+			if (de->name_len != 0 && p >= pos &&
+			    fill_dentry(buf, filler, de, A1FS_DIR_OFF_FIRST + p + 1, fs) != 0) {
+				return;
+			}
+		}
+	}
+}
+
+
 /**
  * Read a directory.
  *
- * Implements the readdir() system call. Should call filler(buf, name, NULL, 0)
- * for each directory entry. See fuse.h in libfuse source code for details.
+ * Implements the readdir() system call. See fuse.h in libfuse source code for
+ * details.
+ *
+ * Entries are passed to filler() straight from the directory blocks, with the
+ * offset at which the listing continues after each one; when the buffer is
+ * full, the kernel calls again with that offset. An offset is the position of
+ * the next entry in a linear directory, or the position of the last entry
+ * listed in an indexed one (see dx_readdir()).
  *
  * Assumptions (already verified by FUSE using getattr() calls):
  *   "path" exists and is a directory.
  *
- * Errors:
- *   ENOMEM  not enough memory (e.g. a filler() call failed).
+ * Errors: none
  *
  * @param path    path to the directory.
  * @param buf     buffer that receives the result.
  * @param filler  function that needs to be called for each directory entry.
- *                Pass 0 as offset (4th argument). 3rd argument can be NULL.
- * @param offset  unused.
+ * @param offset  offset to continue the listing at; 0 to start.
  * @param fi      unused.
  * @return        0 on success; -errno on error.
  */
 static int a1fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                         off_t offset, struct fuse_file_info *fi)
 {
-	(void)offset;// unused
 	(void)fi;// unused
 	fs_ctx *fs = get_fs();
 
-	//TODO: lookup the directory inode for given path and iterate through its
-	// directory entries
-	(void)fs;
 	a1fs_inode *dir;
 	//fill in the data of the inode from the path into dir
-	lookup_inode(path, fs, &dir);
-	a1fs_dentry *dentries;
-	//total number of directory entries
-	int count_dentries = dir->size / sizeof(a1fs_dentry);
-	dentries = malloc(dir->size);
-	if (dentries == NULL) {
-		return -ENOMEM;
+	int value = lookup_inode(path, fs, &dir);
+	if (value != 0) {
+		return value;
 	}
+	a1fs_ino_t dir_num = dir->inode_num;
+	inode_rdlock(fs, dir_num);
 
-	void *temp = (void *)dentries;
-	//find the location that stores the extents
-	a1fs_extent *extents = fs->image + (fs->sb->s_first_data_block + dir->indirect_block) * A1FS_BLOCK_SIZE;
-
-	//loop through the extents and copy data into dentries
-	for(unsigned int i = 0; i < dir->count_extent; i++){
-		//iterate the blocks in current extent
-		for(unsigned int j = extents[i].start; j < extents[i].start + extents[i].count; j++){
-			//the datablock at j
-			const void *block = fs->image + (fs->sb->s_first_data_block + j) * A1FS_BLOCK_SIZE;
-			
-			//if it is the last data block
-			bool is_last = (i == (dir->count_extent - 1)) && (j == (extents[i].start + extents[i].count - 1));
-			if(is_last){
-				//copy whats left
-				memcpy(temp, block, dir->size % A1FS_BLOCK_SIZE);
-			} 
-			else{
-				//copy whole block
-				memcpy(temp, block, A1FS_BLOCK_SIZE);
-			}
-			temp += A1FS_BLOCK_SIZE;
-		}
+	if ((offset < 1 && filler(buf, ".", NULL, 1) != 0) ||
+	    (offset < 2 && filler(buf, "..", NULL, 2) != 0)) {
+		goto end;
 	}
 
-	if(filler(buf, "." , NULL, 0) + filler(buf, "..", NULL, 0) != 0) {
-		return -ENOMEM;
+	if (dir->flags & A1FS_INODE_INDEXED) {
+		dx_readdir(dir, offset < A1FS_DIR_OFF_FIRST ? -1 : offset - A1FS_DIR_OFF_FIRST,
+		           buf, filler, fs);
+		goto end;
+	}
+	if (fs_compact_dirs(fs)) {
+		dirent_readdir(dir, offset < A1FS_DIR_OFF_FIRST ? 0 : offset - A1FS_DIR_OFF_FIRST,
+		               buf, filler, fs);
+		goto end;
 	}
 
-	for(int i = 0; i < count_dentries; i++){
-		if(filler(buf, dentries[i].name, NULL, 0) != 0) {
-			return -ENOMEM;
+	uint64_t count = dir->size / sizeof(a1fs_dentry);
+	uint64_t i = offset < A1FS_DIR_OFF_FIRST ? 0 : offset - A1FS_DIR_OFF_FIRST;
+	a1fs_dentry *block = NULL;
+	for (; i < count; i++) {
+		if (block == NULL || i % A1FS_DENTRIES_PER_BLOCK == 0) {
+			block = inode_block(dir, i / A1FS_DENTRIES_PER_BLOCK, fs);
+		}
+		// slots of removed entries stay in place and keep the offsets stable
+		a1fs_dentry *dentry = &block[i % A1FS_DENTRIES_PER_BLOCK];
+		if (dentry->name[0] != '\0' &&
+		    fill_dentry(buf, filler, dentry, A1FS_DIR_OFF_FIRST + i + 1, fs) != 0) {
+			break;
 		}
 	}
-	free(dentries);
 
+end:
+	inode_unlock(fs, dir_num);
 	return 0;
 }
 
 /**
  * switch bit bit_number from 0 to 1 in inode bitmap
+ * (caller must hold fs->ino_bitmap_lock)
 **/
 void set_flip_ino_bitmap(a1fs_ino_t ino_number, fs_ctx *fs){
-	unsigned char *ino_bitmap = fs->image + (fs->sb->inode_bitmap) * A1FS_BLOCK_SIZE;
+	unsigned char *ino_bitmap = fs->image + (size_t)fs->sb->inode_bitmap * A1FS_BLOCK_SIZE;
 	int byte_number = ino_number / 8;
 	// find the bit number of the inode in the byte it belongs to
 	int bit_number = ino_number % 8;
@@ -385,883 +977,2674 @@ void set_flip_ino_bitmap(a1fs_ino_t ino_number, fs_ctx *fs){
 	unsigned char flip_one = (1 << (7 - bit_number));
 	// merge flip_one with the previous
 	ino_bitmap[byte_number] = ino_bitmap[byte_number] | flip_one;
-	fs->sb->s_free_inodes_count -= 1;
-}
-
-/**
- * switch bit bit_number from 0 to 1 in data block bitmap
-**/
-void set_flip_block_bitmap(a1fs_blk_t block_number, fs_ctx *fs){
-	unsigned char *block_bitmap = fs->image + (fs->sb->dblock_bitmap) * A1FS_BLOCK_SIZE;
-	int byte_number = block_number / 8;
-	// find the bit number of the inode in the byte it belongs to
-	int bit_number = block_number % 8;
-	// 00000000 and change the bit_number's bit to 1
-	unsigned char flip_one = (1 << (7 - bit_number));
-	// merge flip_one with the previous
-	block_bitmap[byte_number] = block_bitmap[byte_number] | flip_one;
-	fs->sb->s_free_blocks_count -= 1;
+	bitmap_summary_update(&fs->ino_summary, ino_bitmap, ino_number);
+	// statfs() reads the free counts without taking the bitmap locks
+	__atomic_fetch_sub(&fs->sb->s_free_inodes_count, 1, __ATOMIC_RELAXED);
+	fs_mark_dirty(fs, &ino_bitmap[byte_number], 1);
+	fs_mark_dirty(fs, fs->sb, sizeof(*fs->sb));
+	if (fs_has_groups(fs)) {
+		a1fs_group_desc *gd = fs_group(fs, ino_number / fs->sb->s_inodes_per_group);
+		__atomic_fetch_sub(&gd->free_inodes, 1, __ATOMIC_RELAXED);
+		fs_mark_dirty(fs, gd, sizeof(*gd));
+	}
 }
 
 /**
- * find the first 0 in the inode bitmap and set the corresponding inode.
- * return 0 on success, -1 on error
- * 
- * @param fs 			file system context
- * @param ino_num 		the index or inode number of the avaliable inode we found
- * @return 				int 0 on success, -1 on error
- */
-int set_inode(int *ino_num, fs_ctx *fs){
-    unsigned char *inode_bitmap = fs->image + (fs->sb->inode_bitmap) * A1FS_BLOCK_SIZE;
-	//total number of bits in the inode bitmap
-	int inode_bits = fs->sb->s_inodes_count;
-	//total number of bytes in the inode bitmap
-	int inode_bytes = inode_bits/8;
-	int i = 0;
-	int iterate_bit = 0;
-	int iterated_bits = 0;
-	bool found = false;
-	while (i <= inode_bytes && !found) {
-		if ((i == inode_bytes) && (inode_bits%8 != 0)){
-			iterate_bit = inode_bits%8;
+ * Update the free block counters of the superblock and of the block groups
+ * after blocks [start, start + count) were allocated or freed. Each counter is
+ * updated once.
+ */
+void count_free_blocks(a1fs_blk_t start, uint64_t count, bool freed, fs_ctx *fs){
+	if (fs_64bit(fs)) {
+		if (freed) {
+			__atomic_fetch_add(&fs->sb->s_free_blocks_count64, count, __ATOMIC_RELAXED);
 		} else {
-			iterate_bit = 8;
-		}
-		for (int j = 0; j < iterate_bit; j++){
-			//inode_bitmap[i] has eight bits each representing an inode
-			if (!(inode_bitmap[i] & (1 << (7 - j)))){
-				*ino_num = iterated_bits + j;
-				found = true;
-				break;
-			}
+			__atomic_fetch_sub(&fs->sb->s_free_blocks_count64, count, __ATOMIC_RELAXED);
 		}
-		iterated_bits += iterate_bit;
+	} else if (freed) {
+		__atomic_fetch_add(&fs->sb->s_free_blocks_count, count, __ATOMIC_RELAXED);
+	} else {
+		__atomic_fetch_sub(&fs->sb->s_free_blocks_count, count, __ATOMIC_RELAXED);
 	}
-	if (found == false){
-		return -ENOSPC;
+	fs_mark_dirty(fs, fs->sb, sizeof(*fs->sb));
+	if (!fs_has_groups(fs)) {
+		return;
 	}
-	set_flip_ino_bitmap(*ino_num, fs);
-	return 0;
-}
-
-/**
- * find the best avaliable extent depending on length
- * 
- * find the first extent that has extent.count equal to length,
- * if none exist, find the longest extent possible
- * 
- * @param dblock_bitmap    points to the start of the datablock bitmap
- * @param length    	length of the extent we want to find
- * @param extent    	the struct extent
- * @param fs         	file system context
- * @return          	true on success, false on error
- */
-bool iterate_data_bitmap(unsigned char *dblock_bitmap, unsigned int length, a1fs_extent *extent, fs_ctx *fs){
-	int total_blocks = (fs->sb->data_block_count);
-	int block_bytes = total_blocks / 8;
-	int iterate_bit = 0;
-	unsigned int start = 0;
-	unsigned int count = 0;
-	int i = 0;
-	int iterated_bits = 0;
-	extent->count = 0;
-	while (i <= block_bytes){
-		// number of bits of the current byte that needs to be counted
-		if ((i == block_bytes) && (total_blocks%8 != 0)){
-			iterate_bit = total_blocks%8;
+	uint64_t per_group = fs->sb->s_blocks_per_group;
+	uint64_t end = (uint64_t)start + count;
+	for (uint64_t b = start; b < end; ) {
+		uint64_t next = (b / per_group + 1) * per_group;
+		next = next < end ? next : end;
+		a1fs_group_desc *gd = fs_group(fs, b / per_group);
+		if (freed) {
+			__atomic_fetch_add(&gd->free_blocks, next - b, __ATOMIC_RELAXED);
 		} else {
-			iterate_bit = 8;
-		}
-		// iterate through each bit
-		for (int j = 0; j < iterate_bit; j++){
-			if (dblock_bitmap[i] & (1 << (7 - j))){
-				if(count > extent->count){
-					extent->start = start;
-					extent->count = count;
-				} 
-				count = 0;
-			}else{
-				count++;
-				if(count == 1){
-					start = iterated_bits + j;
-				}
-				if(count == length){
-					extent->start = start;
-					extent->count = count;
-					return true;
-				}
-			}
+			__atomic_fetch_sub(&gd->free_blocks, next - b, __ATOMIC_RELAXED);
 		}
-		// increase the counter for number of bits iterated
-		iterated_bits += iterate_bit;
-		i+=1;
+		fs_mark_dirty(fs, gd, sizeof(*gd));
+		b = next;
 	}
-	// no space to allocate
-	if(extent->count == 0) {
-		return false;
-	}
-	return true;
 }
 
 /**
- * Set blocks to the inode
- * 
- * @param inode      pointer to inode that needs to allocate block
- * @param num_blocks  number of blocks that needs to be allocated to that inode
+ * switch bits [start, start + count) from 0 to 1 in data block bitmap
+ * (caller must hold fs->dblock_bitmap_lock)
+**/
+void set_flip_block_bitmap(a1fs_blk_t start, uint64_t count, fs_ctx *fs){
+	unsigned char *block_bitmap = fs->image + (size_t)fs->sb->dblock_bitmap * A1FS_BLOCK_SIZE;
+	bitmap_set_range(block_bitmap, start, count);
+	fs_mark_dirty(fs, block_bitmap + start / 8, (start + count - 1) / 8 - start / 8 + 1);
+	count_free_blocks(start, count, false, fs);
+	freemap_remove(&fs->freemap, start, count);
+}
+
+/**
+ * switch bit bit_number from 1 to 0 in data inode bitmap
+ * (caller must hold fs->ino_bitmap_lock)
+**/
+void unset_flip_inode_bitmap(a1fs_blk_t inode_number, fs_ctx *fs){
+	unsigned char *inode_bitmap = fs->image + (size_t)fs->sb->inode_bitmap * A1FS_BLOCK_SIZE;
+	int byte_number = inode_number / 8;
+	// find the bit number of the inode in the byte it belongs to
+	int bit_number = inode_number % 8;
+	// change the bit_number's bit to 0
+	unsigned char flip_zero = ~(1 << (7 - bit_number));
+	// merge flip_one with the previous
+	inode_bitmap[byte_number] = inode_bitmap[byte_number] & flip_zero;
+	bitmap_summary_update(&fs->ino_summary, inode_bitmap, inode_number);
+	__atomic_fetch_add(&fs->sb->s_free_inodes_count, 1, __ATOMIC_RELAXED);
+	fs_mark_dirty(fs, &inode_bitmap[byte_number], 1);
+	fs_mark_dirty(fs, fs->sb, sizeof(*fs->sb));
+	if (fs_has_groups(fs)) {
+		a1fs_group_desc *gd = fs_group(fs, inode_number / fs->sb->s_inodes_per_group);
+		__atomic_fetch_add(&gd->free_inodes, 1, __ATOMIC_RELAXED);
+		fs_mark_dirty(fs, gd, sizeof(*gd));
+	}
+}
+
+/**
+ * switch bits [start, start + count) from 1 to 0 in data block bitmap
+ * (caller must hold fs->dblock_bitmap_lock)
+**/
+void unset_flip_block_bitmap(a1fs_blk_t start, uint64_t count, fs_ctx *fs){
+	unsigned char *block_bitmap = fs->image + (size_t)fs->sb->dblock_bitmap * A1FS_BLOCK_SIZE;
+	bitmap_clear_range(block_bitmap, start, count);
+	fs_mark_dirty(fs, block_bitmap + start / 8, (start + count - 1) / 8 - start / 8 + 1);
+	count_free_blocks(start, count, true, fs);
+	freemap_add(&fs->freemap, start, count);
+}
+
+/**
+ * Free data blocks that a file no longer uses. The blocks of a file with open
+ * handles are held until its last handle is released instead (see openfiles),
+ * since replies to its reads may still be read from them.
+ * (caller must hold fs->dblock_bitmap_lock)
+ */
+void release_blocks(a1fs_inode *inode, a1fs_blk_t start, uint64_t count, fs_ctx *fs){
+	if (!openfiles_hold(&fs->open_files, inode->inode_num, start, count)) {
+		unset_flip_block_bitmap(start, count, fs);
+	}
+}
+
+/**
+ * Choose the block group for a new inode.
+ *
+ * Files go to the group of their parent directory, next to their siblings.
+ * Directories go to the group with the most free blocks among those with at
+ * least the average number of free inodes, which spreads directory trees over
+ * the image and leaves room for the files that will be created in them.
+ * (caller must hold fs->ino_bitmap_lock)
+ *
+ * @param parent  inode number of the parent directory.
+ * @param is_dir  whether the new inode is a directory.
+ * @param fs      file system context.
+ * @return        the group number.
+ */
+uint32_t inode_group(a1fs_ino_t parent, bool is_dir, fs_ctx *fs){
+	uint32_t best = parent / fs->sb->s_inodes_per_group;
+	if (!is_dir) {
+		return best;
+	}
+	uint32_t avg_free_inodes = fs->sb->s_free_inodes_count / fs->sb->s_groups_count;
+	uint32_t best_free_blocks = 0;
+	bool found = false;
+	for (uint32_t g = 0; g < fs->sb->s_groups_count; g++) {
+		a1fs_group_desc *gd = fs_group(fs, g);
+		uint32_t free_blocks = __atomic_load_n(&gd->free_blocks, __ATOMIC_RELAXED);
+		if (gd->free_inodes == 0 || gd->free_inodes < avg_free_inodes) {
+			continue;
+		}
+		if (!found || free_blocks > best_free_blocks) {
+			best = g;
+			best_free_blocks = free_blocks;
+			found = true;
+		}
+	}
+	return best;
+}
+
+/**
+ * find the first 0 in the inode bitmap and set the corresponding inode.
+ * the inode bitmap summary leads straight to a word with a free inode.
+ * with block groups the search starts in the group chosen by inode_group()
+ * and moves on to the next group that has a free inode.
+ * return 0 on success, -ENOSPC if all inodes are in use
+ * 
+ * @param fs 			file system context
+ * @param ino_num 		the index or inode number of the avaliable inode we found
+ * @param parent 		inode number of the parent directory
+ * @param is_dir 		whether the inode will be a directory
+ * @return 				int 0 on success, -ENOSPC on error
+ */
+int set_inode(int *ino_num, a1fs_ino_t parent, bool is_dir, fs_ctx *fs){
+	unsigned char *inode_bitmap = fs->image + (size_t)fs->sb->inode_bitmap * A1FS_BLOCK_SIZE;
+	uint64_t inode_bits = fs->sb->s_inodes_count;
+	bool found = false;
+	pthread_mutex_lock(&fs->ino_bitmap_lock);
+	// without block groups the whole bitmap is a single group
+	bool groups = fs_has_groups(fs);
+	uint32_t ngroups = groups ? fs->sb->s_groups_count : 1;
+	uint64_t per_group = groups ? fs->sb->s_inodes_per_group : inode_bits;
+	uint32_t g = groups ? inode_group(parent, is_dir, fs) : 0;
+	for (uint32_t k = 0; k < ngroups && !found; k++, g = (g + 1) % ngroups) {
+		uint64_t from = g * per_group;
+		uint64_t end = from + per_group < inode_bits ? from + per_group : inode_bits;
+		if (from >= end || (groups && fs_group(fs, g)->free_inodes == 0)) {
+			continue;
+		}
+		uint64_t ino = fs->ino_summary.l1 ? bitmap_summary_find_zero(&fs->ino_summary, inode_bitmap, from)
+		                                  : bitmap_find_zero(inode_bitmap, end, from);
+		if (ino < end) {
+			*ino_num = ino;
+			set_flip_ino_bitmap(ino, fs);
+			// the inode table of the image was not cleared by mkfs.a1fs
+			if (fs->sb->s_uninit & A1FS_UNINIT_INODE_TABLE) {
+				memset(fs_inode(fs, ino), 0, fs->inode_size);
+			}
+			if (groups && is_dir) {
+				a1fs_group_desc *gd = fs_group(fs, g);
+				gd->used_dirs++;
+				fs_mark_dirty(fs, gd, sizeof(*gd));
+			}
+			found = true;
+		}
+	}
+	pthread_mutex_unlock(&fs->ino_bitmap_lock);
+	return found ? 0 : -ENOSPC;
+}
+
+/**
+ * find the best avaliable extent depending on length
+ * 
+ * if the block goal is free, the free extent starting there is taken (up to
+ * length blocks) so that callers can grow an existing extent in place. with
+ * block groups, the first free extent after goal in the goal's group is taken
+ * too, which keeps a file's blocks in its group.
+ * otherwise find the shortest free extent that holds length blocks (best fit),
+ * if none exist, find the longest extent possible. The free space map answers this in
+ * O(log n); the bitmap is only scanned if the map could not be kept in memory,
+ * in which case the first extent of exactly length blocks is taken instead.
+ * (caller must hold fs->dblock_bitmap_lock)
+ * 
+ * @param dblock_bitmap    points to the start of the datablock bitmap
+ * @param length    	length of the extent we want to find; at most the
+ *                  	maximum extent length is returned
+ * @param goal      	preferred first block; A1FS_NO_GOAL for none
+ * @param ext_start 	receives the first block of the extent
+ * @param ext_count 	receives the number of blocks in the extent
+ * @param fs         	file system context
+ * @return          	true on success, false on error
+ */
+bool iterate_data_bitmap(unsigned char *dblock_bitmap, uint64_t length, uint64_t goal,
+                         uint64_t *ext_start, uint64_t *ext_count, fs_ctx *fs){
+	uint64_t total = fs_data_blocks(fs);
+	if (length > a1fs_extent_max_len(fs_64bit(fs))) {
+		length = a1fs_extent_max_len(fs_64bit(fs));
+	}
+	if (goal < total) {
+		// free blocks from goal up to limit are acceptable
+		uint64_t limit = goal + 1;
+		if (fs_has_groups(fs)) {
+			uint64_t per_group = fs->sb->s_blocks_per_group;
+			limit = (goal / per_group + 1) * per_group;
+			limit = limit < total ? limit : total;
+		}
+		uint64_t start, count;
+		bool found;
+		if (fs->freemap.valid) {
+			found = freemap_next(&fs->freemap, goal, &start, &count) && start < limit;
+		} else {
+			start = bitmap_find_zero(dblock_bitmap, limit, goal);
+			found = start < limit;
+			if (found) {
+				uint64_t end = start + length < total ? start + length : total;
+				count = bitmap_find_one(dblock_bitmap, end, start) - start;
+			}
+		}
+		if (found) {
+			*ext_start = start;
+			*ext_count = count < length ? count : length;
+			return true;
+		}
+	}
+
+	if (fs->freemap.valid) {
+		uint64_t start, count;
+		if (!freemap_best_fit(&fs->freemap, length, &start, &count)) {
+			return false;
+		}
+		*ext_start = start;
+		*ext_count = count;
+		return true;
+	}
+
+	uint64_t total_blocks = fs_data_blocks(fs);
+	*ext_count = 0;
+	// visit the free runs in order; whole used or free words are skipped
+	uint64_t start = bitmap_find_zero(dblock_bitmap, total_blocks, 0);
+	while (start < total_blocks) {
+		uint64_t limit = start + length < total_blocks ? start + length : total_blocks;
+		uint64_t end = bitmap_find_one(dblock_bitmap, limit, start);
+		if (end - start == length) {
+			*ext_start = start;
+			*ext_count = length;
+			return true;
+		}
+		if (end - start > *ext_count) {
+			*ext_start = start;
+			*ext_count = end - start;
+		}
+		start = bitmap_find_zero(dblock_bitmap, total_blocks, end);
+	}
+	// no space to allocate
+	return *ext_count != 0;
+}
+
+/**
+ * Allocate a block for the extents of an inode, in the inode's group with block
+ * groups. The caller marks the block dirty once it has filled it in. (caller
+ * must hold the data block bitmap lock)
+ *
+ * @param inode  inode that owns the extents.
+ * @param blk    receives the block number.
+ * @param fs     file system context.
+ * @return       true on success; false if there is no free block.
+ */
+bool ext_alloc_block(a1fs_inode *inode, a1fs_blk_t *blk, fs_ctx *fs){
+	unsigned char *data_bitmap = fs->image + (size_t)fs->sb->dblock_bitmap * A1FS_BLOCK_SIZE;
+	uint64_t goal = fs_has_groups(fs) ? (uint64_t)(inode->inode_num / fs->sb->s_inodes_per_group) *
+	                                    fs->sb->s_blocks_per_group : A1FS_NO_GOAL;
+	uint64_t start, count;
+	if (!iterate_data_bitmap(data_bitmap, 1, goal, &start, &count, fs)) {
+		return false;
+	}
+	set_flip_block_bitmap(start, 1, fs);
+	*blk = start;
+	return true;
+}
+
+/**
+ * Move the extents of an inode into a new extent block once they no longer fit
+ * in the inode itself. (caller must hold the data block bitmap lock)
+ *
+ * @param inode  inode whose extents are kept in the inode.
+ * @param fs     file system context.
+ * @return       true on success; false if there is no free block.
+ */
+bool spill_extents(a1fs_inode *inode, fs_ctx *fs){
+	a1fs_blk_t start;
+	if (!ext_alloc_block(inode, &start, fs)) {
+		return false;
+	}
+	memcpy(fs_block(fs, start), inode->extents, inode->count_extent * sizeof(a1fs_extent));
+	fs_mark_blocks_dirty(fs, start, 1);
+	memset(inode->extents, 0, fs_inode_extents(fs) * sizeof(a1fs_extent));
+	inode_set_extent_block(inode, start, fs);
+	return true;
+}
+
+/**
+ * Insert entry (lblk, blk) into the index node at the given level of a path,
+ * right after the entry that the path followed. Full nodes are split and the
+ * root grows by one level when it is full itself; the caller makes sure that
+ * there are enough free blocks for that (see ext_split_leaf()).
+ * (caller must hold the data block bitmap lock)
+ */
+void ext_insert_index(a1fs_inode *inode, ext_path *path, int level, uint64_t lblk, a1fs_blk_t blk, fs_ctx *fs) {
+	a1fs_blk_t node_blk = path->blk[level];
+	a1fs_extent_node *node = fs_block(fs, node_blk);
+	unsigned int at = path->at[level] + 1;
+
+	// nodes are marked dirty only once they are changed: a flush clears the
+	// dirty bits of a block before writing it
+	if (node->count == A1FS_EXTENT_INDEX_LIMIT) {
+		if (level == 0) {
+			// the root stays where the inode points, so move all of its entries one level down
+			a1fs_blk_t child_blk;
+			ext_alloc_block(inode, &child_blk, fs);
+			memcpy(fs_block(fs, child_blk), node, A1FS_BLOCK_SIZE);
+			node->count = 1;
+			node->levels++;
+			a1fs_extent_index(node)[0].block = child_blk;
+			fs_mark_blocks_dirty(fs, node_blk, 1);
+
+			ext_path grown = {.blk = {path->blk[0], child_blk}, .at = {0, path->at[0]}};
+			ext_insert_index(inode, &grown, 1, lblk, blk, fs);
+			return;
+		}
+
+		// split the node and link the upper part into the parent; a node that
+		// is appended to keeps all but its last entry
+		a1fs_blk_t sibling_blk;
+		ext_alloc_block(inode, &sibling_blk, fs);
+		a1fs_extent_node *sibling = fs_block(fs, sibling_blk);
+		unsigned int half = at == node->count ? node->count - 1 : node->count / 2;
+		ext_insert_index(inode, path, level - 1, a1fs_extent_index(node)[half].lblk, sibling_blk, fs);
+		memcpy(a1fs_extent_index(sibling), &a1fs_extent_index(node)[half],
+		       (node->count - half) * sizeof(a1fs_extent_idx));
+		sibling->count = node->count - half;
+		sibling->levels = node->levels;
+		node->count = half;
+		if (at > half) {
+			fs_mark_blocks_dirty(fs, node_blk, 1);
+			node = sibling;
+			node_blk = sibling_blk;
+			at -= half;
+		} else {
+			fs_mark_blocks_dirty(fs, sibling_blk, 1);
+		}
+	}
+
+	a1fs_extent_idx *entries = a1fs_extent_index(node);
+	memmove(&entries[at + 1], &entries[at], (node->count - at) * sizeof(a1fs_extent_idx));
+	entries[at].lblk = lblk;
+	entries[at].block = blk;
+	node->count++;
+	fs_mark_blocks_dirty(fs, node_blk, 1);
+}
+
+/**
+ * Split the leaf of a path in two, moving its upper part to a new leaf. A leaf
+ * whose last extent the path points to (i.e. that is appended to) keeps all but
+ * that extent, so that files written sequentially end up with full leaves. The
+ * extent block of an inode without an extent tree becomes the first leaf of a
+ * new tree. (caller must hold the data block bitmap lock; the path is not valid
+ * afterwards)
+ *
+ * @return  true on success; false if there are not enough free blocks or the
+ *          tree reached its maximum depth.
+ */
+bool ext_split_leaf(a1fs_inode *inode, ext_path *path, fs_ctx *fs) {
+	// one block for the new leaf and one for each full index node above it,
+	// plus a new root (or a new node under a full root)
+	uint64_t needed = 1;
+	int level = path->depth - 1;
+	while (level >= 0 &&
+	       ((a1fs_extent_node*)fs_block(fs, path->blk[level]))->count == A1FS_EXTENT_INDEX_LIMIT) {
+		needed++;
+		level--;
+	}
+	if (level < 0) {
+		if (path->depth == A1FS_EXTENT_MAX_DEPTH) {
+			return false;
+		}
+		needed++;
+	}
+	if (fs_free_blocks(fs) < needed) {
+		return false;
+	}
+
+	bool wide = fs_64bit(fs);
+	unsigned int count = *path->count;
+	unsigned int half = path->i + 1 >= count ? count - 1 : count / 2;
+	uint64_t lblk = path->first;
+	for (unsigned int j = 0; j < half; j++) {
+		lblk += a1fs_extent_len(&path->extents[j], wide);
+	}
+	// extents move out of the leaf; its index is rebuilt on next use
+	extmap_forget(&fs->extmap, ext_key(inode, path));
+
+	a1fs_blk_t sibling_blk;
+	ext_alloc_block(inode, &sibling_blk, fs);
+	a1fs_extent_node *sibling = fs_block(fs, sibling_blk);
+	memcpy(a1fs_extent_leaf(sibling), &path->extents[half], (count - half) * sizeof(a1fs_extent));
+	sibling->count = count - half;
+	sibling->levels = 0;
+	fs_mark_blocks_dirty(fs, sibling_blk, 1);
+	// the block may have been a leaf of another file before
+	extmap_forget(&fs->extmap, ext_leaf_key(sibling_blk));
+
+	if (path->depth > 0) {
+		*path->count = half;
+		ext_insert_index(inode, path, path->depth - 1, lblk, sibling_blk, fs);
+	} else {
+		// the leaf is the root: put a new root above it and the new leaf
+		a1fs_extent_node *leaf = fs_block(fs, path->block);
+		if (!(inode->flags & A1FS_INODE_EXTENT_TREE)) {
+			// make room for the node header in the extent block
+			memmove(a1fs_extent_leaf(leaf), path->extents, half * sizeof(a1fs_extent));
+			inode->flags |= A1FS_INODE_EXTENT_TREE;
+		}
+		leaf->count = half;
+		leaf->levels = 0;
+
+		a1fs_blk_t root_blk;
+		ext_alloc_block(inode, &root_blk, fs);
+		a1fs_extent_node *root = fs_block(fs, root_blk);
+		root->count = 2;
+		root->levels = 1;
+		a1fs_extent_index(root)[0] = (a1fs_extent_idx){0, path->block};
+		a1fs_extent_index(root)[1] = (a1fs_extent_idx){lblk, sibling_blk};
+		fs_mark_blocks_dirty(fs, root_blk, 1);
+		inode_set_extent_block(inode, root_blk, fs);
+	}
+	fs_mark_blocks_dirty(fs, path->block, 1);
+	return true;
+}
+
+/**
+ * Make room for n more extents in the leaf of a path. The extents are moved out
+ * of the inode once they no longer fit in it, and full blocks are split (see
+ * ext_split_leaf()). The path then points to the same extent as before, which
+ * may have moved to another leaf.
+ * (caller must hold the data block bitmap lock)
+ *
+ * @return  true if the leaf has room; false otherwise.
+ */
+bool extents_room(a1fs_inode *inode, ext_path *path, unsigned int n, fs_ctx *fs){
+	while (*path->count + n > path->max) {
+		uint64_t lblk = path->first;
+		for (unsigned int j = 0; j < path->i; j++) {
+			lblk += a1fs_extent_len(&path->extents[j], fs_64bit(fs));
+		}
+		bool done = path->block == (a1fs_blk_t)-1 ? spill_extents(inode, fs) :
+		                                            ext_split_leaf(inode, path, fs);
+		if (!done) {
+			return false;
+		}
+		uint64_t first;
+		extent_find(inode, lblk, path, &first, fs);
+	}
+	return true;
+}
+
+/** Add n (possibly negative) to the number of extents of the leaf of a path. */
+void ext_count_add(a1fs_inode *inode, ext_path *path, int n) {
+	*path->count += n;
+	// the inode counts the extents of the whole tree
+	if (path->count != &inode->count_extent) {
+		inode->count_extent += n;
+	}
+}
+
+/**
+ * Mark the leaf of a path dirty and bring its offset index up to date after
+ * extents were appended to, removed from, or resized at its end.
+ */
+void ext_leaf_changed(a1fs_inode *inode, ext_path *path, fs_ctx *fs) {
+	if (path->block != (a1fs_blk_t)-1) {
+		fs_mark_blocks_dirty(fs, path->block, 1);
+	}
+	extmap_update(&fs->extmap, ext_key(inode, path), path->extents, *path->count);
+}
+
+/**
+ * Replace extents [lo, hi) of the leaf of a path by the k extents in piece. The
+ * leaf must have room for them (see extents_room()).
+ */
+void ext_splice(a1fs_inode *inode, ext_path *path, unsigned int lo, unsigned int hi,
+                const a1fs_extent *piece, unsigned int k, fs_ctx *fs) {
+	a1fs_extent *extent = path->extents;
+	memmove(&extent[lo + k], &extent[hi], (*path->count - hi) * sizeof(a1fs_extent));
+	memcpy(&extent[lo], piece, k * sizeof(a1fs_extent));
+	ext_count_add(inode, path, (int)k - (int)(hi - lo));
+	if (path->block != (a1fs_blk_t)-1) {
+		fs_mark_blocks_dirty(fs, path->block, 1);
+	}
+	// extents moved within the leaf; the index is rebuilt on next use
+	extmap_forget(&fs->extmap, ext_key(inode, path));
+}
+
+/**
+ * Remove the empty last leaf of an extent tree, along with the index nodes it
+ * leaves empty. The root is replaced by its only child while it has just one,
+ * and the tree goes away with the last extent of the inode.
+ * (caller must hold the data block bitmap lock)
+ */
+void ext_remove_leaf(a1fs_inode *inode, ext_path *path, fs_ctx *fs) {
+	extmap_forget(&fs->extmap, ext_key(inode, path));
+	unset_flip_block_bitmap(path->block, 1, fs);
+	int level = path->depth - 1;
+	while (level >= 0 && ((a1fs_extent_node*)fs_block(fs, path->blk[level]))->count == 1) {
+		unset_flip_block_bitmap(path->blk[level], 1, fs);
+		level--;
+	}
+	if (level < 0) {
+		inode_set_extent_block(inode, -1, fs);
+		inode->flags &= ~A1FS_INODE_EXTENT_TREE;
+		return;
+	}
+	// the leaf is the last one, so its entries are the last ones too
+	((a1fs_extent_node*)fs_block(fs, path->blk[level]))->count--;
+	fs_mark_blocks_dirty(fs, path->blk[level], 1);
+
+	a1fs_extent_node *root = fs_block(fs, inode_extent_block(inode, fs));
+	while (root->levels > 0 && root->count == 1) {
+		a1fs_blk_t child = a1fs_extent_index(root)[0].block;
+		unset_flip_block_bitmap(inode_extent_block(inode, fs), 1, fs);
+		inode_set_extent_block(inode, child, fs);
+		root = fs_block(fs, child);
+	}
+}
+
+/**
+ * Set blocks to the inode
+ * 
+ * The caller must hold the inode's write lock; the data block bitmap lock is
+ * taken here.
+ *
+ * New blocks are zeroed, unless they are allocated as unwritten extents, which
+ * read as zeros without being written to (see convert_unwritten()). The
+ * extents are kept in the inode until they outgrow it (see extents_room()).
+ *
+ * @param inode      pointer to inode that needs to allocate block
+ * @param num_blocks  number of blocks that needs to be allocated to that inode
+ * @param unwritten  whether to allocate unwritten extents
  * @param fs         file system context
  * @return           return 0 on success, -ENOSPC if not enough space available
 **/
-int set_block(a1fs_inode *inode, int num_blocks, fs_ctx *fs){
+int set_block(a1fs_inode *inode, uint64_t num_blocks, bool unwritten, fs_ctx *fs){
+	int ret = -ENOSPC;
+	pthread_mutex_lock(&fs->dblock_bitmap_lock);
 	// check space
-	if(fs->sb->s_free_blocks_count == 0) {
-		return -ENOSPC;
-	} else if(num_blocks > (int)fs->sb->s_free_blocks_count) {
-		return -ENOSPC;
-	} else if (inode->count_extent == A1FS_BLOCK_SIZE / sizeof(a1fs_extent)) {
-		return -ENOSPC;
+	if(fs_free_blocks(fs) == 0) {
+		goto end;
+	} else if(num_blocks > fs_free_blocks(fs)) {
+		goto end;
 	}
 	// find the address of the start of the data bitmap
-	unsigned char *data_bitmap = fs->image + fs->sb->dblock_bitmap * A1FS_BLOCK_SIZE;
-	a1fs_extent extent;
-	// if the inode does not have an extent allocated, initialize one.
-	if((inode->indirect_block) == -1){
+	unsigned char *data_bitmap = fs->image + (size_t)fs->sb->dblock_bitmap * A1FS_BLOCK_SIZE;
+	bool wide = fs_64bit(fs);
+	uint64_t start, count;
+	while(num_blocks > 0){
+		// aim right after the last extent (or at the start of the inode's group
+		// for the first one) so that appends extend the last extent instead of
+		// adding one
+		ext_path path;
+		a1fs_extent *last = extent_last(inode, &path, fs);
+		if (last && a1fs_extent_hole(last, wide)) {
+			// there are no blocks to grow after a hole
+			last = NULL;
+		}
+		uint64_t goal = A1FS_NO_GOAL;
+		if (last) {
+			goal = a1fs_extent_start(last, wide) + a1fs_extent_len(last, wide);
+		} else if (fs_has_groups(fs)) {
+			goal = (uint64_t)(inode->inode_num / fs->sb->s_inodes_per_group) * fs->sb->s_blocks_per_group;
+		}
 		// find place to allocate, check if no space to allocate.
-		if (!iterate_data_bitmap(data_bitmap, 1, &extent, fs)){
-			return ENOSPC;
+		if (!iterate_data_bitmap(data_bitmap, num_blocks, goal, &start, &count, fs)){
+			goto end;
+		}
+		bool merge = last && start == goal &&
+		             a1fs_extent_unwritten(last) == unwritten &&
+		             a1fs_extent_len(last, wide) + count <= a1fs_extent_max_len(wide);
+		if (!merge && *path.count == path.max) {
+			// the leaf is full: make room and search again, the new blocks may
+			// have been taken from the run found
+			if (!extents_room(inode, &path, 1, fs)) {
+				goto end;
+			}
+			continue;
+		}
+		set_flip_block_bitmap(start, count, fs);
+		if (!unwritten) {
+			memset(fs_block(fs, start), 0, (size_t)count * A1FS_BLOCK_SIZE);
+			fs_mark_blocks_dirty(fs, start, count);
 		}
-		set_flip_block_bitmap(extent.start, fs);
-		inode->indirect_block = extent.start;
+		num_blocks -= count;
+		if (merge) {
+			last->count += count;
+		} else {
+			path.extents[*path.count] = a1fs_extent_make(start, count, unwritten, wide);
+			ext_count_add(inode, &path, 1);
+		}
+		ext_leaf_changed(inode, &path, fs);
 	}
-	a1fs_extent *extents = fs->image + (fs->sb->s_first_data_block + inode->indirect_block) * A1FS_BLOCK_SIZE;
-	while(num_blocks > 0){
-		// find place to allocate, check if no space to allocate.
-		if (!iterate_data_bitmap(data_bitmap, num_blocks, &extent, fs)){
-			return ENOSPC;
+	ret = 0;
+
+end:
+	pthread_mutex_unlock(&fs->dblock_bitmap_lock);
+	return ret;
+}
+
+/**
+ * Unset blocks from the inode
+ * 
+ * @param inode      pointer to inode to allocate space for
+ * @param num_blocks  number of blocks that needs to be allocated to that inode
+ * @param fs         file system context
+ * @return           return 0 on success, otherwise return -1
+**/
+int unset_block(a1fs_inode *inode, uint64_t num_blocks, fs_ctx *fs){
+	bool wide = fs_64bit(fs);
+	pthread_mutex_lock(&fs->dblock_bitmap_lock);
+	while(num_blocks > 0 && inode->count_extent > 0) {
+		// free blocks from the end of the last extent
+		ext_path path;
+		a1fs_extent *last = extent_last(inode, &path, fs);
+		uint64_t len = a1fs_extent_len(last, wide);
+		uint64_t n = num_blocks < len ? num_blocks : len;
+		if (!a1fs_extent_hole(last, wide)) {
+			release_blocks(inode, a1fs_extent_start(last, wide) + len - n, n, fs);
+		}
+		// the unwritten flag and the high bits of the start are above the length
+		last->count -= n;
+		if (n == len) {
+			ext_count_add(inode, &path, -1);
 		}
-		for(unsigned int i = extent.start; i < extent.start + extent.count; i++){
-			set_flip_block_bitmap(i, fs);
-			a1fs_blk_t *dblock = fs->image + (fs->sb->s_first_data_block + i) * A1FS_BLOCK_SIZE;
-			memset(dblock, 0, A1FS_BLOCK_SIZE);
+		num_blocks -= n;
+		if (*path.count == 0 && (inode->flags & A1FS_INODE_EXTENT_TREE)) {
+			ext_remove_leaf(inode, &path, fs);
+		} else {
+			ext_leaf_changed(inode, &path, fs);
 		}
-		extents[inode->count_extent] = extent;
-		inode->count_extent++;
-		num_blocks -= extent.count;
 	}
+	// a file without blocks does not need an extent block either
+	if (inode->count_extent == 0 && inode->indirect_block != -1) {
+		unset_flip_block_bitmap(inode_extent_block(inode, fs), 1, fs);
+		inode_set_extent_block(inode, -1, fs);
+	}
+	pthread_mutex_unlock(&fs->dblock_bitmap_lock);
 
 	return 0;
 }
 
-/** 
- * Add the directory entry to the given directory. 
- * 
- * If the dentry is added successfully, return 0.
- * Otherwise return not enough free space error.
+/**
+ * Append a hole of num_blocks blocks to the end of a file.
+ *
+ * @return  0 on success; -ENOSPC if there is no room for the extents.
  */
-int add_dentry(struct a1fs_inode *dir_parent, char *parent_name, struct a1fs_inode *dir, fs_ctx *fs) {
-	// set block if the directory has no space for new directory entry
-	int enough_space = dir_parent->size % A1FS_BLOCK_SIZE;
-	if (enough_space == 0) {
-		int value = set_block(dir_parent, 1, fs);
-		if (value != 0) {
-			return -ENOSPC;
+int add_hole(a1fs_inode *inode, uint64_t num_blocks, fs_ctx *fs){
+	int ret = 0;
+	bool wide = fs_64bit(fs);
+	uint64_t max_len = a1fs_extent_max_len(wide);
+	while (num_blocks > 0) {
+		ext_path path;
+		a1fs_extent *last = extent_last(inode, &path, fs);
+		if (last && a1fs_extent_hole(last, wide) && a1fs_extent_len(last, wide) < max_len) {
+			uint64_t n = max_len - a1fs_extent_len(last, wide);
+			n = num_blocks < n ? num_blocks : n;
+			last->count += n;
+			num_blocks -= n;
+			ext_leaf_changed(inode, &path, fs);
+			continue;
 		}
+		pthread_mutex_lock(&fs->dblock_bitmap_lock);
+		bool room = extents_room(inode, &path, 1, fs);
+		pthread_mutex_unlock(&fs->dblock_bitmap_lock);
+		if (!room) {
+			ret = -ENOSPC;
+			break;
+		}
+		uint64_t n = num_blocks < max_len ? num_blocks : max_len;
+		path.extents[*path.count] = a1fs_extent_make_hole(n, wide);
+		ext_count_add(inode, &path, 1);
+		ext_leaf_changed(inode, &path, fs);
+		num_blocks -= n;
 	}
+	return ret;
+}
 
-	struct a1fs_extent *extent;
-	extent = (struct a1fs_extent*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + dir_parent->indirect_block));
-	int i = dir_parent->count_extent;
-	int j = extent[i-1].start + extent[i-1].count - 1;
-	
-	// add the directory entry to the last block
-	struct a1fs_dentry *dentry;
-	dentry = (struct a1fs_dentry*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + j) + enough_space);
+/**
+ * Allocate unwritten blocks for the holes in logical blocks [lblk, end) of a
+ * file. Each hole is replaced by the blocks found for it, with the parts of the
+ * hole outside of the range left as holes on either side. The blocks of a hole
+ * that directly follows allocated blocks are placed right after them.
+ *
+ * @param inode  file inode.
+ * @param lblk   first logical block of the range.
+ * @param end    logical block after the range; must not be past the extents.
+ * @param fs     file system context.
+ * @return       0 on success; -ENOSPC if there is not enough free space for
+ *               the blocks or the extents.
+ */
+int fill_holes(a1fs_inode *inode, uint64_t lblk, uint64_t end, fs_ctx *fs){
+	unsigned char *data_bitmap = fs->image + (size_t)fs->sb->dblock_bitmap * A1FS_BLOCK_SIZE;
+	bool wide = fs_64bit(fs);
+	int ret = 0;
+	while (lblk < end) {
+		ext_path path;
+		uint64_t first;
+		a1fs_extent *e = extent_find(inode, lblk, &path, &first, fs);
+		uint64_t len = a1fs_extent_len(e, wide);
+		if (!a1fs_extent_hole(e, wide)) {
+			lblk = first + len;
+			continue;
+		}
 
-	dentry->ino = dir->inode_num;
-	char name[A1FS_NAME_MAX];
-	strcpy(name, parent_name);
-	strcpy(dentry->name, name);
+		uint64_t want = (end < first + len ? end : first + len) - lblk;
+		uint64_t goal = A1FS_NO_GOAL;
+		a1fs_extent *prev = path.i > 0 ? &path.extents[path.i - 1] : NULL;
+		if (lblk == first && prev && !a1fs_extent_hole(prev, wide)) {
+			goal = a1fs_extent_start(prev, wide) + a1fs_extent_len(prev, wide);
+		} else if (fs_has_groups(fs)) {
+			goal = (uint64_t)(inode->inode_num / fs->sb->s_inodes_per_group) * fs->sb->s_blocks_per_group;
+		}
+		pthread_mutex_lock(&fs->dblock_bitmap_lock);
+		uint64_t start, count;
+		if (fs_free_blocks(fs) == 0 ||
+		    !iterate_data_bitmap(data_bitmap, want, goal, &start, &count, fs)) {
+			pthread_mutex_unlock(&fs->dblock_bitmap_lock);
+			ret = -ENOSPC;
+			break;
+		}
+		set_flip_block_bitmap(start, count, fs);
+		// the hole becomes [hole] run [hole]
+		a1fs_extent piece[3];
+		unsigned int k = 0;
+		if (lblk > first) {
+			piece[k++] = a1fs_extent_make_hole(lblk - first, wide);
+		}
+		piece[k++] = a1fs_extent_make(start, count, true, wide);
+		if (lblk + count < first + len) {
+			piece[k++] = a1fs_extent_make_hole(first + len - lblk - count, wide);
+		}
+		if (!extents_room(inode, &path, k - 1, fs)) {
+			unset_flip_block_bitmap(start, count, fs);
+			pthread_mutex_unlock(&fs->dblock_bitmap_lock);
+			ret = -ENOSPC;
+			break;
+		}
+		pthread_mutex_unlock(&fs->dblock_bitmap_lock);
 
-	if ((dir_parent->mode & S_IFDIR) == S_IFDIR) {
-		dir_parent->links++;
+		ext_splice(inode, &path, path.i, path.i + 1, piece, k, fs);
+		lblk += count;
+	}
+	return ret;
+}
+
+/**
+ * Append a new zero-filled block to an indexed directory.
+ *
+ * @param dir   directory inode.
+ * @param lblk  receives the logical block number of the new block.
+ * @param fs    file system context.
+ * @return      pointer to the new block; NULL if there is no free space.
+ */
+void *dir_new_block(a1fs_inode *dir, a1fs_blk_t *lblk, fs_ctx *fs) {
+	if (set_block(dir, 1, false, fs) != 0) {
+		return NULL;
+	}
+	*lblk = dir->size / A1FS_BLOCK_SIZE;
+	dir->size += A1FS_BLOCK_SIZE;
+	return inode_block(dir, *lblk, fs);
+}
+
+/**
+ * Give back the last block of an indexed directory, added by dir_new_block()
+ * for an index change that failed.
+ */
+void dir_drop_block(a1fs_inode *dir, fs_ctx *fs) {
+	unset_block(dir, 1, fs);
+	dir->size -= A1FS_BLOCK_SIZE;
+}
+
+/**
+ * Insert entry (hash, block) into the index node at the given level of a path,
+ * right after the entry that the path followed. Full nodes are split and the
+ * root grows by one level when it is full itself.
+ *
+ * On failure the index and the blocks of the directory are left as they were,
+ * so that the caller can give back a block it added for the entry.
+ *
+ * @return  0 on success; -ENOSPC if there is no free space or the index
+ *          reached its maximum depth.
+ */
+int dx_insert(a1fs_inode *dir, dx_frame *frames, int level, uint32_t hash, a1fs_blk_t block, fs_ctx *fs) {
+	a1fs_dx_node *node = frames[level].node;
+	unsigned int at = frames[level].at + 1;
+
+	// nodes are marked dirty only once they are changed: a flush clears the
+	// dirty bits of a block before writing it
+	if (node->count == A1FS_DX_LIMIT) {
+		if (level == 0) {
+			// the root stays at block 0, so move all of its entries one level down
+			if (node->levels + 1 >= A1FS_DX_MAX_DEPTH) {
+				return -ENOSPC;
+			}
+			a1fs_blk_t child_blk;
+			a1fs_dx_node *child = dir_new_block(dir, &child_blk, fs);
+			if (child == NULL) {
+				return -ENOSPC;
+			}
+			memcpy(child->entries, node->entries, node->count * sizeof(a1fs_dx_entry));
+			child->count = node->count;
+			child->levels = node->levels;
+			node->count = 1;
+			node->levels++;
+			node->entries[0].hash = 0;
+			node->entries[0].block = child_blk;
+			fs_mark_dirty(fs, node, A1FS_BLOCK_SIZE);
+
+			dx_frame grown[2] = {{node, 0}, {child, frames[0].at}};
+			int value = dx_insert(dir, grown, 1, hash, block, fs);
+			if (value != 0) {
+				// move the entries back up and give back the child
+				memcpy(node->entries, child->entries, child->count * sizeof(a1fs_dx_entry));
+				node->count = child->count;
+				node->levels = child->levels;
+				fs_mark_dirty(fs, node, A1FS_BLOCK_SIZE);
+				dir_drop_block(dir, fs);
+			}
+			return value;
+		}
+
+		// split the node in half and link the upper half into the parent
+		a1fs_blk_t sibling_blk;
+		a1fs_dx_node *sibling = dir_new_block(dir, &sibling_blk, fs);
+		if (sibling == NULL) {
+			return -ENOSPC;
+		}
+		unsigned int half = node->count / 2;
+		int value = dx_insert(dir, frames, level - 1, node->entries[half].hash, sibling_blk, fs);
+		if (value != 0) {
+			dir_drop_block(dir, fs);
+			return value;
+		}
+		memcpy(sibling->entries, &node->entries[half], (node->count - half) * sizeof(a1fs_dx_entry));
+		sibling->count = node->count - half;
+		sibling->levels = node->levels;
+		node->count = half;
+		if (at > half) {
+			fs_mark_dirty(fs, node, A1FS_BLOCK_SIZE);
+			node = sibling;
+			at -= half;
+		} else {
+			fs_mark_dirty(fs, sibling, A1FS_BLOCK_SIZE);
+		}
 	}
-	dir_parent->size += sizeof(a1fs_dentry);
+
+	memmove(&node->entries[at + 1], &node->entries[at], (node->count - at) * sizeof(a1fs_dx_entry));
+	node->entries[at].hash = hash;
+	node->entries[at].block = block;
+	node->count++;
+	fs_mark_dirty(fs, node, A1FS_BLOCK_SIZE);
 	return 0;
 }
 
+int compare_hash(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
 /**
- * Create a directory.
+ * Turn a linear directory with one full block into an indexed directory.
  *
- * Implements the mkdir() system call.
+ * The existing entries move to a new leaf and block 0 becomes the index root.
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" doesn't exist.
- *   The parent directory of "path" exists and is a directory.
- *   "path" and its components are not too long.
+ * @return  0 on success; -ENOSPC if there is no free space.
+ */
+int dx_convert(a1fs_inode *dir, fs_ctx *fs) {
+	a1fs_blk_t leaf_blk;
+	a1fs_dentry *leaf = dir_new_block(dir, &leaf_blk, fs);
+	if (leaf == NULL) {
+		return -ENOSPC;
+	}
+	a1fs_dx_node *root = inode_block(dir, 0, fs);
+	memcpy(leaf, root, A1FS_BLOCK_SIZE);
+	fs_mark_dirty(fs, leaf, A1FS_BLOCK_SIZE);
+	memset(root, 0, A1FS_BLOCK_SIZE);
+	root->count = 1;
+	root->levels = 0;
+	root->nentries = fs_compact_dirs(fs) ? dirblock_count(leaf) : A1FS_DENTRIES_PER_BLOCK;
+	root->entries[0].hash = 0;
+	root->entries[0].block = leaf_blk;
+	fs_mark_dirty(fs, root, A1FS_BLOCK_SIZE);
+	dir->flags |= A1FS_INODE_INDEXED;
+	return 0;
+}
+
+/**
+ * Choose the hash at which a full index leaf is split: the hash boundary
+ * closest to the middle of its entries, since names with equal hashes must stay
+ * in the same leaf.
+ *
+ * @param hashes  hashes of the entries of the leaf; sorted in place.
+ * @param n       number of entries.
+ * @return        lowest hash that moves to the new leaf; 0 if all hashes are
+ *                equal and the leaf cannot be split.
+ */
+uint32_t dx_split_hash(uint32_t *hashes, unsigned int n) {
+	qsort(hashes, n, sizeof(uint32_t), compare_hash);
+	unsigned int mid = n / 2;
+	for (unsigned int d = 0; d < mid; d++) {
+		if (hashes[mid + d] != hashes[mid + d - 1]) {
+			return hashes[mid + d];
+		} else if (mid - d > 1 && hashes[mid - d - 1] != hashes[mid - d - 2]) {
+			return hashes[mid - d - 1];
+		}
+	}
+	return 0;
+}
+
+/**
+ * Split a full leaf of a directory with variable length entries: the records
+ * with hashes from split_hash up move to new_leaf, and both leaves are packed.
+ */
+void dx_split_dirents(void *leaf, void *new_leaf, uint32_t split_hash) {
+	char old[A1FS_BLOCK_SIZE];
+	memcpy(old, leaf, A1FS_BLOCK_SIZE);
+	dirblock_init(leaf);
+	dirblock_init(new_leaf);
+	for (a1fs_dirent *de = (a1fs_dirent*)old; dirent_in_block(old, de); de = dirent_next(de)) {
+		if (de->name_len != 0) {
+			dirblock_add(de->hash >= split_hash ? new_leaf : leaf, de->name, de->name_len,
+			             de->hash, de->ino, de->file_type);
+		}
+	}
+}
+
+/**
+ * Add an entry to an indexed directory, splitting the leaf if it is full.
+ *
+ * @param file_type  file type of the entry (only recorded with compact
+ *                   directories).
+ * @return           0 on success; -ENOSPC if there is no free space.
+ */
+int dx_add(a1fs_inode *dir, const char *name, a1fs_ino_t ino, uint8_t file_type, fs_ctx *fs) {
+	uint32_t hash = a1fs_name_hash(name);
+	size_t len = strlen(name);
+	bool compact = fs_compact_dirs(fs);
+	dx_frame frames[A1FS_DX_MAX_DEPTH];
+	int depth = dx_probe(dir, hash, frames, fs);
+	void *leaf = dx_leaf(dir, &frames[depth - 1], fs);
+
+	a1fs_dentry *slot = NULL;
+	a1fs_dirent *added = NULL;
+	if (compact) {
+		added = dirblock_add(leaf, name, len, hash, ino, file_type);
+	} else {
+		a1fs_dentry *dentry = leaf;
+		for (unsigned int k = 0; k < A1FS_DENTRIES_PER_BLOCK && slot == NULL; k++) {
+			if (dentry[k].name[0] == '\0') {
+				slot = &dentry[k];
+			}
+		}
+	}
+
+	if (slot == NULL && added == NULL) {
+		uint32_t hashes[A1FS_DIRENTS_PER_BLOCK_MAX];
+		unsigned int n = 0;
+		if (compact) {
+			for (a1fs_dirent *de = leaf; dirent_in_block(leaf, de); de = dirent_next(de)) {
+				if (de->name_len != 0) {
+					hashes[n++] = de->hash;
+				}
+			}
+		} else {
+			a1fs_dentry *dentry = leaf;
+			for (; n < A1FS_DENTRIES_PER_BLOCK; n++) {
+				hashes[n] = a1fs_name_hash(dentry[n].name);
+			}
+		}
+		uint32_t split_hash = dx_split_hash(hashes, n);
+		if (split_hash == 0) {
+			return -ENOSPC;
+		}
+
+		a1fs_blk_t new_blk;
+		void *new_leaf = dir_new_block(dir, &new_blk, fs);
+		if (new_leaf == NULL) {
+			return -ENOSPC;
+		}
+		int value = dx_insert(dir, frames, depth - 1, split_hash, new_blk, fs);
+		if (value != 0) {
+			dir_drop_block(dir, fs);
+			return value;
+		}
+		void *target = hash >= split_hash ? new_leaf : leaf;
+		if (compact) {
+			dx_split_dirents(leaf, new_leaf, split_hash);
+			added = dirblock_add(target, name, len, hash, ino, file_type);
+		} else {
+			a1fs_dentry *dentry = leaf;
+			a1fs_dentry *moved = new_leaf;
+			for (unsigned int k = 0; k < A1FS_DENTRIES_PER_BLOCK; k++) {
+				if (a1fs_name_hash(dentry[k].name) >= split_hash) {
+					*moved++ = dentry[k];
+					memset(&dentry[k], 0, sizeof(a1fs_dentry));
+				}
+			}
+			dentry = target;
+			for (unsigned int k = 0; k < A1FS_DENTRIES_PER_BLOCK && slot == NULL; k++) {
+				if (dentry[k].name[0] == '\0') {
+					slot = &dentry[k];
+				}
+			}
+		}
+		fs_mark_dirty(fs, new_leaf, A1FS_BLOCK_SIZE);
+		// the half with the new name can still be too full for a long name
+		if (compact && added == NULL) {
+			fs_mark_dirty(fs, leaf, A1FS_BLOCK_SIZE);
+			return -ENOSPC;
+		}
+	}
+
+	if (slot != NULL) {
+		slot->ino = ino;
+		strcpy(slot->name, name);
+	}
+	frames[0].node->nentries++;
+	fs_mark_dirty(fs, leaf, A1FS_BLOCK_SIZE);
+	fs_mark_dirty(fs, frames[0].node, A1FS_BLOCK_SIZE);
+	return 0;
+}
+
+/**
+ * Add an entry to a directory with variable length entries.
+ *
+ * A linear directory puts the entry in a block with room for it, and grows by
+ * a block if there is none; with A1FS_FEATURE_DIR_INDEX, it becomes
+ * indexed instead once its first block is full.
+ *
+ * @return  0 on success; -ENOSPC if there is no free space.
+ */
+int add_dirent(a1fs_inode *dir, const char *name, a1fs_inode *inode, fs_ctx *fs) {
+	size_t len = strlen(name);
+	uint32_t hash = a1fs_name_hash(name);
+	uint8_t file_type = (inode->mode & S_IFMT) >> 12;
+	if (!(dir->flags & A1FS_INODE_INDEXED)) {
+		// start with the last block, which has room unless it filled up
+		uint64_t nblocks = dir->size / A1FS_BLOCK_SIZE;
+		for (uint64_t k = 0; k < nblocks; k++) {
+			void *block = inode_block(dir, (nblocks - 1 + k) % nblocks, fs);
+			if (dirblock_add(block, name, len, hash, inode->inode_num, file_type) != NULL) {
+				fs_mark_dirty(fs, block, A1FS_BLOCK_SIZE);
+				return 0;
+			}
+		}
+		if (nblocks != 1 || !(fs->sb->s_features & A1FS_FEATURE_DIR_INDEX)) {
+			a1fs_blk_t lblk;
+			void *block = dir_new_block(dir, &lblk, fs);
+			if (block == NULL) {
+				return -ENOSPC;
+			}
+			dirblock_init(block);
+			dirblock_add(block, name, len, hash, inode->inode_num, file_type);
+			fs_mark_dirty(fs, block, A1FS_BLOCK_SIZE);
+			return 0;
+		}
+		if (dx_convert(dir, fs) != 0) {
+			return -ENOSPC;
+		}
+	}
+	return dx_add(dir, name, inode->inode_num, file_type, fs);
+}
+
+/**
+ * Find the first unused slot of a linear directory with fixed size entries.
+ *
+ * @return  the slot; NULL if all the slots up to the directory size are used.
+ */
+a1fs_dentry *free_dentry(a1fs_inode *dir, fs_ctx *fs) {
+	uint64_t count = dir->size / sizeof(a1fs_dentry);
+	a1fs_dentry *block = NULL;
+	for (uint64_t i = 0; i < count; i++) {
+		if (block == NULL || i % A1FS_DENTRIES_PER_BLOCK == 0) {
+			block = inode_block(dir, i / A1FS_DENTRIES_PER_BLOCK, fs);
+		}
+		if (block[i % A1FS_DENTRIES_PER_BLOCK].name[0] == '\0') {
+			return &block[i % A1FS_DENTRIES_PER_BLOCK];
+		}
+	}
+	return NULL;
+}
+
+/** 
+ * Add the directory entry to the given directory. 
+ * 
+ * If the dentry is added successfully, return 0.
+ * Otherwise return not enough free space error.
+ */
+int add_dentry(struct a1fs_inode *dir_parent, char *parent_name, struct a1fs_inode *dir, fs_ctx *fs) {
+	if (fs_compact_dirs(fs)) {
+		if (add_dirent(dir_parent, parent_name, dir, fs) != 0) {
+			return -ENOSPC;
+		}
+		if ((dir->mode & S_IFDIR) == S_IFDIR) {
+			dir_parent->links++;
+		}
+		dcache_insert(&fs->dcache, dir_parent->inode_num, parent_name, dir->inode_num);
+		return 0;
+	}
+	// the slot of a removed entry is reused before the directory grows
+	struct a1fs_dentry *dentry = NULL;
+	if (!(dir_parent->flags & A1FS_INODE_INDEXED)) {
+		dentry = free_dentry(dir_parent, fs);
+	}
+	// a linear directory that outgrows its first block becomes indexed
+	if (dentry == NULL && !(dir_parent->flags & A1FS_INODE_INDEXED) &&
+	    (fs->sb->s_features & A1FS_FEATURE_DIR_INDEX) && dir_parent->size == A1FS_BLOCK_SIZE) {
+		if (dx_convert(dir_parent, fs) != 0) {
+			return -ENOSPC;
+		}
+	}
+	if (dir_parent->flags & A1FS_INODE_INDEXED) {
+		if (dx_add(dir_parent, parent_name, dir->inode_num, 0, fs) != 0) {
+			return -ENOSPC;
+		}
+		if ((dir->mode & S_IFDIR) == S_IFDIR) {
+			dir_parent->links++;
+		}
+		dcache_insert(&fs->dcache, dir_parent->inode_num, parent_name, dir->inode_num);
+		return 0;
+	}
+
+	if (dentry == NULL) {
+		// set block if the directory has no space for new directory entry
+		int enough_space = dir_parent->size % A1FS_BLOCK_SIZE;
+		if (enough_space == 0) {
+			int value = set_block(dir_parent, 1, false, fs);
+			if (value != 0) {
+				return -ENOSPC;
+			}
+		}
+
+		ext_path path;
+		a1fs_extent *last = extent_last(dir_parent, &path, fs);
+		a1fs_blk_t j = a1fs_extent_start(last, fs_64bit(fs)) + a1fs_extent_len(last, fs_64bit(fs)) - 1;
+
+		// add the directory entry to the last block
+		dentry = (struct a1fs_dentry*)((char*)fs_block(fs, j) + enough_space);
+		dir_parent->size += sizeof(a1fs_dentry);
+	}
+
+	dentry->ino = dir->inode_num;
+	char name[A1FS_NAME_MAX];
+	strcpy(name, parent_name);
+	strcpy(dentry->name, name);
+	fs_mark_dirty(fs, dentry, sizeof(a1fs_dentry));
+
+	if ((dir->mode & S_IFDIR) == S_IFDIR) {
+		dir_parent->links++;
+	}
+	dcache_insert(&fs->dcache, dir_parent->inode_num, parent_name, dir->inode_num);
+	return 0;
+}
+
+/**
+ * Remove an entry from a directory with variable length entries. A linear
+ * directory gives back the blocks at its end that are left empty, so that it
+ * has no blocks once it has no entries.
+ */
+int rm_dirent(a1fs_inode *dir, a1fs_dirent *de, fs_ctx *fs) {
+	size_t at = (char*)de - (char*)fs->image;
+	void *block = (char*)fs->image + at / A1FS_BLOCK_SIZE * A1FS_BLOCK_SIZE;
+	bool empty = dirblock_remove(block, de);
+	fs_mark_dirty(fs, block, A1FS_BLOCK_SIZE);
+	if (dir->flags & A1FS_INODE_INDEXED) {
+		a1fs_dx_node *root = inode_block(dir, 0, fs);
+		root->nentries--;
+		fs_mark_dirty(fs, root, A1FS_BLOCK_SIZE);
+		return 0;
+	}
+	while (empty && dir->size > 0 &&
+	       dirblock_empty(inode_block(dir, dir->size / A1FS_BLOCK_SIZE - 1, fs))) {
+		if (unset_block(dir, 1, fs) != 0) {
+			return -1;
+		}
+		dir->size -= A1FS_BLOCK_SIZE;
+	}
+	return 0;
+}
+
+/** 
+ * Remove the directory entry from the given directory. 
+ * 
+ * If the dentry is removed successfully, return 0.
+ * Otherwise return -1.
+ */
+int rm_dentry(struct a1fs_inode *dir_parent, char *dir_name, void *dir, fs_ctx *fs) {
+	dcache_remove(&fs->dcache, dir_parent->inode_num, dir_name);
+	if (fs_compact_dirs(fs)) {
+		return rm_dirent(dir_parent, dir, fs);
+	}
+	// indexed directories just free the slot in the leaf
+	if (dir_parent->flags & A1FS_INODE_INDEXED) {
+		memset(dir, 0, sizeof(a1fs_dentry));
+		a1fs_dx_node *root = inode_block(dir_parent, 0, fs);
+		root->nentries--;
+		fs_mark_dirty(fs, dir, sizeof(a1fs_dentry));
+		fs_mark_dirty(fs, root, A1FS_BLOCK_SIZE);
+		return 0;
+	}
+
+	// leave the slot unused so that the other entries keep their readdir
+	// offsets, and give back the unused slots at the end of the directory
+	memset(dir, 0, sizeof(a1fs_dentry));
+	fs_mark_dirty(fs, dir, sizeof(a1fs_dentry));
+	while (dir_parent->size > 0) {
+		uint64_t last = dir_parent->size / sizeof(a1fs_dentry) - 1;
+		a1fs_dentry *block = inode_block(dir_parent, last / A1FS_DENTRIES_PER_BLOCK, fs);
+		if (block[last % A1FS_DENTRIES_PER_BLOCK].name[0] != '\0') {
+			break;
+		}
+		dir_parent->size -= sizeof(a1fs_dentry);
+		if (dir_parent->size % A1FS_BLOCK_SIZE == 0) {
+			int value = unset_block(dir_parent, 1, fs);
+			if (value != 0) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Free the blocks of an extent tree node and of the nodes below it (not the
+ * data blocks). (caller must hold the data block bitmap lock)
+ */
+void ext_free_node(a1fs_blk_t blk, fs_ctx *fs) {
+	a1fs_extent_node *node = fs_block(fs, blk);
+	if (node->levels == 0) {
+		extmap_forget(&fs->extmap, ext_leaf_key(blk));
+	}
+	for (unsigned int j = 0; node->levels > 0 && j < node->count; j++) {
+		ext_free_node(a1fs_extent_index(node)[j].block, fs);
+	}
+	unset_flip_block_bitmap(blk, 1, fs);
+}
+
+/**
+ * Release all data blocks, the extent blocks, and the inode bitmap entry of an
+ * inode that is no longer referenced.
+ */
+void free_inode(a1fs_inode *inode, fs_ctx *fs) {
+	extmap_forget(&fs->extmap, inode->inode_num);
+	if (inode->count_extent > 0 || inode->indirect_block != -1) {
+		pthread_mutex_lock(&fs->dblock_bitmap_lock);
+		ext_path path;
+		for (a1fs_extent *e = extent_first(inode, &path, fs); e; e = extent_next(&path, fs)) {
+			if (!a1fs_extent_hole(e, fs_64bit(fs))) {
+				release_blocks(inode, a1fs_extent_start(e, fs_64bit(fs)),
+				               a1fs_extent_len(e, fs_64bit(fs)), fs);
+			}
+		}
+		if (inode->flags & A1FS_INODE_EXTENT_TREE) {
+			ext_free_node(inode_extent_block(inode, fs), fs);
+		} else if (inode->indirect_block != -1) {
+			unset_flip_block_bitmap(inode_extent_block(inode, fs), 1, fs);
+		}
+		pthread_mutex_unlock(&fs->dblock_bitmap_lock);
+		inode_set_extent_block(inode, -1, fs);
+		inode->flags &= ~A1FS_INODE_EXTENT_TREE;
+		inode->count_extent = 0;
+		inode_dirty(inode, fs);
+	}
+	pthread_mutex_lock(&fs->ino_bitmap_lock);
+	unset_flip_inode_bitmap(inode->inode_num, fs);
+	if (fs_has_groups(fs) && S_ISDIR(inode->mode)) {
+		a1fs_group_desc *gd = fs_group(fs, inode->inode_num / fs->sb->s_inodes_per_group);
+		gd->used_dirs--;
+		fs_mark_dirty(fs, gd, sizeof(*gd));
+	}
+	pthread_mutex_unlock(&fs->ino_bitmap_lock);
+}
+
+/**
+ * Look up an entry of a directory and lock both the directory and the inode
+ * the entry refers to for writing.
+ *
+ * @param parent  directory inode (not locked by the caller).
+ * @param name    entry name.
+ * @param child   receives the inode the entry refers to.
+ * @param fs      file system context.
+ * @return        the dentry, valid until the locks are released with
+ *                inode_unlock_pair(); NULL if there is no such entry (nothing
+ *                is locked then).
+ */
+void *lock_dentry(a1fs_inode *parent, char *name, a1fs_inode **child, fs_ctx *fs) {
+	while (true) {
+		int ino;
+		inode_rdlock(fs, parent->inode_num);
+		void *dentry = lookup_dentry(parent, name, &ino, fs);
+		inode_unlock(fs, parent->inode_num);
+		if (dentry == NULL) {
+			return NULL;
+		}
+
+		// take both locks in lock order, then make sure the entry did not
+		// change while no lock was held
+		inode_wrlock_pair(fs, parent->inode_num, ino);
+		int locked_ino;
+		dentry = lookup_dentry(parent, name, &locked_ino, fs);
+		if (dentry != NULL && locked_ino == ino) {
+			*child = fs_inode(fs, ino);
+			return dentry;
+		}
+		inode_unlock_pair(fs, parent->inode_num, ino);
+	}
+}
+
+/**
+ * Create a directory.
+ *
+ * Implements the mkdir() system call.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" doesn't exist.
+ *   The parent directory of "path" exists and is a directory.
+ *   "path" and its components are not too long.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param path  path to the directory to create.
+ * @param mode  file mode bits.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_mkdir(const char *path, mode_t mode)
+{
+	mode = mode | S_IFDIR;
+	fs_ctx *fs = get_fs();
+
+	char dir_name[A1FS_NAME_MAX];
+	char path_parent[A1FS_PATH_MAX];
+	char path_cpy[A1FS_PATH_MAX];
+	strcpy(path_cpy, path);
+
+	//find parent directory path
+	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
+		if (path_cpy[i] == '/') {
+			strncpy(path_parent, &path_cpy[0], i);
+			path_parent[i] = '\0';
+			break;
+		}
+	}
+
+	//find the new file name
+	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
+		if (path_cpy[i] == '/') {
+			strncpy(dir_name, &path_cpy[i+1], strlen(path_cpy)-(i+1));
+			dir_name[strlen(path_cpy)-(i+1)] = '\0';
+			break;
+		}
+	}
+
+	//find the inode that stores the parent directory
+	a1fs_inode *dir_parent;
+	int value = lookup_inode((const char *)(path_parent), fs, &dir_parent);
+	if (value != 0) {
+		return value;
+	}
+	inode_wrlock(fs, dir_parent->inode_num);
+
+	int ino_num;
+	if ((set_inode(&ino_num, dir_parent->inode_num, true, fs)) != 0){
+		inode_unlock(fs, dir_parent->inode_num);
+		return -ENOSPC;
+	}
+	a1fs_inode *dir = fs_inode(fs, ino_num);
+	dir->inode_num = ino_num;
+	dir->links = 2;	
+	dir->size = 0;
+	dir->mode = mode;
+	clock_gettime(CLOCK_REALTIME, &(dir->mtime));
+	dir->indirect_block = -1;
+	dir->count_extent = 0;
+	dir->flags = 0;
+
+	//add dentry with name, inode number of the new directory into the parent directory
+	value = 0;
+	if (add_dentry(dir_parent, dir_name, dir, fs) != 0) {
+		free_inode(dir, fs);
+		value = -ENOSPC;
+	} else {
+		inode_dirty(dir, fs);
+		inode_dirty(dir_parent, fs);
+	}
+	inode_unlock(fs, dir_parent->inode_num);
+	return value;
+}
+
+/**
+ * Remove a directory.
+ *
+ * Implements the rmdir() system call.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a non-root directory.
+ *
+ * Errors:
+ *   ENOTEMPTY  the directory is not empty.
+ *
+ * @param path  path to the directory to remove.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_rmdir(const char *path)
+{
+	assert(strcmp(path, "/") != 0);
+	fs_ctx *fs = get_fs();
+	(void)path;
+	(void)fs;
+	char path_cpy[A1FS_PATH_MAX];
+	strcpy(path_cpy, path);
+	
+	// give an inode pointer to the parent directory
+	char parent_path[A1FS_PATH_MAX];
+	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
+		if (path_cpy[i] == '/') {
+			strncpy(parent_path, &path_cpy[0], i);
+			parent_path[i] = '\0';
+			break;
+		}
+	}
+	struct a1fs_inode *parent_dir;
+	int value = lookup_inode(parent_path, fs, &parent_dir);
+	if (value != 0) {
+		return value;
+	}
+
+	char dir_name[A1FS_NAME_MAX];
+	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
+		if (path_cpy[i] == '/') {
+			strncpy(dir_name, &path_cpy[i+1], strlen(path_cpy)-(i+1));
+			dir_name[strlen(path_cpy)-(i+1)] = '\0';
+			break;
+		}
+	}
+
+	// Go into the path and loop up the directory entry and extents
+	void *dentry;
+	struct a1fs_inode *inode;
+	dentry = lock_dentry(parent_dir, dir_name, &inode, fs);
+	if (dentry == NULL) {
+		return -ENOENT;
+	}
+	a1fs_ino_t inode_num = inode->inode_num;
+
+	// return error if the directory is not empty
+	if (!dir_is_empty(inode, fs)) {
+		inode_unlock_pair(fs, parent_dir->inode_num, inode_num);
+		return -ENOTEMPTY;
+	}
+	
+	// remove the current directory by removing its dentry and block
+	// remove dentry with name, inode number of the directory in the parent directory
+	value = rm_dentry(parent_dir, dir_name, dentry, fs);
+	if (value == 0) {
+		parent_dir->links--;
+		// unset all blocks through the inode extent
+		free_inode(inode, fs);
+	}
+	inode_dirty(parent_dir, fs);
+	inode_unlock_pair(fs, parent_dir->inode_num, inode_num);
+
+	return value != 0 ? -EIO : 0;
+}
+
+/**
+ * Create a file.
+ *
+ * Implements the open()/creat() system call.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" doesn't exist.
+ *   The parent directory of "path" exists and is a directory.
+ *   "path" and its components are not too long.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param path  path to the file to create.
+ * @param mode  file mode bits.
+ * @param fi    receives the handle of the new file.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+	assert(S_ISREG(mode));
+	fs_ctx *fs = get_fs();
+
+	//TODO: create a file at given path with given mode
+	char dir_name[A1FS_NAME_MAX];
+	char path_parent[A1FS_PATH_MAX];
+	char path_cpy[A1FS_PATH_MAX];
+	strcpy(path_cpy, path);
+
+	//find parent directory path
+	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
+		if (path_cpy[i] == '/') {
+			strncpy(path_parent, &path_cpy[0], i);
+			path_parent[i] = '\0';
+			break;
+		}
+	}
+
+	//find the new file name
+	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
+		if (path_cpy[i] == '/') {
+			strncpy(dir_name, &path_cpy[i+1], strlen(path_cpy)-(i+1));
+			dir_name[strlen(path_cpy)-(i+1)] = '\0';
+			break;
+		}
+	}
+
+	// find parent directory inode using parent path
+	a1fs_inode *parent_ino;
+	int value = lookup_inode((const char *)(path_parent), fs, &parent_ino);
+	if (value != 0) {
+		return value;
+	}
+	inode_wrlock(fs, parent_ino->inode_num);
+
+	int ino_num;
+	// if no more space to allocate inode, return ENOSPC
+	if ((set_inode(&ino_num, parent_ino->inode_num, false, fs)) != 0){
+		inode_unlock(fs, parent_ino->inode_num);
+		return -ENOSPC;
+	}
+	// initialize inode
+	struct a1fs_inode *inode = fs_inode(fs, ino_num);
+	inode->mode = mode;
+	inode->links = 1;
+	inode->size = 0;
+	clock_gettime(CLOCK_REALTIME, &(inode->mtime));
+	inode->inode_num = ino_num;
+	inode->indirect_block = -1;
+	inode->count_extent = 0;
+	// new files start out inline if the inodes have room for data
+	inode->flags = fs_inline_size(fs) > 0 ? A1FS_INODE_INLINE : 0;
+	memset(inode_inline(inode), 0, fs_inline_size(fs));
+
+	value = 0;
+	if (!openfiles_open(&fs->open_files, ino_num)) {
+		free_inode(inode, fs);
+		value = -ENOMEM;
+	} else if (add_dentry(parent_ino, dir_name, inode, fs) != 0) {
+		block_run *held;
+		openfiles_release(&fs->open_files, ino_num, &held);
+		free(held);
+		free_inode(inode, fs);
+		value = -ENOSPC;
+	} else {
+		inode_dirty(inode, fs);
+		inode_dirty(parent_ino, fs);
+		fi->fh = ino_num;
+	}
+	inode_unlock(fs, parent_ino->inode_num);
+	return value;
+}
+
+/**
+ * Remove a file.
+ *
+ * Implements the unlink() system call.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors: none
+ *
+ * @param path  path to the file to remove.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_unlink(const char *path)
+{
+	fs_ctx *fs = get_fs();
+
+	(void)path;
+	(void)fs;
+	char path_cpy[A1FS_PATH_MAX];
+	strcpy(path_cpy, path);
+	
+	// give an inode pointer to the parent directory
+	char parent_path[A1FS_PATH_MAX];
+	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
+		if (path_cpy[i] == '/') {
+			strncpy(parent_path, &path_cpy[0], i);
+			parent_path[i] = '\0';
+			break;
+		}
+	}
+	struct a1fs_inode *parent_dir;
+	int value = lookup_inode(parent_path, fs, &parent_dir);
+	if (value != 0) {
+		return value;
+	}
+
+	char dir_name[A1FS_NAME_MAX];
+	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
+		if (path_cpy[i] == '/') {
+			strncpy(dir_name, &path_cpy[i+1], strlen(path_cpy)-(i+1));
+			dir_name[strlen(path_cpy)-(i+1)] = '\0';
+			break;
+		}
+	}
+
+	// Go into the path and look up the directory entry and extents
+	void *dentry;
+	struct a1fs_inode *inode;
+	dentry = lock_dentry(parent_dir, dir_name, &inode, fs);
+	if (dentry == NULL) {
+		return -ENOENT;
+	}
+	a1fs_ino_t inode_num = inode->inode_num;
+
+	// remove dentry with name, inode number of the directory in the parent directory
+	value = rm_dentry(parent_dir, dir_name, dentry, fs);
+	if (value == 0) {
+		// unset all blocks through the inode extent
+		free_inode(inode, fs);
+	}
+	inode_dirty(parent_dir, fs);
+	inode_unlock_pair(fs, parent_dir->inode_num, inode_num);
+
+	return value != 0 ? -EIO : 0;
+}
+
+
+/**
+ * Change the modification time of a file or directory.
+ *
+ * Implements the utimensat() system call. See "man 2 utimensat" for details.
+ *
+ * NOTE: You only need to implement the setting of modification time (mtime).
+ *       Timestamp modifications are not recursive. 
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists.
+ *
+ * Errors: none
+ *
+ * @param path   path to the file or directory.
+ * @param times  timestamps array. See "man 2 utimensat" for details.
+ * @return       0 on success; -errno on failure.
+ */
+static int a1fs_utimens(const char *path, const struct timespec times[2])
+{
+	fs_ctx *fs = get_fs();
+
+	// update the modification timestamp (mtime) in the inode for given
+	// path with either the time passed as argument or the current time,
+	// according to the utimensat man page
+	struct a1fs_inode *inode;
+	int value = lookup_inode(path, fs, &inode);
+	if (value != 0) {
+		return value;
+	}
+
+	// if the tv_nsec field of one of the timespec structures has the special value
+	// UTIME_NOW, then the corresponding file timestamp is set to the current time.
+	inode_wrlock(fs, inode->inode_num);
+	if (times[1].tv_nsec == UTIME_NOW) { // last modification time
+		clock_gettime(CLOCK_REALTIME, &(inode->mtime));
+	} else {
+		inode->mtime = times[1];
+	}
+	inode_dirty(inode, fs);
+	inode_unlock(fs, inode->inode_num);
+	return 0;
+}
+
+/**
+ * Return the number of blocks of a file covered by its extents, holes included.
+ */
+uint64_t inode_nblocks(a1fs_inode *inode, fs_ctx *fs) {
+	if (inode->count_extent == 0) {
+		return 0;
+	}
+	// only the last leaf has to be summed up
+	ext_path path;
+	ext_probe(inode, UINT64_MAX, &path, fs);
+	uint64_t total = path.first;
+	for (unsigned int i = 0; i < *path.count; i++) {
+		total += a1fs_extent_len(&path.extents[i], fs_64bit(fs));
+	}
+	return total;
+}
+
+/**
+ * Move the data of an inline file (A1FS_INODE_INLINE) into a data block, so
+ * that the file can grow past the inline area.
+ *
+ * @return  0 on success; -ENOSPC if there is no free block.
+ */
+int uninline_file(a1fs_inode *inode, fs_ctx *fs){
+	inode->flags &= ~A1FS_INODE_INLINE;
+	if (inode->size > 0) {
+		if (set_block(inode, 1, false, fs) != 0) {
+			inode->flags |= A1FS_INODE_INLINE;
+			return -ENOSPC;
+		}
+		memcpy(inode_block(inode, 0, fs), inode_inline(inode), inode->size);
+		fs_mark_dirty(fs, inode_block(inode, 0, fs), inode->size);
+	}
+	memset(inode_inline(inode), 0, fs_inline_size(fs));
+	return 0;
+}
+
+/**
+ * Grow a file to new_size bytes.
+ *
+ * Inline files grow in place while they fit in the inode; the inline area past
+ * the end of the file is always zero.
+ *
+ * The unused tail of the current last block is zeroed and the missing blocks
+ * are added as a hole, so the new range reads as zeros without allocating or
+ * writing anything; blocks are allocated when they are written (see
+ * fill_holes()).
+ *
+ * @return  0 on success; -ENOSPC if there is not enough free space.
+ */
+int extend_file(a1fs_inode *inode, uint64_t new_size, fs_ctx *fs){
+	if (inode->flags & A1FS_INODE_INLINE) {
+		if (new_size <= fs_inline_size(fs)) {
+			inode->size = new_size;
+			return 0;
+		}
+		if (uninline_file(inode, fs) != 0) {
+			return -ENOSPC;
+		}
+	}
+
+	// zero the rest of the last block, it may hold data from before a shrink
+	size_t used = inode->size % A1FS_BLOCK_SIZE;
+	if (used != 0) {
+		void *lastb = inode_block(inode, inode->size / A1FS_BLOCK_SIZE, fs);
+		if (lastb) {
+			memset(lastb + used, 0, A1FS_BLOCK_SIZE - used);
+			fs_mark_dirty(fs, lastb, A1FS_BLOCK_SIZE);
+		}
+	}
+
+	// blocks are counted rather than derived from the size so that blocks
+	// preallocated past the end of the file are kept
+	uint64_t needed = ceiling(new_size, A1FS_BLOCK_SIZE);
+	uint64_t have = inode_nblocks(inode, fs);
+	if (needed > have) {
+		if (add_hole(inode, needed - have, fs) != 0) {
+			return -ENOSPC;
+		}
+	}
+	inode->size = new_size;
+	return 0;
+}
+
+/**
+ * Drop what a failed write or fallocate added past the end of a file, after
+ * its size has been restored: the blocks past both the end of the file and
+ * the first keep_blocks blocks, which the file had before.
+ */
+void trim_file(a1fs_inode *inode, uint64_t keep_blocks, fs_ctx *fs){
+	if (inode->flags & A1FS_INODE_INLINE) {
+		// keep the inline area past the end zeroed
+		memset((char*)inode_inline(inode) + inode->size, 0, fs_inline_size(fs) - inode->size);
+		return;
+	}
+	uint64_t keep = ceiling(inode->size, A1FS_BLOCK_SIZE);
+	keep = keep > keep_blocks ? keep : keep_blocks;
+	uint64_t have = inode_nblocks(inode, fs);
+	if (have > keep) {
+		unset_block(inode, have - keep, fs);
+	}
+}
+
+/**
+ * Change the size of a file.
+ *
+ * Implements the truncate() system call. Supports both extending and shrinking.
+ * If the file is extended, the new uninitialized range at the end must be
+ * filled with zeros.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
  *
  * Errors:
+ *   EFBIG   size is larger than the maximum file size.
  *   ENOMEM  not enough memory (e.g. a malloc() call failed).
  *   ENOSPC  not enough free space in the file system.
  *
- * @param path  path to the directory to create.
- * @param mode  file mode bits.
+ * @param path  path to the file to set the size.
+ * @param size  new file size in bytes.
  * @return      0 on success; -errno on error.
  */
-static int a1fs_mkdir(const char *path, mode_t mode)
+static int a1fs_truncate(const char *path, off_t size)
 {
-	mode = mode | S_IFDIR;
 	fs_ctx *fs = get_fs();
 
-	int ino_num;
-	if ((set_inode(&ino_num, fs)) != 0){
-		return -ENOSPC;
+	if ((uint64_t)size > fs_max_file_size(fs)) {
+		return -EFBIG;
 	}
-	a1fs_inode *inode_table = fs->image + (fs->sb->inode_table * A1FS_BLOCK_SIZE);
-	a1fs_inode *dir = &inode_table[ino_num];
-	dir->inode_num = ino_num;
-	dir->links = 2;	
-	dir->size = 0;
-	dir->mode = mode;
-	clock_gettime(CLOCK_REALTIME, &(dir->mtime));
-	dir->indirect_block = -1;
-	dir->count_extent = 0;
-
-	char dir_name[A1FS_NAME_MAX];
-	char path_parent[A1FS_PATH_MAX];
-	char path_cpy[A1FS_PATH_MAX];
-	strcpy(path_cpy, path);
-
-	//find parent directory path
-	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
-		if (path_cpy[i] == '/') {
-			strncpy(path_parent, &path_cpy[0], i);
-			path_parent[i] = '\0';
-			break;
+	//set new file size, possibly "zeroing out" the uninitialized range
+	a1fs_inode *inode;
+	int value = lookup_inode(path, fs, &inode);
+	if (value != 0) {
+		return value;
+	}
+	inode_wrlock(fs, inode->inode_num);
+	if((uint64_t)size > inode->size){
+		uint64_t old_blocks = inode_nblocks(inode, fs);
+		value = extend_file(inode, size, fs);
+		if (value != 0) {
+			// drop the part of the hole added before running out of space
+			trim_file(inode, old_blocks, fs);
 		}
 	}
-
-	//find the new file name
-	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
-		if (path_cpy[i] == '/') {
-			strncpy(dir_name, &path_cpy[i+1], strlen(path_cpy)-(i+1));
-			dir_name[strlen(path_cpy)-(i+1)] = '\0';
-			break;
+	if((uint64_t)size < inode->size && (inode->flags & A1FS_INODE_INLINE)){
+		// keep the inline area past the end zeroed
+		memset((char*)inode_inline(inode) + size, 0, inode->size - size);
+		inode->size = size;
+	}
+	if((uint64_t)size < inode->size){
+		// find the number of blocks we need to deallocate from inode
+		uint64_t keep = ceiling(size, A1FS_BLOCK_SIZE);
+		uint64_t have = inode_nblocks(inode, fs);
+		inode->size = size;
+		if(have > keep){
+			unset_block(inode, have - keep, fs);
 		}
 	}
-
-	//find the inode that stores the parent directory
-	a1fs_inode *dir_parent;
-	lookup_inode((const char *)(path_parent), fs, &dir_parent);
-
-	//add dentry with name, inode number of the new directory into the parent directory
-	add_dentry(dir_parent, dir_name, dir, fs);
-	return 0;
+	if (value == 0) {
+		clock_gettime(CLOCK_REALTIME, &(inode->mtime));
+	}
+	inode_dirty(inode, fs);
+	inode_unlock(fs, inode->inode_num);
+	return value;
 }
 
-/**
- * switch bit bit_number from 1 to 0 in data inode bitmap
-**/
-void unset_flip_inode_bitmap(a1fs_blk_t inode_number, fs_ctx *fs){
-	unsigned char *inode_bitmap = fs->image + (fs->sb->inode_bitmap) * A1FS_BLOCK_SIZE;
-	int byte_number = inode_number / 8;
-	// find the bit number of the inode in the byte it belongs to
-	int bit_number = inode_number % 8;
-	// change the bit_number's bit to 0
-	unsigned char flip_zero = ~(1 << (7 - bit_number));
-	// merge flip_one with the previous
-	inode_bitmap[byte_number] = inode_bitmap[byte_number] & flip_zero;
-	fs->sb->s_free_inodes_count += 1;
+/** 
+ * Look up the pointer to the file that we want read/write data
+ * 
+ * Return the pointer to the byte at the given offset of the file, and the
+ * number of bytes from there to the end of the extent holding it, i.e. the
+ * largest range that can be copied with a single memcpy().
+ *
+ * @param inode      file inode.
+ * @param offset     byte offset within the file; must be below the allocated size.
+ * @param contig     receives the number of contiguous bytes at the pointer.
+ * @param unwritten  if not NULL, receives whether the extent is unwritten or a
+ *                   hole (its contents must be read as zeros).
+ * @param fs         file system context.
+ * @return           pointer into the image; NULL if offset is past the extents
+ *                   or in a hole.
+ */
+void *lookup_file(a1fs_inode *inode, uint64_t offset, uint64_t *contig, bool *unwritten, fs_ctx *fs){
+	ext_path path;
+	uint64_t first;
+	a1fs_extent *e = extent_find(inode, offset / A1FS_BLOCK_SIZE, &path, &first, fs);
+	if (e == NULL) {
+		return NULL;
+	}
+	uint64_t lblk = offset / A1FS_BLOCK_SIZE - first;
+	bool wide = fs_64bit(fs);
+	*contig = (a1fs_extent_len(e, wide) - lblk) * A1FS_BLOCK_SIZE - offset % A1FS_BLOCK_SIZE;
+	if (unwritten) {
+		*unwritten = a1fs_extent_unwritten(e) || a1fs_extent_hole(e, wide);
+	}
+	if (a1fs_extent_hole(e, wide)) {
+		return NULL;
+	}
+	return (char*)fs_block(fs, a1fs_extent_start(e, wide) + lblk) + offset % A1FS_BLOCK_SIZE;
 }
 
 /**
- * switch bit bit_number from 1 to 0 in data block bitmap
-**/
-void unset_flip_block_bitmap(a1fs_blk_t block_number, fs_ctx *fs){
-	unsigned char *block_bitmap = fs->image + (fs->sb->dblock_bitmap) * A1FS_BLOCK_SIZE;
-	int byte_number = block_number / 8;
-	// find the bit number of the inode in the byte it belongs to
-	int bit_number = block_number % 8;
-	// change the bit_number's bit to 0
-	unsigned char flip_zero = ~(1 << (7 - bit_number));
-	// merge flip_one with the previous
-	block_bitmap[byte_number] = block_bitmap[byte_number] & flip_zero;
-	fs->sb->s_free_blocks_count += 1;
-}
+ * Mark the blocks under the byte range [offset, offset + size) of a file as
+ * written, before data is copied into them.
+ *
+ * The unwritten extents in the range are split so that only the blocks of the
+ * range become written; blocks the range covers only partially are zeroed. A
+ * written piece is merged with written neighbours that are physically
+ * contiguous, so sequential writes into a preallocated region keep the number
+ * of extents constant. A leaf that has no room for a split makes room first
+ * (see extents_room()); if that fails, the whole extent is zeroed and marked
+ * written instead.
+ * (caller must hold the inode's write lock; the range must not have holes,
+ * see fill_holes())
+ *
+ * @param inode   file inode.
+ * @param offset  first byte of the range.
+ * @param size    length of the range in bytes.
+ * @param fs      file system context.
+ */
+void convert_unwritten(a1fs_inode *inode, uint64_t offset, uint64_t size, fs_ctx *fs){
+	bool wide = fs_64bit(fs);
+	uint64_t lblk = offset / A1FS_BLOCK_SIZE;
+	uint64_t end = ceiling(offset + size, A1FS_BLOCK_SIZE);
+	while (lblk < end) {
+		ext_path path;
+		uint64_t first;
+		a1fs_extent *e = extent_find(inode, lblk, &path, &first, fs);
+		a1fs_extent *extent = path.extents;
+		unsigned int i = path.i;
+		a1fs_blk_t start = a1fs_extent_start(e, wide);
+		uint64_t len = a1fs_extent_len(e, wide);
+		if (!a1fs_extent_unwritten(e)) {
+			lblk = first + len;
+			continue;
+		}
 
-/**
- * Unset blocks from the inode
- * 
- * @param inode      pointer to inode to allocate space for
- * @param num_blocks  number of blocks that needs to be allocated to that inode
- * @param fs         file system context
- * @return           return 0 on success, otherwise return -1
-**/
-int unset_block(a1fs_inode *inode, unsigned int num_blocks, fs_ctx *fs){
-	struct a1fs_extent *extent;
-	extent = (struct a1fs_extent*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + inode->indirect_block));
-
-	// index of last block
-	int i = inode->count_extent;
-	int j = extent[i-1].start + extent[i-1].count - 1;
-
-	while(num_blocks > 0) {
-		// if number of blocks we need to remove is equal to the length of the current extent
-		if (num_blocks == extent[i-1].count) {
-			for (unsigned int k = extent[i-1].start; k < extent[i-1].start + extent[i-1].count; k++) {
-				unset_flip_block_bitmap(k, fs);
-			}
-			inode->count_extent--;
-			break;
+		// blocks [from, from + n) of extent i become written
+		uint64_t from = lblk - first;
+		uint64_t n = (end < first + len ? end : first + len) - lblk;
+		a1fs_extent piece[3];
+		unsigned int k = 0;
+		// entries [lo, hi) of the leaf are replaced by piece[0..k); only
+		// neighbours in the same leaf are merged
+		unsigned int lo = i, hi = i + 1;
+		a1fs_blk_t mid_start = start + from;
+		uint64_t mid_len = n;
+		if (from > 0) {
+			piece[k++] = a1fs_extent_make(start, from, true, wide);
+		} else if (i > 0 && !a1fs_extent_unwritten(&extent[i - 1]) &&
+		           !a1fs_extent_hole(&extent[i - 1], wide) &&
+		           a1fs_extent_start(&extent[i - 1], wide) + a1fs_extent_len(&extent[i - 1], wide) == mid_start &&
+		           a1fs_extent_len(&extent[i - 1], wide) + mid_len <= a1fs_extent_max_len(wide)) {
+			lo--;
+			mid_start = a1fs_extent_start(&extent[i - 1], wide);
+			mid_len += a1fs_extent_len(&extent[i - 1], wide);
+		}
+		bool tail = from + n < len;
+		if (!tail && i + 1 < *path.count &&
+		    !a1fs_extent_unwritten(&extent[i + 1]) &&
+		    !a1fs_extent_hole(&extent[i + 1], wide) &&
+		    start + len == a1fs_extent_start(&extent[i + 1], wide) &&
+		    mid_len + a1fs_extent_len(&extent[i + 1], wide) <= a1fs_extent_max_len(wide)) {
+			hi++;
+			mid_len += a1fs_extent_len(&extent[i + 1], wide);
 		}
-		// if number of blocks we need to remove is smaller than the length of the current extent
-		if (num_blocks < extent[i-1].count){
-			for (unsigned int k = 0; k < num_blocks; k++) {
-				a1fs_blk_t block_num = j - k;
-				unset_flip_block_bitmap(block_num, fs);
+		piece[k++] = a1fs_extent_make(mid_start, mid_len, false, wide);
+		if (tail) {
+			piece[k++] = a1fs_extent_make(start + from + n, len - from - n, true, wide);
+		}
+
+		if (k > hi - lo && *path.count + (k - (hi - lo)) > path.max) {
+			// the split does not fit in the leaf: make room first
+			pthread_mutex_lock(&fs->dblock_bitmap_lock);
+			bool room = extents_room(inode, &path, k - (hi - lo), fs);
+			pthread_mutex_unlock(&fs->dblock_bitmap_lock);
+			if (room) {
+				continue;
 			}
-			extent[i-1].count -= num_blocks;
-			break;
+			// no room to split: write zeros to the whole extent instead (it
+			// may have moved out of the inode)
+			e = &path.extents[path.i];
+			memset(fs_block(fs, start), 0, len * A1FS_BLOCK_SIZE);
+			fs_mark_blocks_dirty(fs, start, len);
+			*e = a1fs_extent_make(start, len, false, wide);
+			ext_leaf_changed(inode, &path, fs);
+			lblk = first + len;
+			continue;
+		}
+
+		// zero the parts of the first and last block the range does not cover
+		if (lblk == offset / A1FS_BLOCK_SIZE && offset % A1FS_BLOCK_SIZE != 0) {
+			memset(fs_block(fs, start + from), 0, A1FS_BLOCK_SIZE);
+			fs_mark_blocks_dirty(fs, start + from, 1);
 		}
-		// if number of blocks we need to remove is larger than the length of the current extent
-		for (unsigned int k = extent[i-1].start; k < extent[i-1].start + extent[i-1].count; k++) {
-			unset_flip_block_bitmap(k, fs);
+		if (lblk + n == end && (offset + size) % A1FS_BLOCK_SIZE != 0) {
+			memset(fs_block(fs, start + from + n - 1), 0, A1FS_BLOCK_SIZE);
+			fs_mark_blocks_dirty(fs, start + from + n - 1, 1);
 		}
-		inode->count_extent--;
-		num_blocks -= extent[i-1].count;
-		i = inode->count_extent;
-		j = extent[i-1].start + extent[i-1].count - 1;
-	}
 
-	return 0;
+		ext_splice(inode, &path, lo, hi, piece, k, fs);
+		lblk += n;
+	}
 }
 
-/** 
- * Remove the directory entry from the given directory. 
- * 
- * If the dentry is removed successfully, return 0.
- * Otherwise return -1.
+/**
+ * Give madvise() advice for the blocks of the image that hold bytes
+ * [start, end) of a file. Holes and unwritten extents are skipped.
+ * (caller must hold the inode's lock)
  */
-int rm_dentry(struct a1fs_inode *dir_parent, char *dir_name, struct a1fs_dentry *dir, fs_ctx *fs) {
-	(void)dir_name;
-	int enough_space = dir_parent->size % A1FS_BLOCK_SIZE;
-
-	struct a1fs_extent *extent;
-	extent = (struct a1fs_extent*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + dir_parent->indirect_block));
-	int i = dir_parent->count_extent;
-	// last block that belongs to the inode
-	int j = extent[i-1].start + extent[i-1].count - 1;
-	
-	// remove the directory entry from the last block
-	int lastb = sizeof(a1fs_dentry);
-	struct a1fs_dentry *last_dentry;
-	last_dentry = (struct a1fs_dentry*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + j) + enough_space);
-	last_dentry -= lastb;
-
-	memcpy(dir, last_dentry, sizeof(a1fs_dentry));
-
-	dir_parent->size -= sizeof(a1fs_dentry);
-
-	if (dir_parent->size % A1FS_BLOCK_SIZE == 0) {
-		int value = unset_block(dir_parent, 1, fs);
-		if (value != 0) {
-			return -1;
+void advise_file(a1fs_inode *inode, uint64_t start, uint64_t end, int advice, fs_ctx *fs){
+	start -= start % A1FS_BLOCK_SIZE;
+	end = end < inode->size ? end : inode->size;
+	while (start < end) {
+		uint64_t contig;
+		bool unwritten = false;
+		void *p = lookup_file(inode, start, &contig, &unwritten, fs);
+		if (!p && !unwritten) {
+			break;
 		}
+		uint64_t n = end - start < contig ? end - start : contig;
+		if (p) {
+			madvise(p, align_up(n, A1FS_BLOCK_SIZE), advice);
+		}
+		start += n;
 	}
+}
 
-	return 0;
+/**
+ * Track the reads of a file and, once they form a sequential stream, start
+ * reading the extents ahead of the reader into the page cache in growing
+ * windows, and let the pages behind the reader go first under memory
+ * pressure. The kernel's own readahead only sees faults on the mapping, which
+ * follow the physical layout rather than the file. (caller must hold the
+ * inode's lock)
+ */
+void file_readahead(a1fs_inode *inode, uint64_t offset, size_t size, fs_ctx *fs){
+	if (fs->cache) {
+		// the block cache reads blocks in as they are accessed
+		return;
+	}
+	uint64_t ahead[2], behind[2];
+	ramap_access(&fs->readahead, inode->inode_num, offset, size, ahead, behind);
+	if (ahead[0] < ahead[1]) {
+		advise_file(inode, ahead[0], ahead[1], MADV_WILLNEED, fs);
+	}
+#ifdef MADV_COLD
+	if (behind[0] < behind[1]) {
+		// unlike MADV_DONTNEED, keeps the pages and dirty data
+		advise_file(inode, behind[0], behind[1], MADV_COLD, fs);
+	}
+#endif
 }
 
 /**
- * Remove a directory.
+ * Read data from a file.
  *
- * Implements the rmdir() system call.
+ * Implements the pread() system call. Must return exactly the number of bytes
+ * requested except on EOF (end of file). Reads from file ranges that have not
+ * been written to must return ranges filled with zeros. The byte range may span
+ * any number of blocks and extents.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a non-root directory.
- *
- * Errors:
- *   ENOTEMPTY  the directory is not empty.
+ *   "path" exists and is a file.
+ * 
+ * Errors: none
  *
- * @param path  path to the directory to remove.
- * @return      0 on success; -errno on error.
+ * @param path    path to the file to read from.
+ * @param buf     pointer to the buffer that receives the data.
+ * @param size    buffer size (number of bytes requested).
+ * @param offset  offset from the beginning of the file to read from.
+ * @param fi      unused.
+ * @return        number of bytes read on success; 0 if offset is beyond EOF;
+ *                -errno on error.
  */
-static int a1fs_rmdir(const char *path)
+static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
+                     struct fuse_file_info *fi)
 {
-	assert(strcmp(path, "/") != 0);
+	(void)fi;// unused
 	fs_ctx *fs = get_fs();
-	(void)path;
-	(void)fs;
-	char path_cpy[A1FS_PATH_MAX];
-	strcpy(path_cpy, path);
-	
-	// give an inode pointer to the parent directory
-	char parent_path[A1FS_PATH_MAX];
-	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
-		if (path_cpy[i] == '/') {
-			strncpy(parent_path, &path_cpy[0], i);
-			parent_path[i] = '\0';
-			break;
-		}
-	}
-	struct a1fs_inode *parent_dir;
-	lookup_inode(parent_path, fs, &parent_dir);
-
-	char dir_name[A1FS_NAME_MAX];
-	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
-		if (path_cpy[i] == '/') {
-			strncpy(dir_name, &path_cpy[i+1], strlen(path_cpy)-(i+1));
-			dir_name[strlen(path_cpy)-(i+1)] = '\0';
-			break;
-		}
-	}
 
-	// Go into the path and loop up the directory entry and extents
-	struct a1fs_dentry *dentry;
-	int inode_num = parent_dir->inode_num;
-	dentry = lookup_dentry(parent_dir, dir_name, &inode_num, fs);
+	//read data from the file at given offset into the buffer
+	// find the inode from the given path
 	struct a1fs_inode *inode;
-	inode = fs->image + A1FS_BLOCK_SIZE * fs->sb->inode_table + sizeof(a1fs_inode) * dentry->ino;
+	int value = lookup_inode(path, fs, &inode);
+	if (value != 0) {
+		return value;
+	}
+	inode_rdlock(fs, inode->inode_num);
 
-	// return error if the directory is not empty
-	if (inode->size > 0) {
-		return -ENOTEMPTY;
+	// nothing to read at or beyond EOF
+	if ((uint64_t)offset >= inode->size) {
+		inode_unlock(fs, inode->inode_num);
+		return 0;
 	}
-	
-	// remove the current directory by removing its dentry and block
-	// remove dentry with name, inode number of the directory in the parent directory
-	int value = rm_dentry(parent_dir, dir_name, dentry, fs);
-	if (value != 0) {
-		return -1;
+	if (size > inode->size - offset) {
+		size = inode->size - offset;
 	}
 
-	// unset all blocks through the inode extent
-	struct a1fs_extent *extent = (struct a1fs_extent*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + inode->indirect_block));
-	for(unsigned int i = 0; i < inode->count_extent; i++) {
-		for(unsigned int j = extent[i].start; j < extent[i].start + extent[i].count; j++) {
-			unset_flip_inode_bitmap(j, fs);
+	if (inode->flags & A1FS_INODE_INLINE) {
+		memcpy(buf, (char*)inode_inline(inode) + offset, size);
+		inode_unlock(fs, inode->inode_num);
+		return size;
+	}
+	file_readahead(inode, offset, size, fs);
+
+	// copy one extent-contiguous run at a time
+	size_t done = 0;
+	while (done < size) {
+		uint64_t contig;
+		bool unwritten;
+		const void *src = lookup_file(inode, offset + done, &contig, &unwritten, fs);
+		size_t n = size - done < contig ? size - done : contig;
+		if (unwritten) {
+			memset(buf + done, 0, n);
+		} else {
+			memcpy(buf + done, src, n);
 		}
+		done += n;
 	}
-	unset_flip_inode_bitmap(inode->inode_num, fs);
-
-	return 0;
+	inode_unlock(fs, inode->inode_num);
+	return done;
 }
 
 /**
- * Create a file.
+ * Read data from a file without copying it.
  *
- * Implements the open()/creat() system call.
+ * Implements the pread() system call like a1fs_read(), but instead of copying
+ * the data it returns the byte ranges of the image file that hold it, one per
+ * extent-contiguous run, so that libfuse can splice them into the reply. Only
+ * unwritten runs (zeros) and inline data are returned in memory buffers.
+ *
+ * The ranges are read by libfuse after the inode lock is released, so a write
+ * or truncate racing with the read may be partially visible in its result.
+ * They are always read before the handle is released, however, and blocks cut
+ * off an open file are not freed until its last release (see release_blocks()),
+ * so the reply never shows data of another file.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" doesn't exist.
- *   The parent directory of "path" exists and is a directory.
- *   "path" and its components are not too long.
+ *   "path" exists and is a file.
  *
  * Errors:
  *   ENOMEM  not enough memory (e.g. a malloc() call failed).
- *   ENOSPC  not enough free space in the file system.
  *
- * @param path  path to the file to create.
- * @param mode  file mode bits.
- * @param fi    unused.
- * @return      0 on success; -errno on error.
+ * @param path    path to the file to read from.
+ * @param bufp    receives the buffer vector; libfuse frees it.
+ * @param size    number of bytes requested.
+ * @param offset  offset from the beginning of the file to read from.
+ * @param fi      unused.
+ * @return        0 on success; -errno on error.
  */
-static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+static int a1fs_read_buf(const char *path, struct fuse_bufvec **bufp,
+                         size_t size, off_t offset, struct fuse_file_info *fi)
 {
 	(void)fi;// unused
-	assert(S_ISREG(mode));
 	fs_ctx *fs = get_fs();
 
-	//TODO: create a file at given path with given mode
-	int ino_num;
-	// if no more space to allocate inode, return ENOSPC
-	if ((set_inode(&ino_num, fs)) != 0){
-		return -ENOSPC;
-	}
-	// initialize inode
 	struct a1fs_inode *inode;
-    inode = fs->image + A1FS_BLOCK_SIZE * fs->sb->inode_table + sizeof(a1fs_inode) * ino_num;
-	inode->mode = mode;
-	inode->links = 1;
-	inode->size = 0;
-	clock_gettime(CLOCK_REALTIME, &(inode->mtime));
-	inode->inode_num = ino_num;
-	inode->indirect_block = -1;
-	inode->count_extent = 0;
-
-	char dir_name[A1FS_NAME_MAX];
-	char path_parent[A1FS_PATH_MAX];
-	char path_cpy[A1FS_PATH_MAX];
-	strcpy(path_cpy, path);
+	int value = lookup_inode(path, fs, &inode);
+	if (value != 0) {
+		return value;
+	}
+	inode_rdlock(fs, inode->inode_num);
 
-	//find parent directory path
-	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
-		if (path_cpy[i] == '/') {
-			strncpy(path_parent, &path_cpy[0], i);
-			path_parent[i] = '\0';
-			break;
-		}
+	// nothing to read at or beyond EOF
+	if ((uint64_t)offset >= inode->size) {
+		size = 0;
+	} else if (size > inode->size - offset) {
+		size = inode->size - offset;
+	}
+	if (size > 0 && !(inode->flags & A1FS_INODE_INLINE)) {
+		file_readahead(inode, offset, size, fs);
 	}
 
-	//find the new file name
-	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
-		if (path_cpy[i] == '/') {
-			strncpy(dir_name, &path_cpy[i+1], strlen(path_cpy)-(i+1));
-			dir_name[strlen(path_cpy)-(i+1)] = '\0';
+	// every run but the first one starts at a block boundary
+	size_t max_runs = size / A1FS_BLOCK_SIZE + 2;
+	struct fuse_bufvec *bv = malloc(sizeof(*bv) + max_runs * sizeof(struct fuse_buf));
+	if (!bv) {
+		inode_unlock(fs, inode->inode_num);
+		return -ENOMEM;
+	}
+	*bv = FUSE_BUFVEC_INIT(0);
+	bv->count = 0;
+
+	size_t done = 0;
+	while (done < size) {
+		struct fuse_buf *b = &bv->buf[bv->count++];
+		*b = (struct fuse_buf){ .fd = -1 };
+		if (inode->flags & A1FS_INODE_INLINE) {
+			b->size = size;
+			b->mem = malloc(size);
+			if (b->mem) {
+				memcpy(b->mem, (char*)inode_inline(inode) + offset, size);
+			}
+		} else {
+			uint64_t contig;
+			bool unwritten;
+			void *src = lookup_file(inode, offset + done, &contig, &unwritten, fs);
+			b->size = size - done < contig ? size - done : contig;
+			if (unwritten) {
+				b->mem = calloc(1, b->size);
+			} else if (fs->fd < 0) {
+				b->mem = malloc(b->size);
+				if (b->mem) {
+					memcpy(b->mem, src, b->size);
+				}
+			} else {
+				b->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+				b->fd = fs->fd;
+				b->pos = (char*)src - (char*)fs->image;
+			}
+		}
+		if (!(b->flags & FUSE_BUF_IS_FD) && !b->mem) {
+			value = -ENOMEM;
 			break;
 		}
+		done += b->size;
 	}
+	inode_unlock(fs, inode->inode_num);
 
-	// find parent directory inode using parent path
-	a1fs_inode *parent_ino;
-	lookup_inode((const char *)(path_parent), fs, &parent_ino);
-	add_dentry(parent_ino, dir_name, inode, fs);
+	if (value != 0) {
+		for (size_t i = 0; i < bv->count; i++) {
+			free(bv->buf[i].mem);
+		}
+		free(bv);
+		return value;
+	}
+	*bufp = bv;
 	return 0;
 }
 
 /**
- * Remove a file.
- *
- * Implements the unlink() system call.
+ * Store data in the byte range [offset, offset + size) of a file, allocating
+ * blocks for the holes in the range first.
+ * (caller must hold the inode's write lock; the range must be within the extents)
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
- *
- * Errors: none
- *
- * @param path  path to the file to remove.
- * @return      0 on success; -errno on error.
+ * @param inode   file inode.
+ * @param offset  first byte of the range.
+ * @param size    length of the range in bytes.
+ * @param buf     buffer vector with the data; advanced past the bytes stored.
+ * @param fs      file system context.
+ * @return        number of bytes stored; -errno on error.
  */
-static int a1fs_unlink(const char *path)
-{
-	fs_ctx *fs = get_fs();
-
-	(void)path;
-	(void)fs;
-	char path_cpy[A1FS_PATH_MAX];
-	strcpy(path_cpy, path);
-	
-	// give an inode pointer to the parent directory
-	char parent_path[A1FS_PATH_MAX];
-	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
-		if (path_cpy[i] == '/') {
-			strncpy(parent_path, &path_cpy[0], i);
-			parent_path[i] = '\0';
-			break;
-		}
+ssize_t write_range(a1fs_inode *inode, uint64_t offset, size_t size,
+                    struct fuse_bufvec *buf, fs_ctx *fs){
+	if (fill_holes(inode, offset / A1FS_BLOCK_SIZE, ceiling(offset + size, A1FS_BLOCK_SIZE), fs) != 0) {
+		return -ENOSPC;
 	}
-	struct a1fs_inode *parent_dir;
-	lookup_inode(parent_path, fs, &parent_dir);
-
-	char dir_name[A1FS_NAME_MAX];
-	for (int i = strlen(path_cpy) - 1; i >= 0; i--) {
-		if (path_cpy[i] == '/') {
-			strncpy(dir_name, &path_cpy[i+1], strlen(path_cpy)-(i+1));
-			dir_name[strlen(path_cpy)-(i+1)] = '\0';
-			break;
+	convert_unwritten(inode, offset, size, fs);
+
+	// copy one extent-contiguous run at a time
+	size_t done = 0;
+	while (done < size) {
+		uint64_t contig;
+		void *dst = lookup_file(inode, offset + done, &contig, NULL, fs);
+		struct fuse_bufvec dst_buf = FUSE_BUFVEC_INIT(size - done < contig ? size - done : contig);
+		dst_buf.buf[0].mem = dst;
+		ssize_t n = fuse_buf_copy(&dst_buf, buf, 0);
+		if (n > 0) {
+			fs_mark_dirty(fs, dst, n);
 		}
-	}
-
-	// Go into the path and look up the directory entry and extents
-	struct a1fs_dentry *dentry;
-	int inode_num = parent_dir->inode_num;
-	dentry = lookup_dentry(parent_dir, dir_name, &inode_num, fs);
-	struct a1fs_inode *inode;
-	inode = fs->image + A1FS_BLOCK_SIZE * fs->sb->inode_table + sizeof(a1fs_inode) * dentry->ino;
-
-	// unset all blocks through the inode extent
-	struct a1fs_extent *extent = (struct a1fs_extent*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + inode->indirect_block));
-	for(unsigned int i = 0; i < inode->count_extent; i++) {
-		for(unsigned int j = extent[i].start; j < extent[i].start + extent[i].count; j++) {
-			unset_flip_inode_bitmap(j, fs);
+		if (n <= 0) {
+			// a short source (e.g. a failed splice) ends the write early
+			return done > 0 ? (ssize_t)done : n < 0 ? n : -EIO;
 		}
+		done += n;
 	}
-	unset_flip_inode_bitmap(inode->inode_num, fs);
+	return done;
+}
 
-	// remove dentry with name, inode number of the directory in the parent directory
-	int value = rm_dentry(parent_dir, dir_name, dentry, fs);
-	if (value != 0) {
-		return -1;
+/** Whether a block of data is all zeros. */
+bool is_zero_block(const char *data){
+	// OR the block together a word at a time; the loop is vectorized
+	uint64_t acc = 0;
+	for (size_t i = 0; i < A1FS_BLOCK_SIZE; i += sizeof(uint64_t)) {
+		uint64_t w;
+		memcpy(&w, data + i, sizeof(w));
+		acc |= w;
 	}
-
-	return 0;
+	return acc == 0;
 }
 
+/**
+ * Whether writing data at offset of a file can be skipped for a whole block:
+ * the data holds a full block of zeros and the block already reads as zeros
+ * (it is a hole or unwritten).
+ */
+bool skip_zero_block(a1fs_inode *inode, uint64_t offset, const char *data,
+                     size_t size, fs_ctx *fs){
+	if (offset % A1FS_BLOCK_SIZE != 0 || size < A1FS_BLOCK_SIZE) {
+		return false;
+	}
+	uint64_t contig;
+	bool zeros;
+	lookup_file(inode, offset, &contig, &zeros, fs);
+	return zeros && is_zero_block(data);
+}
 
 /**
- * Change the modification time of a file or directory.
+ * Write data to a file.
  *
- * Implements the utimensat() system call. See "man 2 utimensat" for details.
+ * Implements the pwrite() system call. Must return exactly the number of bytes
+ * requested except on error. If the offset is beyond EOF (end of file), the
+ * file must be extended. If the write creates a "hole" of uninitialized data,
+ * the new uninitialized range must filled with zeros. The byte range may span
+ * any number of blocks and extents.
  *
- * NOTE: You only need to implement the setting of modification time (mtime).
- *       Timestamp modifications are not recursive. 
+ * The data is copied by libfuse from the request buffer (or pipe, if the
+ * request was spliced) directly into the extents in the image. A gap between
+ * EOF and the offset is left as a hole. With the detect_zeroes option, full
+ * blocks of zeros are not stored where the file already reads as zeros.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists.
+ *   "path" exists and is a file.
  *
- * Errors: none
+ * Errors:
+ *   EFBIG   the write would extend the file past the maximum file size.
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *   ENOSPC  too many extents (a1fs only needs to support 512 extents per file)
  *
- * @param path   path to the file or directory.
- * @param times  timestamps array. See "man 2 utimensat" for details.
- * @return       0 on success; -errno on failure.
+ * @param path    path to the file to write to.
+ * @param buf     buffer vector with the data.
+ * @param offset  offset from the beginning of the file to write to.
+ * @param fi      unused.
+ * @return        number of bytes written on success; -errno on error.
  */
-static int a1fs_utimens(const char *path, const struct timespec times[2])
+static int a1fs_write_buf(const char *path, struct fuse_bufvec *buf,
+                          off_t offset, struct fuse_file_info *fi)
 {
+	(void)fi;// unused
 	fs_ctx *fs = get_fs();
 
-	// update the modification timestamp (mtime) in the inode for given
-	// path with either the time passed as argument or the current time,
-	// according to the utimensat man page
-	struct a1fs_inode *inode;
-	lookup_inode(path, fs, &inode);
-
-	// if the tv_nsec field of one of the timespec structures has the special value
-	// UTIME_NOW, then the corresponding file timestamp is set to the current time.
-	if (times[1].tv_nsec == UTIME_NOW) { // last modification time
-		clock_gettime(CLOCK_REALTIME, &(inode->mtime));
-	} else {
-		inode->mtime = times[1];
+	//write data from the buffer into the file at given offset, possibly
+	// "zeroing out" the uninitialized range
+	a1fs_inode *inode;
+	int value = lookup_inode(path, fs, &inode);
+	if (value != 0) {
+		return value;
 	}
-	return 0;
-}
-
-int extend_file(a1fs_inode *inode, int num_bytes, fs_ctx *fs){
-	// find the rermaining bytes that does not belong to the inode in the last block of the inode.
-	int remaining;
-	remaining = inode->size % A1FS_BLOCK_SIZE;
-	if (remaining != 0){
-		remaining = A1FS_BLOCK_SIZE - remaining;
+	size_t size = fuse_buf_size(buf);
+	if(size == 0) {
+		return 0;
 	}
-
-	if(inode->count_extent > 0){
-		int enough_space = inode->size % A1FS_BLOCK_SIZE;
-		struct a1fs_extent *extent;
-		extent = (struct a1fs_extent*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + inode->indirect_block));
-		int i = inode->count_extent;
-		int j = extent[i-1].start + extent[i-1].count - 1;
-		
-		// get first byte that does not belong to the inode and add <leftover_space> 0s to the end
-		struct a1fs_dentry *dentry;
-		dentry = (struct a1fs_dentry*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + j) + enough_space);
-		memset(dentry, 0, remaining);
+	if ((uint64_t)offset + size > fs_max_file_size(fs)) {
+		return -EFBIG;
 	}
-	
-	if(remaining >= num_bytes) {	// no need to allocate new blocks
-		inode->size += num_bytes;
-	}
-	else {	// need to allocate new blocks
-		int rest = num_bytes - remaining;
-		// get the number of blocks we need to allocate for that inode
-		int num_blocks = ceiling(rest, A1FS_BLOCK_SIZE);
-		if(set_block(inode, num_blocks, fs) != 0) {
-			return -ENOSPC;
+	inode_wrlock(fs, inode->inode_num);
+	uint64_t old_size = inode->size;
+	uint64_t old_blocks = inode_nblocks(inode, fs);
+	// cover everything up to the end of the write with extents
+	if((uint64_t)offset + size > inode->size){
+		value = extend_file(inode, offset + size, fs);
+		if (value != 0) {
+			trim_file(inode, old_blocks, fs);
+			inode_unlock(fs, inode->inode_num);
+			return value;
 		}
-		inode->size += num_bytes;
 	}
-	return 0;
+
+	ssize_t done = 0;
+	struct fuse_buf *src = &buf->buf[buf->idx];
+	if (inode->flags & A1FS_INODE_INLINE) {
+		// the write fits in the inode (extend_file() moves it out otherwise)
+		struct fuse_bufvec dst_buf = FUSE_BUFVEC_INIT(size);
+		dst_buf.buf[0].mem = (char*)inode_inline(inode) + offset;
+		done = fuse_buf_copy(&dst_buf, buf, 0);
+	} else if (fs->detect_zeroes && buf->count - buf->idx == 1 && !(src->flags & FUSE_BUF_IS_FD)) {
+		// full blocks of zeros that would land in a hole are not stored
+		const char *data = (const char*)src->mem + buf->off;
+		size_t pos = 0;
+		while (pos < size && done >= 0) {
+			if (skip_zero_block(inode, offset + pos, data + pos, size - pos, fs)) {
+				pos += A1FS_BLOCK_SIZE;
+				continue;
+			}
+			// store everything up to the next block that can be skipped
+			size_t n = A1FS_BLOCK_SIZE - (offset + pos) % A1FS_BLOCK_SIZE;
+			while (pos + n < size &&
+			       !skip_zero_block(inode, offset + pos + n, data + pos + n, size - pos - n, fs)) {
+				n += A1FS_BLOCK_SIZE;
+			}
+			n = n < size - pos ? n : size - pos;
+			struct fuse_bufvec part = FUSE_BUFVEC_INIT(n);
+			part.buf[0].mem = (void*)(data + pos);
+			done = write_range(inode, offset + pos, n, &part, fs);
+			if (done > 0) {
+				pos += done;
+				done = (size_t)done == n ? 0 : -EIO;
+			}
+		}
+		done = pos > 0 ? (ssize_t)pos : done;
+	} else {
+		done = write_range(inode, offset, size, buf, fs);
+	}
+	if ((size_t)done != size) {
+		// a failed or short write only keeps the size it actually reached
+		uint64_t end = done > 0 ? offset + done : 0;
+		inode->size = end > old_size ? end : old_size;
+		trim_file(inode, old_blocks, fs);
+	}
+	if (done > 0) {
+		clock_gettime(CLOCK_REALTIME, &(inode->mtime));
+	}
+	inode_dirty(inode, fs);
+	inode_unlock(fs, inode->inode_num);
+	return done;
 }
 
 /**
- * Change the size of a file.
+ * Write data to a file from a buffer; see a1fs_write_buf().
  *
- * Implements the truncate() system call. Supports both extending and shrinking.
- * If the file is extended, the new uninitialized range at the end must be
- * filled with zeros.
+ * @param path    path to the file to write to.
+ * @param buf     pointer to the buffer containing the data.
+ * @param size    buffer size (number of bytes requested).
+ * @param offset  offset from the beginning of the file to write to.
+ * @param fi      unused.
+ * @return        number of bytes written on success; -errno on error.
+ */
+static int a1fs_write(const char *path, const char *buf, size_t size,
+                      off_t offset, struct fuse_file_info *fi)
+{
+	struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+	src.buf[0].mem = (void*)buf;
+	return a1fs_write_buf(path, &src, offset, fi);
+}
+
+/**
+ * Allocate space for a file without writing to it.
+ *
+ * Implements the fallocate() system call. The blocks of the byte range that
+ * are not allocated yet (holes, and the blocks past the last extent) are
+ * allocated as unwritten extents: they read as zeros and are only written when
+ * data is written to them. Unless FALLOC_FL_KEEP_SIZE is given, the file is
+ * extended to cover the range.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
  *   "path" exists and is a file.
  *
  * Errors:
- *   ENOMEM  not enough memory (e.g. a malloc() call failed).
- *   ENOSPC  not enough free space in the file system.
+ *   EFBIG       the range ends past the maximum file size.
+ *   EINVAL      invalid offset or length.
+ *   EOPNOTSUPP  unsupported mode (only FALLOC_FL_KEEP_SIZE is supported).
+ *   ENOSPC      not enough free space in the file system.
  *
- * @param path  path to the file to set the size.
- * @param size  new file size in bytes.
- * @return      0 on success; -errno on error.
+ * @param path    path to the file.
+ * @param mode    0 or FALLOC_FL_KEEP_SIZE.
+ * @param offset  start of the byte range.
+ * @param length  length of the byte range.
+ * @param fi      unused.
+ * @return        0 on success; -errno on error.
  */
-static int a1fs_truncate(const char *path, off_t size)
+static int a1fs_fallocate(const char *path, int mode, off_t offset,
+                          off_t length, struct fuse_file_info *fi)
 {
+	(void)fi;// unused
 	fs_ctx *fs = get_fs();
 
-	//set new file size, possibly "zeroing out" the uninitialized range
-	(void)path;
-	(void)size;
-	(void)fs;
+	if (mode & ~FALLOC_FL_KEEP_SIZE) {
+		return -EOPNOTSUPP;
+	}
+	if (offset < 0 || length <= 0) {
+		return -EINVAL;
+	}
+	if ((uint64_t)offset + length > fs_max_file_size(fs)) {
+		return -EFBIG;
+	}
 	a1fs_inode *inode;
-	lookup_inode(path, fs, &inode);
-	if((uint64_t)size > inode->size){
-		if(extend_file(inode, size, fs)!= 0) {
-			return -ENOSPC;
-		}
+	int value = lookup_inode(path, fs, &inode);
+	if (value != 0) {
+		return value;
 	}
-	if((uint64_t)size < inode->size){
-		// find the number of blocks we need to deallocate from inode
-		int over_bytes = inode->size - size;
-		inode->size = size;
-		int block_fill_bytes = inode->size % A1FS_BLOCK_SIZE;
-		int num_blocks_deallocate = (over_bytes - block_fill_bytes) / A1FS_BLOCK_SIZE;
-		if(num_blocks_deallocate > 0){
-			unset_block(inode, num_blocks_deallocate, fs);
+	inode_wrlock(fs, inode->inode_num);
+	uint64_t old_size = inode->size;
+	uint64_t end = (uint64_t)offset + length;
+	bool grow = !(mode & FALLOC_FL_KEEP_SIZE) && end > inode->size;
+	if ((inode->flags & A1FS_INODE_INLINE) && end <= fs_inline_size(fs)) {
+		// the range is already stored in the inode
+		if (grow) {
+			value = extend_file(inode, end, fs);
+		}
+	} else {
+		// space past the inline area can only be reserved in data blocks
+		if (inode->flags & A1FS_INODE_INLINE) {
+			value = uninline_file(inode, fs);
+		}
+		uint64_t needed = ceiling(end, A1FS_BLOCK_SIZE);
+		uint64_t have = inode_nblocks(inode, fs);
+		if (value == 0 && grow) {
+			value = extend_file(inode, end, fs);
+		} else if (value == 0 && needed > have) {
+			value = add_hole(inode, needed - have, fs);
+		}
+		if (value == 0) {
+			value = fill_holes(inode, offset / A1FS_BLOCK_SIZE, needed, fs);
+		}
+		if (value != 0) {
+			inode->size = old_size;
+			trim_file(inode, have, fs);
 		}
 	}
-	return 0;
+	if (value == 0 && grow) {
+		clock_gettime(CLOCK_REALTIME, &(inode->mtime));
+	}
+	inode_dirty(inode, fs);
+	inode_unlock(fs, inode->inode_num);
+	return value;
 }
 
-/** 
- * Look up the pointer to the file that we want read/write data
- * 
- * Return the pointer to the file by the given inode
- */
-void *lookup_file(a1fs_inode *inode, int num_bytes, fs_ctx *fs){
-	struct a1fs_extent *extent;
-	extent = (struct a1fs_extent*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + inode->indirect_block));
-	int num_block;
-	int remainder = num_bytes % A1FS_BLOCK_SIZE;
-	if (num_bytes == 0) {
-		num_block = 1;
-	} else {
-		if (remainder == 0) {
-			num_block = num_bytes / A1FS_BLOCK_SIZE;
-		} else {
-			num_block = num_bytes / A1FS_BLOCK_SIZE + 1;
-		}
+/**
+ * Write back the dirty blocks of an extent tree node and of the nodes below it.
+ *
+ * @return  0 on success; -errno on error.
+ */
+int ext_flush_node(a1fs_blk_t blk, fs_ctx *fs) {
+	a1fs_extent_node *node = fs_block(fs, blk);
+	int value = 0;
+	for (unsigned int j = 0; node->levels > 0 && j < node->count && value == 0; j++) {
+		value = ext_flush_node(a1fs_extent_index(node)[j].block, fs);
 	}
-	
-	int total = 0;
-	void *lastb;
-	for(unsigned int i = 0; i < inode->count_extent; i++){
-		total += extent[i].count;
-		if(total >= num_block) {
-			int count = total - num_block;
-			lastb = fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + extent[i].start + count);
-			break;
-		} else {
-			lastb = fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block - 1);
+	if (value == 0) {
+		value = dirtymap_flush(&fs->dirty, fs->sb->s_first_data_block + blk, 1);
+	}
+	return value;
+}
+
+/**
+ * Write back the dirty blocks of a file or directory: its data blocks first,
+ * then its inode and extent blocks, then the allocation metadata (bitmaps,
+ * superblock and group descriptors). Only the blocks marked dirty since they
+ * were last written back are passed to msync(); the rest of the image is not
+ * looked at. (caller must hold the inode's lock)
+ *
+ * @return  0 on success; -errno on error.
+ */
+int sync_inode(a1fs_inode *inode, fs_ctx *fs){
+	int value = 0;
+	uint64_t first = fs->sb->s_first_data_block;
+	ext_path path;
+	for (a1fs_extent *e = extent_first(inode, &path, fs); e && value == 0; e = extent_next(&path, fs)) {
+		// unwritten extents are only dirty where they were zeroed
+		if (!a1fs_extent_hole(e, fs_64bit(fs))) {
+			value = dirtymap_flush(&fs->dirty, first + a1fs_extent_start(e, fs_64bit(fs)),
+			                       a1fs_extent_len(e, fs_64bit(fs)));
 		}
 	}
-	
-	return lastb + remainder;
+	if (value == 0 && (inode->flags & A1FS_INODE_EXTENT_TREE)) {
+		value = ext_flush_node(inode_extent_block(inode, fs), fs);
+	} else if (value == 0 && inode->indirect_block != -1) {
+		value = dirtymap_flush(&fs->dirty, first + inode_extent_block(inode, fs), 1);
+	}
+	if (value == 0) {
+		size_t off = (char*)inode - (char*)fs->image;
+		uint64_t blk = off / A1FS_BLOCK_SIZE;
+		value = dirtymap_flush(&fs->dirty, blk, (off + fs->inode_size - 1) / A1FS_BLOCK_SIZE - blk + 1);
+	}
+	if (value == 0) {
+		// everything before the inode table
+		value = dirtymap_flush(&fs->dirty, 0, fs->sb->inode_table);
+	}
+	return value;
 }
 
 /**
- * Read data from a file.
+ * Synchronize the contents of a file or directory with the image file.
  *
- * Implements the pread() system call. Must return exactly the number of bytes
- * requested except on EOF (end of file). Reads from file ranges that have not
- * been written to must return ranges filled with zeros. You can assume that the
- * byte range from offset to offset + size is contained within a single block.
+ * Implements the fsync() and fdatasync() system calls, for directories too.
+ * Data and metadata are always written back, so datasync is ignored. Dirty
+ * blocks of other files are left to the writeback thread.
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
- * 
- * Errors: none
+ * Errors:
+ *   EIO  the image could not be written.
  *
- * @param path    path to the file to read from.
- * @param buf     pointer to the buffer that receives the data.
- * @param size    buffer size (number of bytes requested).
- * @param offset  offset from the beginning of the file to read from.
- * @param fi      unused.
- * @return        number of bytes read on success; 0 if offset is beyond EOF;
- *                -errno on error.
+ * @param path      path to the file or directory.
+ * @param datasync  unused.
+ * @param fi        unused.
+ * @return          0 on success; -errno on error.
  */
-static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
-                     struct fuse_file_info *fi)
+static int a1fs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
 {
+	(void)datasync;// unused
 	(void)fi;// unused
 	fs_ctx *fs = get_fs();
 
-	//read data from the file at given offset into the buffer
-	(void)path;
-	(void)buf;
-	(void)size;
-	(void)offset;
-	(void)fs;
-	// find the inode from the given path
-	struct a1fs_inode *inode;
-	lookup_inode(path, fs, &inode);
-
-	int enough_space = inode->size % A1FS_BLOCK_SIZE;
-
-	struct a1fs_extent *extent;
-	extent = (struct a1fs_extent*)(fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + inode->indirect_block));
-	int i = inode->count_extent;
-	// last block that belongs to the inode
-	int j = extent[i-1].start + extent[i-1].count - 1;
-	void *lastb = fs->image + A1FS_BLOCK_SIZE * (fs->sb->s_first_data_block + j) + enough_space;
-
-	// find the remaining bytes that does not belong to the inode in the last block of the inode.
-	int byte_num;
-	int remaining = lastb - lookup_file(inode, offset, fs);
-	// get the number of bytes that is requested
-	if (size - remaining > 0){
-		byte_num = remaining;
-	} else {
-		byte_num = size;
+	a1fs_inode *inode;
+	int value = lookup_inode(path, fs, &inode);
+	if (value != 0) {
+		return value;
 	}
-	// make buffer receive information from the file data
-	memcpy(buf, lookup_file(inode, offset, fs), byte_num);
-	return byte_num;
+	inode_rdlock(fs, inode->inode_num);
+	value = sync_inode(inode, fs);
+	inode_unlock(fs, inode->inode_num);
+	return value;
 }
 
 /**
- * Write data to a file.
+ * Open a file.
  *
- * Implements the pwrite() system call. Must return exactly the number of bytes
- * requested except on error. If the offset is beyond EOF (end of file), the
- * file must be extended. If the write creates a "hole" of uninitialized data,
- * the new uninitialized range must filled with zeros. You can assume that the
- * byte range from offset to offset + size is contained within a single block.
+ * Implements the open() system call. Records the handle so that the blocks
+ * the file loses while it is open stay allocated until it is released.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
  *   "path" exists and is a file.
  *
  * Errors:
  *   ENOMEM  not enough memory (e.g. a malloc() call failed).
- *   ENOSPC  not enough free space in the file system.
- *   ENOSPC  too many extents (a1fs only needs to support 512 extents per file)
  *
- * @param path    path to the file to write to.
- * @param buf     pointer to the buffer containing the data.
- * @param size    buffer size (number of bytes requested).
- * @param offset  offset from the beginning of the file to write to.
- * @param fi      unused.
- * @return        number of bytes written on success; -errno on error.
+ * @param path  path to the file to open.
+ * @param fi    receives the handle of the file.
+ * @return      0 on success; -errno on error.
  */
-static int a1fs_write(const char *path, const char *buf, size_t size,
-                      off_t offset, struct fuse_file_info *fi)
+static int a1fs_open(const char *path, struct fuse_file_info *fi)
 {
-	(void)fi;// unused
 	fs_ctx *fs = get_fs();
 
-	//write data from the buffer into the file at given offset, possibly
-	// "zeroing out" the uninitialized range
 	a1fs_inode *inode;
-	lookup_inode(path, fs, &inode);
-	if(size == 0) {
-		return 0;
-	}
-	if(inode->indirect_block == -1){
-		// set an empty extent if the inode does not have an extent
-		if(set_block(inode, 0, fs) != 0) {
-			return -ENOSPC;
-		}
+	int value = lookup_inode(path, fs, &inode);
+	if (value != 0) {
+		return value;
 	}
-	int size_of_inode = inode->size;
-	if(offset > size_of_inode){
-		int total_bytes = offset - inode->size;
-		// add bytes
-		if(extend_file(inode, total_bytes, fs)!= 0) {
-			return -ENOSPC;
-		}
-		size_of_inode = inode->size;
+	if (!openfiles_open(&fs->open_files, inode->inode_num)) {
+		return -ENOMEM;
 	}
-	int rest = (offset + size) - size_of_inode;
-	if(rest > 0){
-		if(extend_file(inode, size, fs)!= 0) {
-			return -ENOSPC;
+	fi->fh = inode->inode_num;
+	return 0;
+}
+
+/**
+ * Release an open file.
+ *
+ * Called when the last reference to a handle from a1fs_open() or a1fs_create()
+ * is dropped. Frees the blocks held for the file if it has no other handles.
+ *
+ * @param path  unused.
+ * @param fi    handle of the file.
+ * @return      0.
+ */
+static int a1fs_release(const char *path, struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	fs_ctx *fs = get_fs();
+
+	block_run *held;
+	size_t n = openfiles_release(&fs->open_files, fi->fh, &held);
+	if (n > 0) {
+		pthread_mutex_lock(&fs->dblock_bitmap_lock);
+		for (size_t i = 0; i < n; i++) {
+			unset_flip_block_bitmap(held[i].start, held[i].count, fs);
 		}
+		pthread_mutex_unlock(&fs->dblock_bitmap_lock);
 	}
-	void *byte = lookup_file(inode, offset, fs);
-	memcpy(byte, buf, size);
-	return size;
+	free(held);
+	return 0;
 }
 
 
@@ -1273,11 +3656,18 @@ static struct fuse_operations a1fs_ops = {
 	.mkdir    = a1fs_mkdir,
 	.rmdir    = a1fs_rmdir,
 	.create   = a1fs_create,
+	.open     = a1fs_open,
+	.release  = a1fs_release,
 	.unlink   = a1fs_unlink,
 	.utimens  = a1fs_utimens,
 	.truncate = a1fs_truncate,
 	.read     = a1fs_read,
 	.write    = a1fs_write,
+	.read_buf  = a1fs_read_buf,
+	.write_buf = a1fs_write_buf,
+	.fallocate = a1fs_fallocate,
+	.fsync     = a1fs_fsync,
+	.fsyncdir  = a1fs_fsync,
 };
 
 int main(int argc, char *argv[])
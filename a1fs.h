@@ -19,6 +19,7 @@
 #pragma once  
   
 #include <assert.h>  
+#include <stdbool.h>
 #include <stdint.h>  
 #include <limits.h>  
 #include <sys/stat.h>  
@@ -34,8 +35,11 @@
  */  
 #define A1FS_BLOCK_SIZE 4096  
   
-/** Block number (block pointer) type. */  
-typedef uint32_t a1fs_blk_t;  
+/**
+ * Block number (block pointer) type. Block numbers are stored on disk in 32
+ * bits, or in 40 bits in extents with A1FS_FEATURE_64BIT.
+ */
+typedef uint64_t a1fs_blk_t;  
   
 /** Inode number type. */  
 typedef uint32_t a1fs_ino_t;  
@@ -52,16 +56,25 @@ typedef struct a1fs_superblock {
     uint64_t size;  
   
     //TODO: add necessary fields  
-    a1fs_blk_t   s_first_data_block;  /* First Data Block */  
+    uint32_t   s_first_data_block;  /* First Data Block */  
 	a1fs_ino_t   inode_table;       /* Inodes table block, first inode */  
     uint32_t   s_block_size;    /* Block size */  
     uint32_t   s_inodes_count;      /* Inodes count */  
-    uint32_t   data_block_count;      /* Data blocks count */  
-    a1fs_blk_t   dblock_bitmap;      /* Data blocks bitmap block */  
+    uint32_t   data_block_count;      /* Data blocks count (unless A1FS_FEATURE_64BIT) */  
+    uint32_t   dblock_bitmap;      /* Data blocks bitmap block */  
     a1fs_ino_t   inode_bitmap;      /* Inodes bitmap block */  
-    uint32_t   s_free_blocks_count; /* Free blocks count */  
+    uint32_t   s_free_blocks_count; /* Free blocks count (unless A1FS_FEATURE_64BIT) */  
     uint32_t   s_free_inodes_count; /* Free inodes count */  
-	unsigned char padding[32]; //TODO: change
+    uint32_t   s_features;      /* Optional features (A1FS_FEATURE_*) */
+    uint32_t   s_groups_count;      /* Block groups count (A1FS_FEATURE_GROUPS) */
+    uint32_t   s_blocks_per_group;      /* Data blocks per group */
+    uint32_t   s_inodes_per_group;      /* Inodes per group */
+    uint32_t   s_group_desc;      /* Group descriptor table block */
+    uint32_t   s_inode_size;      /* Inode size in bytes (A1FS_FEATURE_INLINE_DATA) */
+    uint32_t   s_uninit;      /* Regions left uninitialized (A1FS_UNINIT_*) */
+    uint32_t   s_state;      /* State of the file system (A1FS_STATE_*) */
+    uint64_t   s_data_blocks_count64;      /* Data blocks count (A1FS_FEATURE_64BIT) */
+    uint64_t   s_free_blocks_count64;      /* Free blocks count (A1FS_FEATURE_64BIT) */
 } a1fs_superblock;  
   
 // Superblock must fit into a single block  
@@ -70,18 +83,210 @@ typedef struct a1fs_superblock {
   
 static_assert(sizeof(a1fs_superblock) <= A1FS_BLOCK_SIZE,  
               "superblock is too large");  
-  
-  
-/** Extent - a contiguous range of blocks. */  
+
+/** Directories outgrowing one block switch to a hashed index (a1fs_dx_node). */
+#define A1FS_FEATURE_DIR_INDEX 0x1
+/** Inodes and data blocks are divided into block groups (a1fs_group_desc). */
+#define A1FS_FEATURE_GROUPS 0x2
+/**
+ * Inodes are s_inode_size bytes long; small files keep their data in the
+ * space after the a1fs_inode fields (A1FS_INODE_INLINE).
+ */
+#define A1FS_FEATURE_INLINE_DATA 0x4
+/** Directory blocks hold variable length entries (a1fs_dirent). */
+#define A1FS_FEATURE_COMPACT_DIRS 0x8
+/**
+ * Data block numbers are 40 bits long (see a1fs_extent) and the block counts
+ * are kept in the 64-bit superblock fields, for images of more than 2^32 blocks.
+ */
+#define A1FS_FEATURE_64BIT 0x10
+
+/**
+ * Metadata regions that mkfs.a1fs left as they were instead of clearing them
+ * (s_uninit), because the image could not be zeroed without writing it.
+ */
+/** The data block bitmap is cleared at the first mount. */
+#define A1FS_UNINIT_BLOCK_BITMAP 0x1
+/** The inode bitmap is cleared at the first mount, except for the root inode. */
+#define A1FS_UNINIT_INODE_BITMAP 0x2
+/** Free inodes may hold garbage; each inode is cleared when it is allocated. */
+#define A1FS_UNINIT_INODE_TABLE 0x4
+
+/**
+ * The image is mounted, or was not unmounted cleanly. Data blocks that files
+ * lose while they are open stay marked used until the last handle is released
+ * (see openfiles), so after a crash they may belong to no file; a mount that
+ * finds this set frees them.
+ */
+#define A1FS_STATE_MOUNTED 0x1
+
+/**
+ * Block group descriptor.
+ *
+ * Group g owns data blocks [g * s_blocks_per_group, (g + 1) * s_blocks_per_group)
+ * and inodes [g * s_inodes_per_group, (g + 1) * s_inodes_per_group), that is
+ * its own slice of both bitmaps, of the inode table and of the data region
+ * (the last group may be shorter). Files are placed in the group of their
+ * parent directory; new directories are spread over the groups. The
+ * descriptor table starts at block s_group_desc.
+ */
+typedef struct a1fs_group_desc {
+    /** Free data blocks in the group. */
+    uint32_t free_blocks;
+    /** Free inodes in the group. */
+    uint32_t free_inodes;
+    /** Directories whose inodes are in the group. */
+    uint32_t used_dirs;
+    uint32_t padding;
+} a1fs_group_desc;
+  
+  
+/**
+ * Extent - a contiguous range of blocks.
+ *
+ * With A1FS_FEATURE_64BIT ("wide" extents) bits 23-30 of count hold bits
+ * 32-39 of the starting block and the length is limited to 23 bits, so that
+ * extents keep their size. The fields should be accessed with the functions
+ * below, which take whether the extent is wide.
+ */
 typedef struct a1fs_extent {  
-    /** Starting block of the extent. */  
-    a1fs_blk_t start;  
-    /** Number of blocks in the extent. */  
-    a1fs_blk_t count;  
+    /** Starting block of the extent (the low 32 bits if wide). */  
+    uint32_t start;  
+    /** Number of blocks in the extent, and flags. */  
+    uint32_t count;  
   
 } a1fs_extent;  
-  
-  
+
+/**
+ * Set in a1fs_extent.count if the blocks are allocated (e.g. by fallocate())
+ * but have not been written yet; such blocks read as zeros.
+ */
+#define A1FS_EXTENT_UNWRITTEN 0x80000000u
+/** Maximum extent length; the low bits of a1fs_extent.count. */
+#define A1FS_EXTENT_MAX_LEN 0x7fffffffu
+/** Maximum length of a wide extent. */
+#define A1FS_EXTENT_MAX_LEN_64 0x7fffffu
+/**
+ * Starting block of a hole: a range of a sparse file that has no blocks and
+ * reads as zeros. Holes take their place in the extent array like any other
+ * extent, so logical block offsets are still the sums of the preceding lengths.
+ */
+#define A1FS_EXTENT_HOLE UINT32_MAX
+/** Starting block of a wide hole; never a data block. */
+#define A1FS_EXTENT_HOLE_64 ((1ull << 40) - 1)
+
+/** Maximum length of an extent. */
+static inline uint32_t a1fs_extent_max_len(bool wide)
+{
+    return wide ? A1FS_EXTENT_MAX_LEN_64 : A1FS_EXTENT_MAX_LEN;
+}
+
+/** Starting block of an extent. */
+static inline a1fs_blk_t a1fs_extent_start(const a1fs_extent *e, bool wide)
+{
+    return wide ? (a1fs_blk_t)(e->count >> 23 & 0xff) << 32 | e->start : e->start;
+}
+
+/** Number of blocks in an extent. */
+static inline a1fs_blk_t a1fs_extent_len(const a1fs_extent *e, bool wide)
+{
+    return e->count & a1fs_extent_max_len(wide);
+}
+
+/** Whether an extent is allocated but unwritten. */
+static inline int a1fs_extent_unwritten(const a1fs_extent *e)
+{
+    return (e->count & A1FS_EXTENT_UNWRITTEN) != 0;
+}
+
+/** Whether an extent is a hole. */
+static inline int a1fs_extent_hole(const a1fs_extent *e, bool wide)
+{
+    return a1fs_extent_start(e, wide) == (wide ? A1FS_EXTENT_HOLE_64 : A1FS_EXTENT_HOLE);
+}
+
+/**
+ * Make an extent of len blocks (at most a1fs_extent_max_len()) starting at
+ * block start, or a hole if start is A1FS_EXTENT_HOLE(_64).
+ */
+static inline a1fs_extent a1fs_extent_make(a1fs_blk_t start, a1fs_blk_t len,
+                                           bool unwritten, bool wide)
+{
+    uint32_t hi = wide ? (uint32_t)(start >> 32) << 23 : 0;
+    return (a1fs_extent){ (uint32_t)start,
+                          hi | (uint32_t)len | (unwritten ? A1FS_EXTENT_UNWRITTEN : 0) };
+}
+
+/** Hole of len blocks. */
+static inline a1fs_extent a1fs_extent_make_hole(a1fs_blk_t len, bool wide)
+{
+    return a1fs_extent_make(wide ? A1FS_EXTENT_HOLE_64 : A1FS_EXTENT_HOLE, len, false, wide);
+}
+
+/**
+ * Maximum number of blocks in a file: as many as block numbers can address,
+ * 2^32 (16 TB), or 2^40 (4 PB) with wide extents. This also bounds the number
+ * of hole extents that a sparse file of the maximum size needs.
+ */
+static inline uint64_t a1fs_max_file_blocks(bool wide)
+{
+    return wide ? 1ull << 40 : 1ull << 32;
+}
+
+
+/**
+ * Extent tree.
+ *
+ * A file whose extents outgrow its inode and a single extent block keeps them
+ * in a B+tree of a1fs_extent_node blocks (A1FS_INODE_EXTENT_TREE) rooted at the
+ * block the inode points to. Leaves hold the extents of consecutive ranges of
+ * the file in order. Index nodes hold entries sorted by the logical block
+ * number of the first block under each child; the lblk of the first entry of
+ * a node is the first block covered by the node itself. Extents only change
+ * length at the end of the file and are otherwise split or merged in place, so
+ * the keys never have to be updated.
+ */
+typedef struct a1fs_extent_idx {
+    /** Logical block number of the first block under the child. */
+    uint64_t lblk;
+    /** Block number of the child node. */
+    uint64_t block;
+} a1fs_extent_idx;
+
+typedef struct a1fs_extent_node {
+    /** Number of entries in use. */
+    uint32_t count;
+    /** Number of index levels below this node; 0 in leaves. */
+    uint32_t levels;
+} a1fs_extent_node;
+
+/** Maximum number of extents in a leaf. */
+#define A1FS_EXTENT_LEAF_LIMIT \
+    ((A1FS_BLOCK_SIZE - sizeof(a1fs_extent_node)) / sizeof(a1fs_extent))
+
+/** Maximum number of entries in an index node. */
+#define A1FS_EXTENT_INDEX_LIMIT \
+    ((A1FS_BLOCK_SIZE - sizeof(a1fs_extent_node)) / sizeof(a1fs_extent_idx))
+
+/** Maximum number of index levels (including the root). */
+#define A1FS_EXTENT_MAX_DEPTH 5
+
+/** Extents of a leaf, right after the node header. */
+static inline a1fs_extent *a1fs_extent_leaf(a1fs_extent_node *node)
+{
+    return (a1fs_extent*)(node + 1);
+}
+
+/** Entries of an index node, right after the node header. */
+static inline a1fs_extent_idx *a1fs_extent_index(a1fs_extent_node *node)
+{
+    return (a1fs_extent_idx*)(node + 1);
+}
+  
+  
+/** Number of extents that fit in a minimal (64-byte) inode. */
+#define A1FS_INODE_EXTENTS 2
+
 /** a1fs inode. */  
 typedef struct a1fs_inode {  
     /** File mode. */  
@@ -111,9 +316,25 @@ typedef struct a1fs_inode {
   
     //TODO: add necessary fields  
     uint32_t inode_num; /* Index of inode */
-    uint32_t count_extent; /* Extents count in disk sector */   
-    int32_t indirect_block; /* Pointer to block that points to 512 extents */  
-    unsigned char padding[18]; 
+    /** Number of extents, in the whole tree with A1FS_INODE_EXTENT_TREE. */
+    uint32_t count_extent;
+    /**
+     * Block holding up to 512 extents, or the root of the extent tree with
+     * A1FS_INODE_EXTENT_TREE; -1 if the extents are kept in the inode.
+     */
+    int32_t indirect_block;
+    /**
+     * Inode flags (A1FS_INODE_*). With A1FS_FEATURE_64BIT, the bits from
+     * A1FS_INODE_BLOCK_HI_SHIFT up are bits 31-39 of the extent block number
+     * and indirect_block holds its low 31 bits.
+     */
+    uint32_t flags;
+    /**
+     * First extents of the file, while indirect_block is -1. They continue
+     * into the inline data area of larger inodes (unless A1FS_INODE_INLINE is
+     * set); once they no longer fit, all extents move to indirect_block.
+     */
+    a1fs_extent extents[A1FS_INODE_EXTENTS];
   
     // NOTE: You might have to add padding (e.g. a dummy char array field)   
     // at the end of the struct in order to satisfy the assertion below.   
@@ -124,6 +345,21 @@ typedef struct a1fs_inode {
   
 // A single block must fit an integral number of inodes  
 static_assert(A1FS_BLOCK_SIZE % sizeof(a1fs_inode) == 0, "invalid inode size");  
+
+/** Directory blocks are organized as a hash tree rather than a flat array. */
+#define A1FS_INODE_INDEXED 0x1
+/**
+ * File data is stored inside the inode, after the a1fs_inode fields, instead of
+ * in extents; the rest of that area is zero.
+ */
+#define A1FS_INODE_INLINE 0x2
+/**
+ * The extent block is the root of an extent tree (a1fs_extent_node) rather
+ * than a plain array; set once the extents no longer fit in one block.
+ */
+#define A1FS_INODE_EXTENT_TREE 0x4
+/** First bit of the high part of the extent block number in a1fs_inode.flags. */
+#define A1FS_INODE_BLOCK_HI_SHIFT 23
   
   
 /** Maximum file name (path component) length. Includes the null terminator. */  
@@ -132,7 +368,14 @@ static_assert(A1FS_BLOCK_SIZE % sizeof(a1fs_inode) == 0, "invalid inode size");
 /** Maximum file path length. Includes the null terminator. */  
 #define A1FS_PATH_MAX PATH_MAX  
   
-/** Fixed size directory entry structure. */  
+/**
+ * Fixed size directory entry structure.
+ *
+ * An entry with an empty name is an unused slot. Removing an entry leaves an
+ * unused slot behind rather than moving other entries into it, so that an entry
+ * keeps its position for as long as it exists; a linear directory only shrinks
+ * by the unused slots at its end.
+ */
 typedef struct a1fs_dentry {  
     /** Inode number. */  
     a1fs_ino_t ino;  
@@ -141,4 +384,88 @@ typedef struct a1fs_dentry {
   
 } a1fs_dentry;  
   
-static_assert(sizeof(a1fs_dentry) == 256, "invalid dentry size"); 
+static_assert(sizeof(a1fs_dentry) == 256, "invalid dentry size");
+
+/** Number of fixed size directory entries in one block. */
+#define A1FS_DENTRIES_PER_BLOCK (A1FS_BLOCK_SIZE / sizeof(a1fs_dentry))
+
+/**
+ * Variable length directory entry (A1FS_FEATURE_COMPACT_DIRS).
+ *
+ * Every directory block is divided into records that follow each other without
+ * gaps; a record never crosses a block boundary. A record with name_len 0 is
+ * unused, and the space past the name of a used record (up to rec_len) is free
+ * as well. A removed record is merged into the record before it, so only the
+ * first record of a block can be unused and an empty block is a single unused
+ * record.
+ */
+typedef struct a1fs_dirent {
+    /** Inode number. */
+    a1fs_ino_t ino;
+    /** Length of the record in bytes (a multiple of 4). */
+    uint16_t rec_len;
+    /** Name length without the null terminator; 0 if the record is unused. */
+    uint8_t name_len;
+    /** File type: the S_IFMT bits of the inode mode, shifted right by 12. */
+    uint8_t file_type;
+    /** Name hash (a1fs_name_hash()). */
+    uint32_t hash;
+    /** File name. A null-terminated string. */
+    char name[];
+} a1fs_dirent;
+
+static_assert(sizeof(a1fs_dirent) == 12, "invalid dirent size");
+
+/** Size of a record holding a name of len characters. */
+#define A1FS_DIRENT_SIZE(len) ((sizeof(a1fs_dirent) + (len) + 1 + 3) & ~(size_t)3)
+
+/** Maximum number of records in one block. */
+#define A1FS_DIRENTS_PER_BLOCK_MAX (A1FS_BLOCK_SIZE / A1FS_DIRENT_SIZE(1))
+
+
+/**
+ * Hashed directory index.
+ *
+ * An indexed directory keeps a tree of a1fs_dx_node blocks rooted at its
+ * logical block 0. Each node entry covers the names whose hash is greater or
+ * equal to its hash and less than the hash of the following entry; the hash of
+ * the first entry is ignored and taken to be 0. Entries of the bottom level
+ * nodes point to leaf blocks that hold A1FS_DENTRIES_PER_BLOCK fixed size
+ * dentries, with unused slots marked by an empty name, or a1fs_dirent records
+ * with A1FS_FEATURE_COMPACT_DIRS. All block numbers are logical block numbers
+ * within the directory.
+ */
+typedef struct a1fs_dx_entry {
+    /** Lowest name hash covered by this entry. */
+    uint32_t hash;
+    /** Logical block of the child node or leaf. */
+    uint32_t block;
+} a1fs_dx_entry;
+
+typedef struct a1fs_dx_node {
+    /** Number of entries in use. */
+    uint16_t count;
+    /** Number of index levels below this node; 0 if entries point to leaves. */
+    uint16_t levels;
+    /** Number of directory entries in the whole directory (root only). */
+    uint32_t nentries;
+    /** Entries sorted by hash. */
+    a1fs_dx_entry entries[];
+} a1fs_dx_node;
+
+/** Maximum number of entries in one index node. */
+#define A1FS_DX_LIMIT \
+    ((A1FS_BLOCK_SIZE - sizeof(a1fs_dx_node)) / sizeof(a1fs_dx_entry))
+
+/** Maximum number of index levels (including the root). */
+#define A1FS_DX_MAX_DEPTH 3
+
+/** Hash a file name for the directory index (32-bit FNV-1a). */
+static inline uint32_t a1fs_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char*)name; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,575 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Image block cache implementation.
+ */
+
+// O_DIRECT
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "bcache.h"
+#include "bitmap.h"
+#include "map.h"
+
+
+/** The block was modified since it was last written back. */
+#define BCACHE_DIRTY 0x1
+/** The block was used since the clock hand last passed it. */
+#define BCACHE_REF   0x2
+
+/** End of a hash chain. */
+#define BCACHE_NONE UINT32_MAX
+
+
+/** Report an error that leaves a faulting thread with no way to go on. */
+static void fail(const char *what)
+{
+	perror(what);
+	abort();
+}
+
+static char *block_addr(bcache *bc, uint64_t block)
+{
+	return (char*)bc->image + block * bc->block_size;
+}
+
+static bool test_bit(const unsigned char *bits, uint64_t i)
+{
+	return bits[i / 8] & (0x80 >> i % 8);
+}
+
+static uint32_t hash(bcache *bc, uint64_t block)
+{
+	return (block * 0x9e3779b97f4a7c15ull >> 32) & bc->mask;
+}
+
+/** Find the slot that holds a block; BCACHE_NONE if it is not cached. */
+static uint32_t find_slot(bcache *bc, uint64_t block)
+{
+	uint32_t s = bc->heads[hash(bc, block)];
+	while (s != BCACHE_NONE && bc->blocks[s] != block) {
+		s = bc->next[s];
+	}
+	return s;
+}
+
+static void link_slot(bcache *bc, uint32_t s)
+{
+	uint32_t *head = &bc->heads[hash(bc, bc->blocks[s])];
+	bc->next[s] = *head;
+	*head = s;
+}
+
+static void unlink_slot(bcache *bc, uint32_t s)
+{
+	uint32_t *p = &bc->heads[hash(bc, bc->blocks[s])];
+	while (*p != s) {
+		p = &bc->next[*p];
+	}
+	*p = bc->next[s];
+}
+
+/** Free a slot; the last slot in use takes its place. */
+static void remove_slot(bcache *bc, uint32_t s)
+{
+	unlink_slot(bc, s);
+	uint32_t last = --bc->count;
+	if (s != last) {
+		unlink_slot(bc, last);
+		bc->blocks[s] = bc->blocks[last];
+		bc->flags[s] = bc->flags[last];
+		link_slot(bc, s);
+	}
+	if (bc->hand >= bc->count) {
+		bc->hand = 0;
+	}
+}
+
+/**
+ * Set or lift the write protection of blocks [block, block + count). Lifting
+ * it wakes up the threads waiting to write them.
+ *
+ * @return  0 on success; -errno on error.
+ */
+static int protect(bcache *bc, uint64_t block, uint64_t count, bool wp)
+{
+	struct uffdio_writeprotect arg = {
+		.range = { (uintptr_t)block_addr(bc, block), count * bc->block_size },
+		.mode = wp ? UFFDIO_WRITEPROTECT_MODE_WP : 0,
+	};
+	// EAGAIN: the address space was changing
+	while (ioctl(bc->uffd, UFFDIO_WRITEPROTECT, &arg) != 0) {
+		if (errno != EAGAIN) {
+			return -errno;
+		}
+	}
+	return 0;
+}
+
+/** Wake up the threads waiting for a block; they access it again. */
+static void wake(bcache *bc, uint64_t block)
+{
+	struct uffdio_range range = { (uintptr_t)block_addr(bc, block), bc->block_size };
+	if (ioctl(bc->uffd, UFFDIO_WAKE, &range) != 0) {
+		fail("UFFDIO_WAKE");
+	}
+}
+
+/**
+ * Write blocks [block, block + count) to the image file; they are protected
+ * first, so that they do not change while they are written (caller holds
+ * bc->lock, and the blocks are cached).
+ *
+ * @return  0 on success; -errno on error.
+ */
+static int write_back(bcache *bc, uint64_t block, uint64_t count)
+{
+	int ret = protect(bc, block, count, true);
+	const char *start = block_addr(bc, block);
+	size_t len = count * bc->block_size;
+	for (size_t done = 0; ret == 0 && done < len; ) {
+		ssize_t n = pwrite(bc->fd, start + done, len - done, block * bc->block_size + done);
+		if (n < 0) {
+			ret = -errno;
+			break;
+		}
+		done += n;
+	}
+	return ret;
+}
+
+/**
+ * Evict a block chosen with the CLOCK algorithm, writing it back first if it
+ * is dirty (caller holds bc->lock; the cache is full).
+ *
+ * @return  the slot freed.
+ */
+static uint32_t evict(bcache *bc)
+{
+	for (;;) {
+		uint32_t s = bc->hand;
+		bc->hand = (bc->hand + 1) % bc->count;
+		if (bc->flags[s] & BCACHE_REF) {
+			bc->flags[s] &= ~BCACHE_REF;
+			continue;
+		}
+
+		uint64_t block = bc->blocks[s];
+		int ret = bc->flags[s] & BCACHE_DIRTY ? write_back(bc, block, 1) : 0;
+		if (ret != 0) {
+			errno = -ret;
+			fail("Failed to write back an evicted block");
+		}
+		// the next access faults and reads the block in again
+		if (madvise(block_addr(bc, block), bc->block_size, MADV_DONTNEED) != 0) {
+			fail("madvise");
+		}
+		unlink_slot(bc, s);
+		return s;
+	}
+}
+
+/**
+ * Read a block in and place it in the image range, which wakes up the threads
+ * waiting for it; it is write-protected unless write is set, and then it is
+ * dirty (caller holds bc->lock; the block is not cached).
+ */
+static void read_in(bcache *bc, uint64_t block, bool write)
+{
+	bool pinned = block < bc->npinned;
+	uint32_t s = BCACHE_NONE;
+	if (!pinned) {
+		s = bc->count < bc->capacity ? bc->count++ : evict(bc);
+	}
+
+	ssize_t n = pread(bc->fd, bc->buf, bc->block_size, block * bc->block_size);
+	if (n != (ssize_t)bc->block_size) {
+		if (n >= 0) {
+			errno = EIO;
+		}
+		fail("Failed to read a block of the image");
+	}
+	struct uffdio_copy copy = {
+		.dst = (uintptr_t)block_addr(bc, block),
+		.src = (uintptr_t)bc->buf,
+		.len = bc->block_size,
+		.mode = write ? 0 : UFFDIO_COPY_MODE_WP,
+	};
+	while (ioctl(bc->uffd, UFFDIO_COPY, &copy) != 0) {
+		if (errno != EAGAIN) {
+			fail("UFFDIO_COPY");
+		}
+	}
+
+	if (pinned) {
+		bitmap_set_range(bc->pinned_in, block, 1);
+		if (write) {
+			bitmap_set_range(bc->pinned_dirty, block, 1);
+		}
+	} else {
+		bc->blocks[s] = block;
+		bc->flags[s] = BCACHE_REF | (write ? BCACHE_DIRTY : 0);
+		link_slot(bc, s);
+	}
+}
+
+static void handle_fault(bcache *bc, const struct uffd_msg *msg)
+{
+	uint64_t block = (msg->arg.pagefault.address - (uintptr_t)bc->image) / bc->block_size;
+	bool wp = msg->arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP;
+	bool write = msg->arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE;
+
+	pthread_mutex_lock(&bc->lock);
+	uint32_t s = BCACHE_NONE;
+	bool cached = block < bc->npinned ? test_bit(bc->pinned_in, block)
+	                                  : (s = find_slot(bc, block)) != BCACHE_NONE;
+	if (!cached && !wp) {
+		read_in(bc, block, write);
+	} else if (cached && wp) {
+		// the first write since the block was read in or written back
+		if (s == BCACHE_NONE) {
+			bitmap_set_range(bc->pinned_dirty, block, 1);
+		} else {
+			bc->flags[s] |= BCACHE_DIRTY | BCACHE_REF;
+		}
+		if (protect(bc, block, 1, false) != 0) {
+			fail("UFFDIO_WRITEPROTECT");
+		}
+	} else {
+		// served by an earlier fault, or evicted since this one; try again
+		wake(bc, block);
+	}
+	pthread_mutex_unlock(&bc->lock);
+}
+
+static void *cache_thread(void *arg)
+{
+	bcache *bc = (bcache*)arg;
+	struct pollfd fds[2] = {
+		{ .fd = bc->uffd, .events = POLLIN },
+		{ .fd = bc->stop_fd, .events = POLLIN },
+	};
+	struct uffd_msg msgs[16];
+
+	for (;;) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fail("poll");
+		}
+		if (fds[1].revents) {
+			return NULL;
+		}
+		ssize_t n = read(bc->uffd, msgs, sizeof(msgs));
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				continue;
+			}
+			fail("userfaultfd");
+		}
+		for (size_t i = 0; i < n / sizeof(msgs[0]); i++) {
+			if (msgs[i].event == UFFD_EVENT_PAGEFAULT) {
+				handle_fault(bc, &msgs[i]);
+			}
+		}
+	}
+}
+
+/**
+ * Create a userfaultfd that write-protects and serves the faults on the image
+ * range.
+ *
+ * @return  true on success; false on failure (the error is printed).
+ */
+static bool open_uffd(bcache *bc)
+{
+	bc->uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+#ifdef USERFAULTFD_IOC_NEW
+	if (bc->uffd < 0 && errno == EPERM) {
+		int dev = open("/dev/userfaultfd", O_RDWR | O_CLOEXEC);
+		if (dev >= 0) {
+			bc->uffd = ioctl(dev, USERFAULTFD_IOC_NEW, O_CLOEXEC | O_NONBLOCK);
+			close(dev);
+		}
+	}
+#endif
+	if (bc->uffd < 0) {
+		perror("userfaultfd");
+		return false;
+	}
+
+	struct uffdio_api api = { .api = UFFD_API, .features = UFFD_FEATURE_PAGEFAULT_FLAG_WP };
+	if (ioctl(bc->uffd, UFFDIO_API, &api) != 0) {
+		perror("UFFDIO_API");
+		return false;
+	}
+	struct uffdio_register reg = {
+		.range = { (uintptr_t)bc->image, bc->nblocks * bc->block_size },
+		.mode = UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP,
+	};
+	if (ioctl(bc->uffd, UFFDIO_REGISTER, &reg) != 0) {
+		perror("UFFDIO_REGISTER");
+		return false;
+	}
+	uint64_t needed = 1ull << _UFFDIO_COPY | 1ull << _UFFDIO_WAKE | 1ull << _UFFDIO_WRITEPROTECT;
+	if ((reg.ioctls & needed) != needed) {
+		fprintf(stderr, "userfaultfd cannot write-protect the image memory\n");
+		return false;
+	}
+	return true;
+}
+
+/** Free what bcache_open() got; the cache thread is not running. */
+static void free_cache(bcache *bc)
+{
+	if (bc->uffd >= 0) {
+		close(bc->uffd);
+	}
+	if (bc->stop_fd >= 0) {
+		close(bc->stop_fd);
+	}
+	if (bc->fd >= 0) {
+		close(bc->fd);
+	}
+	if (bc->image) {
+		munmap(bc->image, bc->nblocks * bc->block_size);
+	}
+	free(bc->buf);
+	free(bc->pinned_in);
+	free(bc->pinned_dirty);
+	free(bc->blocks);
+	free(bc->flags);
+	free(bc->next);
+	free(bc->heads);
+}
+
+void *bcache_open(bcache *bc, const char *path, size_t block_size, uint32_t capacity,
+                  size_t *size)
+{
+	memset(bc, 0, sizeof(*bc));
+	bc->fd = bc->uffd = bc->stop_fd = -1;
+	if (block_size != (size_t)sysconf(_SC_PAGESIZE)) {
+		fprintf(stderr, "The block cache needs the block size to be the page size\n");
+		return NULL;
+	}
+	if (capacity < BCACHE_MIN_CAPACITY) {
+		fprintf(stderr, "The block cache must hold at least %d blocks\n", BCACHE_MIN_CAPACITY);
+		return NULL;
+	}
+
+	// some file systems (e.g. tmpfs before Linux 6.6) do not support O_DIRECT
+	bc->fd = open(path, O_RDWR | O_DIRECT);
+	if (bc->fd < 0 && errno == EINVAL) {
+		bc->fd = open(path, O_RDWR);
+	}
+	if (bc->fd < 0) {
+		perror(path);
+		goto fail;
+	}
+	size_t bytes;
+	if (!image_size(bc->fd, block_size, &bytes)) {
+		goto fail;
+	}
+	bc->block_size = block_size;
+	bc->nblocks = bytes / block_size;
+
+	bc->image = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+	                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (bc->image == MAP_FAILED) {
+		bc->image = NULL;
+		perror("mmap");
+		goto fail;
+	}
+	// blocks are read in and evicted one page at a time
+	madvise(bc->image, bytes, MADV_NOHUGEPAGE);
+
+	bc->capacity = capacity;
+	uint32_t nchains = 1;
+	while (nchains < capacity && nchains < 1u << 31) {
+		nchains *= 2;
+	}
+	bc->mask = nchains - 1;
+	bc->blocks = malloc((size_t)capacity * sizeof(uint64_t));
+	bc->flags = malloc(capacity);
+	bc->next = malloc((size_t)capacity * sizeof(uint32_t));
+	bc->heads = malloc((size_t)nchains * sizeof(uint32_t));
+	if (posix_memalign(&bc->buf, block_size, block_size) != 0) {
+		bc->buf = NULL;
+	}
+	if (!bc->blocks || !bc->flags || !bc->next || !bc->heads || !bc->buf) {
+		fprintf(stderr, "Out of memory for the block cache\n");
+		goto fail;
+	}
+	memset(bc->heads, 0xff, (size_t)nchains * sizeof(uint32_t));
+
+	if (!open_uffd(bc)) {
+		goto fail;
+	}
+	bc->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (bc->stop_fd < 0) {
+		perror("eventfd");
+		goto fail;
+	}
+	pthread_mutex_init(&bc->lock, NULL);
+	if (pthread_create(&bc->thread, NULL, cache_thread, bc) != 0) {
+		fprintf(stderr, "Failed to start the block cache thread\n");
+		pthread_mutex_destroy(&bc->lock);
+		goto fail;
+	}
+	*size = bytes;
+	return bc->image;
+
+fail:
+	free_cache(bc);
+	return NULL;
+}
+
+bool bcache_pin(bcache *bc, uint64_t nblocks)
+{
+	assert(bc->npinned == 0);
+	// the bitmap search functions read whole 64-bit words
+	unsigned char *in = calloc((nblocks + 63) / 64, sizeof(uint64_t));
+	unsigned char *dirty = calloc((nblocks + 63) / 64, sizeof(uint64_t));
+	if (!in || !dirty) {
+		free(in);
+		free(dirty);
+		return false;
+	}
+
+	pthread_mutex_lock(&bc->lock);
+	// blocks already cached move out of the slots
+	for (uint32_t s = bc->count; s-- > 0; ) {
+		uint64_t block = bc->blocks[s];
+		if (block < nblocks) {
+			bitmap_set_range(in, block, 1);
+			if (bc->flags[s] & BCACHE_DIRTY) {
+				bitmap_set_range(dirty, block, 1);
+			}
+			remove_slot(bc, s);
+		}
+	}
+	bc->pinned_in = in;
+	bc->pinned_dirty = dirty;
+	bc->npinned = nblocks;
+	pthread_mutex_unlock(&bc->lock);
+	return true;
+}
+
+static int compare_blocks(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Write back the dirty slots with blocks in [block, end), adjacent blocks with
+ * one write (caller holds bc->lock).
+ *
+ * @return  0 on success; -errno on error.
+ */
+static int flush_slots(bcache *bc, uint64_t block, uint64_t end)
+{
+	uint64_t *dirty = malloc((size_t)bc->count * sizeof(uint64_t) + 1);
+	if (!dirty) {
+		return -ENOMEM;
+	}
+	size_t n = 0;
+	if (end - block < bc->count) {
+		for (uint64_t b = block; b < end; b++) {
+			uint32_t s = find_slot(bc, b);
+			if (s != BCACHE_NONE && (bc->flags[s] & BCACHE_DIRTY)) {
+				dirty[n++] = b;
+			}
+		}
+	} else {
+		for (uint32_t s = 0; s < bc->count; s++) {
+			uint64_t b = bc->blocks[s];
+			if ((bc->flags[s] & BCACHE_DIRTY) && b >= block && b < end) {
+				dirty[n++] = b;
+			}
+		}
+		qsort(dirty, n, sizeof(uint64_t), compare_blocks);
+	}
+
+	int ret = 0;
+	for (size_t i = 0; i < n && ret == 0; ) {
+		size_t j = i + 1;
+		while (j < n && dirty[j] == dirty[j - 1] + 1) {
+			j++;
+		}
+		ret = write_back(bc, dirty[i], j - i);
+		for (; ret == 0 && i < j; i++) {
+			bc->flags[find_slot(bc, dirty[i])] &= ~BCACHE_DIRTY;
+		}
+	}
+	free(dirty);
+	return ret;
+}
+
+int bcache_flush(bcache *bc, uint64_t block, uint64_t count)
+{
+	uint64_t end = block + count < bc->nblocks ? block + count : bc->nblocks;
+	int ret = 0;
+
+	pthread_mutex_lock(&bc->lock);
+	uint64_t pinned_end = end < bc->npinned ? end : bc->npinned;
+	for (uint64_t b = block; ret == 0 && b < pinned_end &&
+	                         (b = bitmap_find_one(bc->pinned_dirty, pinned_end, b)) < pinned_end; ) {
+		uint64_t run_end = bitmap_find_zero(bc->pinned_dirty, pinned_end, b);
+		ret = write_back(bc, b, run_end - b);
+		if (ret == 0) {
+			bitmap_clear_range(bc->pinned_dirty, b, run_end - b);
+		}
+		b = run_end;
+	}
+	uint64_t from = block > bc->npinned ? block : bc->npinned;
+	if (ret == 0 && from < end) {
+		ret = flush_slots(bc, from, end);
+	}
+	pthread_mutex_unlock(&bc->lock);
+	return ret;
+}
+
+int bcache_sync(bcache *bc)
+{
+	return fdatasync(bc->fd) == 0 ? 0 : -errno;
+}
+
+void bcache_close(bcache *bc)
+{
+	uint64_t one = 1;
+	if (write(bc->stop_fd, &one, sizeof(one)) != sizeof(one)) {
+		fail("eventfd");
+	}
+	pthread_join(bc->thread, NULL);
+	pthread_mutex_destroy(&bc->lock);
+	free_cache(bc);
+}
@@ -0,0 +1,147 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Image block cache header file.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** Smallest number of blocks a cache may hold besides the pinned ones. */
+#define BCACHE_MIN_CAPACITY 64
+
+/**
+ * Blocks of an image cached in user space, read and written with O_DIRECT
+ * (where the image file supports it), bypassing the page cache.
+ *
+ * The image is served from a range of anonymous memory the size of the image,
+ * so that the file system reaches it through plain pointers, as it does a file
+ * mapping. The range is registered with userfaultfd(2), and the first access
+ * to a block that is not cached wakes up the cache thread: it reads the block
+ * in, write-protected unless the access was a write. The first write to a
+ * write-protected block marks it dirty and lifts the protection. Writing a
+ * block back protects it again before it is written, so that a write made
+ * meanwhile waits and marks it dirty again.
+ *
+ * Up to capacity blocks are cached, plus the pinned blocks (the metadata),
+ * which stay cached once read in. When the cache is full, the block to evict
+ * is chosen with the CLOCK algorithm and written back first if it is dirty. A
+ * block counts as referenced when it is read in and when it is first written
+ * after a writeback; the cache does not see other accesses.
+ *
+ * Reads and writes of the image file that fail while blocks are read in or
+ * evicted abort the process, as they would raise SIGBUS with a file mapping.
+ * All operations are thread-safe.
+ */
+typedef struct bcache {
+	/** Protects the fields below. */
+	pthread_mutex_t lock;
+	/** Start of the image in memory. */
+	void *image;
+	/** Number of blocks in the image. */
+	uint64_t nblocks;
+	/** Block size (the page size). */
+	size_t block_size;
+	/** Image file. */
+	int fd;
+	/** userfaultfd for the image range. */
+	int uffd;
+	/** Eventfd that tells the cache thread to exit. */
+	int stop_fd;
+	/** Cache thread; serves the faults on the image range. */
+	pthread_t thread;
+	/** Buffer a block is read into before it is placed in the image range. */
+	void *buf;
+
+	/** Blocks [0, npinned) are pinned. */
+	uint64_t npinned;
+	/** Bits of the pinned blocks that are cached. */
+	unsigned char *pinned_in;
+	/** Bits of the pinned blocks that are dirty. */
+	unsigned char *pinned_dirty;
+
+	/** Maximum number of blocks cached, besides the pinned ones. */
+	uint32_t capacity;
+	/** Number of slots in use. */
+	uint32_t count;
+	/** Next slot looked at for eviction. */
+	uint32_t hand;
+	/** Block number held in each slot. */
+	uint64_t *blocks;
+	/** Flags of each slot (BCACHE_*). */
+	unsigned char *flags;
+	/** Next slot in the same hash chain; UINT32_MAX at the end. */
+	uint32_t *next;
+	/** First slot of each hash chain; UINT32_MAX if empty. */
+	uint32_t *heads;
+	/** Number of hash chains minus one (a power of 2 minus one). */
+	uint32_t mask;
+} bcache;
+
+/**
+ * Open an image file or block device and reserve memory for all of it, served
+ * from a cache of up to capacity blocks.
+ *
+ * The image size must be a non-zero multiple of block_size, and block_size
+ * must be the page size. userfaultfd(2) must be allowed for the process: it
+ * runs as root, vm.unprivileged_userfaultfd is 1, or /dev/userfaultfd can be
+ * opened.
+ *
+ * @param bc          cache to initialize.
+ * @param path        image file path.
+ * @param block_size  file system block size.
+ * @param capacity    maximum number of blocks cached, besides the pinned ones;
+ *                    at least BCACHE_MIN_CAPACITY.
+ * @param size        pointer to the variable that will be set to file size.
+ * @return            pointer to the start of the image in memory on success;
+ *                    NULL on failure (the error is printed).
+ */
+void *bcache_open(bcache *bc, const char *path, size_t block_size, uint32_t capacity,
+                  size_t *size);
+
+/**
+ * Pin blocks [0, nblocks) of the image: once read in, they are never evicted.
+ * Blocks already cached stay cached. Must be called at most once.
+ *
+ * @return  true on success; false if out of memory.
+ */
+bool bcache_pin(bcache *bc, uint64_t nblocks);
+
+/**
+ * Write the dirty cached blocks in [block, block + count) to the image file.
+ * Does not wait for them to reach stable storage (see bcache_sync()).
+ *
+ * @return  0 on success; -errno on error (the blocks not written stay dirty).
+ */
+int bcache_flush(bcache *bc, uint64_t block, uint64_t count);
+
+/**
+ * Wait until the blocks written to the image file are on stable storage.
+ *
+ * @return  0 on success; -errno on error.
+ */
+int bcache_sync(bcache *bc);
+
+/**
+ * Stop the cache thread and free the image memory; dirty blocks that were not
+ * written back are lost.
+ */
+void bcache_close(bcache *bc);
@@ -0,0 +1,265 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Bitmap search implementation.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "bitmap.h"
+
+
+/** Load the i-th word of a bitmap so that its first bit is the word's MSB. */
+static inline uint64_t load_word(const unsigned char *bitmap, uint64_t i)
+{
+	uint64_t w;
+	memcpy(&w, bitmap + i * 8, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	return w;
+}
+
+/**
+ * Return the index of the first word in [from, to) that is not equal to skip
+ * (all zeros or all ones); to if there is none.
+ */
+static uint64_t skip_words_scalar(const unsigned char *bitmap, uint64_t from,
+                                  uint64_t to, uint64_t skip)
+{
+	const uint64_t *words = (const uint64_t*)bitmap;
+	while (from < to && words[from] == skip) {
+		from++;
+	}
+	return from;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static uint64_t skip_words_avx2(const unsigned char *bitmap, uint64_t from,
+                                uint64_t to, uint64_t skip)
+{
+	const uint64_t *words = (const uint64_t*)bitmap;
+	__m256i pattern = _mm256_set1_epi64x((long long)skip);
+	// Compare four words at a time until a mismatch is seen
+	while (from + 4 <= to) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(words + from));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(v, pattern)) != -1) {
+			break;
+		}
+		from += 4;
+	}
+	return skip_words_scalar(bitmap, from, to, skip);
+}
+#endif
+
+static uint64_t (*skip_words)(const unsigned char*, uint64_t, uint64_t,
+                              uint64_t) = skip_words_scalar;
+
+void bitmap_init(void)
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		skip_words = skip_words_avx2;
+	}
+#endif
+}
+
+/**
+ * Find the first bit at or after from whose value is the opposite of the bits
+ * in skip (~0 finds a clear bit, 0 finds a set bit).
+ */
+static uint64_t find_bit(const unsigned char *bitmap, uint64_t nbits,
+                         uint64_t from, uint64_t skip)
+{
+	if (from >= nbits) {
+		return nbits;
+	}
+	uint64_t nwords = (nbits + 63) / 64;
+	uint64_t i = from / 64;
+
+	// Bits before from in the first word are masked off
+	uint64_t w = (load_word(bitmap, i) ^ skip) & (~0ULL >> (from % 64));
+	while (w == 0) {
+		i = skip_words(bitmap, i + 1, nwords, skip);
+		if (i == nwords) {
+			return nbits;
+		}
+		w = load_word(bitmap, i) ^ skip;
+	}
+	uint64_t bit = i * 64 + __builtin_clzll(w);
+	return bit < nbits ? bit : nbits;
+}
+
+uint64_t bitmap_find_zero(const unsigned char *bitmap, uint64_t nbits, uint64_t from)
+{
+	return find_bit(bitmap, nbits, from, ~0ULL);
+}
+
+uint64_t bitmap_find_one(const unsigned char *bitmap, uint64_t nbits, uint64_t from)
+{
+	return find_bit(bitmap, nbits, from, 0);
+}
+
+/** Mask of bits [lo, hi) of a bitmap byte (0 <= lo < hi <= 8). */
+static inline unsigned char byte_mask(unsigned int lo, unsigned int hi)
+{
+	return (unsigned char)((0xffu >> lo) & (0xffu << (8 - hi)));
+}
+
+/** Set (value ~0) or clear (value 0) bits [from, from + count). */
+static void fill_range(unsigned char *bitmap, uint64_t from, uint64_t count,
+                       unsigned char value)
+{
+	if (count == 0) {
+		return;
+	}
+	uint64_t end = from + count;
+	uint64_t first = from / 8, last = (end - 1) / 8;
+	// Bytes the range covers only partially are masked; the rest is memset(),
+	// which writes whole words
+	unsigned char head = byte_mask(from % 8, first == last ? (end - 1) % 8 + 1 : 8);
+	bitmap[first] = (bitmap[first] & ~head) | (value & head);
+	if (first == last) {
+		return;
+	}
+	memset(bitmap + first + 1, value, last - first - 1);
+	unsigned char tail = byte_mask(0, (end - 1) % 8 + 1);
+	bitmap[last] = (bitmap[last] & ~tail) | (value & tail);
+}
+
+void bitmap_set_range(unsigned char *bitmap, uint64_t from, uint64_t count)
+{
+	fill_range(bitmap, from, count, 0xff);
+}
+
+void bitmap_clear_range(unsigned char *bitmap, uint64_t from, uint64_t count)
+{
+	fill_range(bitmap, from, count, 0);
+}
+
+/** Whether the i-th word of a bitmap has a clear bit below nbits. */
+static bool word_has_zero(const unsigned char *bitmap, uint64_t nbits, uint64_t i)
+{
+	uint64_t w = load_word(bitmap, i);
+	if ((i + 1) * 64 > nbits) {
+		// Bits past the end of the bitmap count as set
+		w |= ~0ULL >> (nbits % 64);
+	}
+	return w != ~0ULL;
+}
+
+/** Set or clear bit i of an in-memory (LSB-first) bit array. */
+static inline void assign_bit(uint64_t *bits, uint64_t i, bool value)
+{
+	if (value) {
+		bits[i / 64] |= 1ULL << (i % 64);
+	} else {
+		bits[i / 64] &= ~(1ULL << (i % 64));
+	}
+}
+
+bool bitmap_summary_init(bitmap_summary *sum, const unsigned char *bitmap, uint64_t nbits)
+{
+	uint64_t nwords = (nbits + 63) / 64;
+	uint64_t n1 = (nwords + 63) / 64;
+	sum->nbits = nbits;
+	sum->n2 = (n1 + 63) / 64;
+	sum->l1 = calloc(n1, sizeof(uint64_t));
+	sum->l2 = calloc(sum->n2, sizeof(uint64_t));
+	if (!sum->l1 || !sum->l2) {
+		bitmap_summary_destroy(sum);
+		return false;
+	}
+	for (uint64_t i = 0; i < nwords; i++) {
+		assign_bit(sum->l1, i, word_has_zero(bitmap, nbits, i));
+	}
+	for (uint64_t i = 0; i < n1; i++) {
+		assign_bit(sum->l2, i, sum->l1[i] != 0);
+	}
+	return true;
+}
+
+void bitmap_summary_destroy(bitmap_summary *sum)
+{
+	free(sum->l1);
+	free(sum->l2);
+	sum->l1 = NULL;
+	sum->l2 = NULL;
+}
+
+void bitmap_summary_update(bitmap_summary *sum, const unsigned char *bitmap, uint64_t bit)
+{
+	if (!sum->l1) {
+		return;
+	}
+	uint64_t i = bit / 64;
+	assign_bit(sum->l1, i, word_has_zero(bitmap, sum->nbits, i));
+	assign_bit(sum->l2, i / 64, sum->l1[i / 64] != 0);
+}
+
+uint64_t bitmap_summary_find_zero(const bitmap_summary *sum, const unsigned char *bitmap,
+                                  uint64_t from)
+{
+	uint64_t nwords = (sum->nbits + 63) / 64;
+	uint64_t n1 = (nwords + 63) / 64;
+	if (from >= sum->nbits) {
+		return sum->nbits;
+	}
+
+	// The rest of the word holding from
+	uint64_t word = from / 64;
+	uint64_t end = (word + 1) * 64 < sum->nbits ? (word + 1) * 64 : sum->nbits;
+	uint64_t bit = bitmap_find_zero(bitmap, end, from);
+	if (bit < end) {
+		return bit;
+	}
+
+	// The next words summarized by the same level 1 word
+	uint64_t next = word + 1;
+	if (next >= nwords) {
+		return sum->nbits;
+	}
+	uint64_t w1 = sum->l1[next / 64] & (~0ULL << (next % 64));
+	if (w1 != 0) {
+		word = next / 64 * 64 + __builtin_ctzll(w1);
+		return bitmap_find_zero(bitmap, sum->nbits, word * 64);
+	}
+
+	// The next level 1 words
+	uint64_t i1 = next / 64 + 1;
+	if (i1 >= n1) {
+		return sum->nbits;
+	}
+	uint64_t j = i1 / 64;
+	uint64_t w2 = sum->l2[j] & (~0ULL << (i1 % 64));
+	while (w2 == 0) {
+		if (++j >= sum->n2) {
+			return sum->nbits;
+		}
+		w2 = sum->l2[j];
+	}
+	i1 = j * 64 + __builtin_ctzll(w2);
+	word = i1 * 64 + __builtin_ctzll(sum->l1[i1]);
+	return bitmap_find_zero(bitmap, sum->nbits, word * 64);
+}
@@ -0,0 +1,113 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Bitmap search header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/**
+ * Bitmaps are stored MSB-first: bit i is the (7 - i % 8)-th bit of byte i / 8.
+ *
+ * The search functions read the bitmap one 64-bit word at a time, so the
+ * bitmap must start at an 8-byte aligned address and the memory up to the end
+ * of its last word must be readable (true for bitmaps stored in whole blocks).
+ */
+
+/**
+ * Select the fastest implementation supported by the CPU. Optional; the
+ * portable implementation is used until this is called.
+ */
+void bitmap_init(void);
+
+/**
+ * Find the first clear bit at or after from.
+ *
+ * @param bitmap  the bitmap.
+ * @param nbits   number of bits in the bitmap.
+ * @param from    bit number to start the search at.
+ * @return        number of the bit found; nbits if all bits are set.
+ */
+uint64_t bitmap_find_zero(const unsigned char *bitmap, uint64_t nbits, uint64_t from);
+
+/**
+ * Find the first set bit at or after from.
+ *
+ * @param bitmap  the bitmap.
+ * @param nbits   number of bits in the bitmap.
+ * @param from    bit number to start the search at.
+ * @return        number of the bit found; nbits if all bits are clear.
+ */
+uint64_t bitmap_find_one(const unsigned char *bitmap, uint64_t nbits, uint64_t from);
+
+/**
+ * Set bits [from, from + count). Whole bytes in the range are written at once.
+ */
+void bitmap_set_range(unsigned char *bitmap, uint64_t from, uint64_t count);
+
+/**
+ * Clear bits [from, from + count). Whole bytes in the range are written at once.
+ */
+void bitmap_clear_range(unsigned char *bitmap, uint64_t from, uint64_t count);
+
+
+/**
+ * In-memory summary of a bitmap for finding a clear bit in O(1).
+ *
+ * Level 1 holds one bit per 64-bit word of the bitmap, set if the word has a
+ * clear bit; level 2 holds one bit per level 1 word, set if the level 1 word is
+ * not zero. A search reads a few level 2 words and two count-trailing-zeros.
+ * The summary is not thread-safe; callers serialize access with the lock that
+ * protects the bitmap.
+ */
+typedef struct bitmap_summary {
+	/** Level 1 bits; NULL if the summary could not be allocated. */
+	uint64_t *l1;
+	/** Level 2 bits. */
+	uint64_t *l2;
+	/** Number of bits in the bitmap. */
+	uint64_t nbits;
+	/** Number of level 2 words. */
+	uint64_t n2;
+} bitmap_summary;
+
+/**
+ * Build the summary of a bitmap.
+ *
+ * @param sum     summary to initialize.
+ * @param bitmap  the bitmap.
+ * @param nbits   number of bits in the bitmap.
+ * @return        true on success; false if out of memory (sum->l1 is NULL).
+ */
+bool bitmap_summary_init(bitmap_summary *sum, const unsigned char *bitmap, uint64_t nbits);
+
+/** Free the memory held by a summary. */
+void bitmap_summary_destroy(bitmap_summary *sum);
+
+/** Update the summary after bit number bit of the bitmap has changed. */
+void bitmap_summary_update(bitmap_summary *sum, const unsigned char *bitmap, uint64_t bit);
+
+/**
+ * Find the first clear bit of a bitmap at or after from using its summary.
+ *
+ * @return  number of the bit found; nbits if all bits from there on are set.
+ */
+uint64_t bitmap_summary_find_zero(const bitmap_summary *sum, const unsigned char *bitmap,
+                                  uint64_t from);
@@ -0,0 +1,211 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Directory entry cache implementation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcache.h"
+#include "util.h"
+
+
+/** Hash a (parent directory, name) pair. */
+static uint32_t dcache_hash(a1fs_ino_t parent, const char *name)
+{
+	return a1fs_name_hash(name) ^ (parent * 0x9E3779B1u);
+}
+
+bool dcache_init(dcache *dc, size_t capacity)
+{
+	memset(dc, 0, sizeof(*dc));
+	// Keep the load factor of the hash table at or below 1
+	size_t nbuckets = 1;
+	while (nbuckets < capacity) {
+		nbuckets *= 2;
+	}
+	assert(is_powerof2(nbuckets));
+
+	dc->entries = malloc(capacity * sizeof(dcache_entry));
+	dc->buckets = malloc(nbuckets * sizeof(int32_t));
+	if (!dc->entries || !dc->buckets) {
+		dcache_destroy(dc);
+		return false;
+	}
+	memset(dc->buckets, -1, nbuckets * sizeof(int32_t));
+	dc->capacity = capacity;
+	dc->nbuckets = nbuckets;
+	dc->lru_head = dc->lru_tail = -1;
+	dc->free = -1;
+	pthread_mutex_init(&dc->lock, NULL);
+	return true;
+}
+
+void dcache_destroy(dcache *dc)
+{
+	if (dc->entries && dc->buckets) {
+		pthread_mutex_destroy(&dc->lock);
+	}
+	free(dc->entries);
+	free(dc->buckets);
+	dc->entries = NULL;
+	dc->buckets = NULL;
+}
+
+/** Unlink an entry from the LRU list. */
+static void lru_unlink(dcache *dc, int32_t i)
+{
+	dcache_entry *e = &dc->entries[i];
+	if (e->lru_prev >= 0) {
+		dc->entries[e->lru_prev].lru_next = e->lru_next;
+	} else {
+		dc->lru_head = e->lru_next;
+	}
+	if (e->lru_next >= 0) {
+		dc->entries[e->lru_next].lru_prev = e->lru_prev;
+	} else {
+		dc->lru_tail = e->lru_prev;
+	}
+}
+
+/** Make an entry the most recently used one. */
+static void lru_push(dcache *dc, int32_t i)
+{
+	dcache_entry *e = &dc->entries[i];
+	e->lru_prev = -1;
+	e->lru_next = dc->lru_head;
+	if (dc->lru_head >= 0) {
+		dc->entries[dc->lru_head].lru_prev = i;
+	} else {
+		dc->lru_tail = i;
+	}
+	dc->lru_head = i;
+}
+
+/**
+ * Find the entry for a name.
+ *
+ * @param link  if not NULL, receives the pointer to the chain link that
+ *              refers to the entry (for unlinking it).
+ * @return      index of the entry; -1 if not found.
+ */
+static int32_t dcache_find(dcache *dc, a1fs_ino_t parent, const char *name,
+                           uint32_t hash, int32_t **link)
+{
+	int32_t *p = &dc->buckets[hash & (dc->nbuckets - 1)];
+	while (*p >= 0) {
+		dcache_entry *e = &dc->entries[*p];
+		if ((e->hash == hash) && (e->parent == parent) &&
+		    (strcmp(e->name, name) == 0))
+		{
+			if (link) {
+				*link = p;
+			}
+			return *p;
+		}
+		p = &e->next;
+	}
+	return -1;
+}
+
+/** Unlink an entry from its bucket and the LRU list and put it on the free list. */
+static void dcache_drop(dcache *dc, int32_t i, int32_t *link)
+{
+	*link = dc->entries[i].next;
+	lru_unlink(dc, i);
+	dc->entries[i].next = dc->free;
+	dc->free = i;
+}
+
+dcache_result dcache_lookup(dcache *dc, a1fs_ino_t parent, const char *name,
+                            a1fs_ino_t *ino)
+{
+	dcache_result result = DCACHE_MISS;
+	pthread_mutex_lock(&dc->lock);
+	int32_t i = dcache_find(dc, parent, name, dcache_hash(parent, name), NULL);
+	if (i >= 0) {
+		lru_unlink(dc, i);
+		lru_push(dc, i);
+		if (dc->entries[i].ino == DCACHE_NEGATIVE) {
+			result = DCACHE_NEGATIVE_HIT;
+		} else {
+			*ino = dc->entries[i].ino;
+			result = DCACHE_HIT;
+		}
+	}
+	pthread_mutex_unlock(&dc->lock);
+	return result;
+}
+
+void dcache_insert(dcache *dc, a1fs_ino_t parent, const char *name,
+                   a1fs_ino_t ino)
+{
+	if (dc->capacity == 0) {
+		return;
+	}
+	uint32_t hash = dcache_hash(parent, name);
+	pthread_mutex_lock(&dc->lock);
+	int32_t i = dcache_find(dc, parent, name, hash, NULL);
+	if (i >= 0) {
+		dc->entries[i].ino = ino;
+		lru_unlink(dc, i);
+		lru_push(dc, i);
+		pthread_mutex_unlock(&dc->lock);
+		return;
+	}
+
+	// Take a free entry, or evict the least recently used one
+	if (dc->free >= 0) {
+		i = dc->free;
+		dc->free = dc->entries[i].next;
+	} else if (dc->used < dc->capacity) {
+		i = dc->used++;
+	} else {
+		int32_t *link = NULL;
+		dcache_entry *victim = &dc->entries[dc->lru_tail];
+		i = dcache_find(dc, victim->parent, victim->name, victim->hash, &link);
+		assert(i == dc->lru_tail);
+		dcache_drop(dc, i, link);
+		dc->free = dc->entries[i].next;
+	}
+
+	dcache_entry *e = &dc->entries[i];
+	e->parent = parent;
+	e->ino = ino;
+	e->hash = hash;
+	strncpy(e->name, name, A1FS_NAME_MAX - 1);
+	e->name[A1FS_NAME_MAX - 1] = '\0';
+	int32_t *bucket = &dc->buckets[hash & (dc->nbuckets - 1)];
+	e->next = *bucket;
+	*bucket = i;
+	lru_push(dc, i);
+	pthread_mutex_unlock(&dc->lock);
+}
+
+void dcache_remove(dcache *dc, a1fs_ino_t parent, const char *name)
+{
+	if (dc->capacity == 0) {
+		return;
+	}
+	int32_t *link = NULL;
+	pthread_mutex_lock(&dc->lock);
+	int32_t i = dcache_find(dc, parent, name, dcache_hash(parent, name), &link);
+	if (i >= 0) {
+		dcache_drop(dc, i, link);
+	}
+	pthread_mutex_unlock(&dc->lock);
+}
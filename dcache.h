@@ -0,0 +1,123 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Directory entry cache header file.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Default number of entries in the directory entry cache. */
+#define A1FS_DCACHE_ENTRIES 16384
+
+/** Inode number recorded for names that are known not to exist. */
+#define DCACHE_NEGATIVE ((a1fs_ino_t)-1)
+
+/** Result of a directory entry cache lookup. */
+typedef enum dcache_result {
+	/** Nothing is known about the name; the directory must be searched. */
+	DCACHE_MISS,
+	/** The name exists; the inode number is returned. */
+	DCACHE_HIT,
+	/** The name is known not to exist. */
+	DCACHE_NEGATIVE_HIT,
+} dcache_result;
+
+/** Cached (parent directory, name) -> inode mapping. */
+typedef struct dcache_entry {
+	/** Inode number of the parent directory. */
+	a1fs_ino_t parent;
+	/** Inode number of the child, or DCACHE_NEGATIVE. */
+	a1fs_ino_t ino;
+	/** Hash of (parent, name). */
+	uint32_t hash;
+	/** Next entry in the same hash bucket, or -1. */
+	int32_t next;
+	/** Neighbours in the LRU list, or -1. */
+	int32_t lru_prev, lru_next;
+	/** Entry name. A null-terminated string. */
+	char name[A1FS_NAME_MAX];
+} dcache_entry;
+
+/**
+ * Bounded size cache of directory entries, including negative entries.
+ *
+ * Entries live in a fixed array allocated up front; when the cache is full the
+ * least recently used entry is evicted. All operations are thread-safe.
+ */
+typedef struct dcache {
+	/** Protects all the fields below. */
+	pthread_mutex_t lock;
+	/** Entry storage. */
+	dcache_entry *entries;
+	/** Number of entries in the storage array. */
+	size_t capacity;
+	/** Hash buckets holding the index of the first entry in a chain, or -1. */
+	int32_t *buckets;
+	/** Number of buckets (a power of 2). */
+	size_t nbuckets;
+	/** Most and least recently used entries, or -1. */
+	int32_t lru_head, lru_tail;
+	/** Number of entries that have been handed out from the array. */
+	size_t used;
+	/** Chain of entries that were removed and can be reused, or -1. */
+	int32_t free;
+} dcache;
+
+/**
+ * Initialize an empty cache.
+ *
+ * @param dc        cache to initialize.
+ * @param capacity  maximum number of entries.
+ * @return          true on success; false if out of memory.
+ */
+bool dcache_init(dcache *dc, size_t capacity);
+
+/** Free the memory held by the cache. */
+void dcache_destroy(dcache *dc);
+
+/**
+ * Look up a name in a directory.
+ *
+ * @param dc      the cache.
+ * @param parent  inode number of the directory.
+ * @param name    entry name.
+ * @param ino     receives the inode number on DCACHE_HIT.
+ * @return        the lookup result.
+ */
+dcache_result dcache_lookup(dcache *dc, a1fs_ino_t parent, const char *name,
+                            a1fs_ino_t *ino);
+
+/**
+ * Record the result of a directory lookup, replacing any existing entry for
+ * the same name.
+ *
+ * @param dc      the cache.
+ * @param parent  inode number of the directory.
+ * @param name    entry name.
+ * @param ino     inode number of the entry, or DCACHE_NEGATIVE.
+ */
+void dcache_insert(dcache *dc, a1fs_ino_t parent, const char *name,
+                   a1fs_ino_t ino);
+
+/** Forget what is known about a name in a directory. */
+void dcache_remove(dcache *dc, a1fs_ino_t parent, const char *name);
@@ -0,0 +1,93 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Directory block implementation.
+ */
+
+#include <string.h>
+
+#include "dirblock.h"
+
+
+void dirblock_init(void *block)
+{
+	a1fs_dirent *de = block;
+	de->ino = 0;
+	de->rec_len = A1FS_BLOCK_SIZE;
+	de->name_len = 0;
+	de->file_type = 0;
+	de->hash = 0;
+}
+
+a1fs_dirent *dirblock_find(void *block, const char *name, size_t len, uint32_t hash)
+{
+	for (a1fs_dirent *de = block; dirent_in_block(block, de); de = dirent_next(de)) {
+		if (de->hash == hash && de->name_len == len && memcmp(de->name, name, len) == 0) {
+			return de;
+		}
+	}
+	return NULL;
+}
+
+a1fs_dirent *dirblock_add(void *block, const char *name, size_t len, uint32_t hash,
+                          a1fs_ino_t ino, uint8_t file_type)
+{
+	size_t need = A1FS_DIRENT_SIZE(len);
+	for (a1fs_dirent *de = block; dirent_in_block(block, de); de = dirent_next(de)) {
+		size_t used = de->name_len ? A1FS_DIRENT_SIZE(de->name_len) : 0;
+		if (de->rec_len - used < need) {
+			continue;
+		}
+		// split the free space after the name off into a record of its own
+		if (used > 0) {
+			a1fs_dirent *rest = (a1fs_dirent*)((char*)de + used);
+			rest->rec_len = de->rec_len - used;
+			de->rec_len = used;
+			de = rest;
+		}
+		de->ino = ino;
+		de->name_len = len;
+		de->file_type = file_type;
+		de->hash = hash;
+		memcpy(de->name, name, len);
+		de->name[len] = '\0';
+		return de;
+	}
+	return NULL;
+}
+
+bool dirblock_remove(void *block, a1fs_dirent *de)
+{
+	a1fs_dirent *first = block;
+	if (de == first) {
+		de->name_len = 0;
+	} else {
+		a1fs_dirent *prev = first;
+		while (dirent_next(prev) != de) {
+			prev = dirent_next(prev);
+		}
+		prev->rec_len += de->rec_len;
+	}
+	return dirblock_empty(block);
+}
+
+unsigned int dirblock_count(const void *block)
+{
+	unsigned int n = 0;
+	for (const a1fs_dirent *de = block; dirent_in_block(block, de); de = dirent_next(de)) {
+		n += de->name_len != 0;
+	}
+	return n;
+}
@@ -0,0 +1,88 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Directory block header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Get the record that follows a record in its block. */
+static inline a1fs_dirent *dirent_next(const a1fs_dirent *de)
+{
+	return (a1fs_dirent*)((char*)de + de->rec_len);
+}
+
+/** Check whether a record pointer is still inside a directory block. */
+static inline bool dirent_in_block(const void *block, const a1fs_dirent *de)
+{
+	return (const char*)de < (const char*)block + A1FS_BLOCK_SIZE;
+}
+
+/** Turn a directory block into a single unused record. */
+void dirblock_init(void *block);
+
+/**
+ * Find an entry in a directory block.
+ *
+ * @param block  directory block.
+ * @param name   entry name.
+ * @param len    length of the name.
+ * @param hash   name hash; records with a different hash are skipped without
+ *               comparing the names.
+ * @return       the record; NULL if the block has no such entry.
+ */
+a1fs_dirent *dirblock_find(void *block, const char *name, size_t len, uint32_t hash);
+
+/**
+ * Add an entry to a directory block, in the first unused record or free space
+ * after a name that is large enough.
+ *
+ * @param block      directory block.
+ * @param name       entry name.
+ * @param len        length of the name.
+ * @param hash       name hash.
+ * @param ino        inode number.
+ * @param file_type  file type (see a1fs_dirent).
+ * @return           the new record; NULL if the block does not have room.
+ */
+a1fs_dirent *dirblock_add(void *block, const char *name, size_t len, uint32_t hash,
+                          a1fs_ino_t ino, uint8_t file_type);
+
+/**
+ * Remove an entry from a directory block and merge its space into the record
+ * before it.
+ *
+ * @param block  directory block.
+ * @param de     record to remove.
+ * @return       true if the block is now empty.
+ */
+bool dirblock_remove(void *block, a1fs_dirent *de);
+
+/** Check whether a directory block has no entries. */
+static inline bool dirblock_empty(const void *block)
+{
+	const a1fs_dirent *first = block;
+	return first->name_len == 0 && first->rec_len == A1FS_BLOCK_SIZE;
+}
+
+/** Count the used records of a directory block. */
+unsigned int dirblock_count(const void *block);
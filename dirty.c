@@ -0,0 +1,230 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Dirty block tracking and writeback implementation.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "a1fs.h"
+#include "bitmap.h"
+#include "dirty.h"
+
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool dirtymap_init(dirtymap *dm, void *image, uint64_t nblocks, bcache *cache)
+{
+	// the bitmap search functions read whole 64-bit words
+	dm->bits = calloc((nblocks + 63) / 64, sizeof(uint64_t));
+	uint64_t nchunks = (nblocks + A1FS_DIRTY_CHUNK - 1) / A1FS_DIRTY_CHUNK;
+	dm->chunks = calloc((nchunks + 63) / 64, sizeof(uint64_t));
+	if (!dm->bits || !dm->chunks) {
+		free(dm->bits);
+		free(dm->chunks);
+		return false;
+	}
+	dm->image = image;
+	dm->cache = cache;
+	dm->nblocks = nblocks;
+	dm->ndirty = 0;
+	dm->since = 0;
+	dm->started = false;
+	dm->stop = false;
+	dm->max_dirty = UINT64_MAX;
+	pthread_mutex_init(&dm->lock, NULL);
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&dm->wake, &attr);
+	pthread_condattr_destroy(&attr);
+	return true;
+}
+
+void dirtymap_destroy(dirtymap *dm)
+{
+	if (dm->started) {
+		pthread_mutex_lock(&dm->lock);
+		dm->stop = true;
+		pthread_cond_signal(&dm->wake);
+		pthread_mutex_unlock(&dm->lock);
+		pthread_join(dm->thread, NULL);
+		dm->started = false;
+	}
+	pthread_cond_destroy(&dm->wake);
+	pthread_mutex_destroy(&dm->lock);
+	free(dm->bits);
+	free(dm->chunks);
+	dm->bits = NULL;
+	dm->chunks = NULL;
+}
+
+/** Mark the clean blocks in a range dirty (caller holds dm->lock). */
+static void mark_locked(dirtymap *dm, uint64_t block, uint64_t end)
+{
+	uint64_t marked = 0;
+	while ((block = bitmap_find_zero(dm->bits, end, block)) < end) {
+		uint64_t run_end = bitmap_find_one(dm->bits, end, block);
+		bitmap_set_range(dm->bits, block, run_end - block);
+		uint64_t chunk = block / A1FS_DIRTY_CHUNK;
+		bitmap_set_range(dm->chunks, chunk, (run_end - 1) / A1FS_DIRTY_CHUNK - chunk + 1);
+		marked += run_end - block;
+		block = run_end;
+	}
+	if (marked > 0 && dm->ndirty == 0) {
+		dm->since = now_ms();
+	}
+	dm->ndirty += marked;
+}
+
+void dirtymap_mark(dirtymap *dm, uint64_t block, uint64_t count)
+{
+	pthread_mutex_lock(&dm->lock);
+	bool was_below = dm->ndirty < dm->max_dirty;
+	mark_locked(dm, block, block + count);
+	if (dm->started && was_below && dm->ndirty >= dm->max_dirty) {
+		pthread_cond_signal(&dm->wake);
+	}
+	pthread_mutex_unlock(&dm->lock);
+}
+
+/**
+ * Find the first dirty block in [block, end), skipping the chunks whose summary
+ * bit is clear (caller holds dm->lock).
+ *
+ * @return  the block found; end if there is none.
+ */
+static uint64_t next_dirty(dirtymap *dm, uint64_t block, uint64_t end)
+{
+	uint64_t nchunks = (end + A1FS_DIRTY_CHUNK - 1) / A1FS_DIRTY_CHUNK;
+	while (block < end) {
+		uint64_t chunk = bitmap_find_one(dm->chunks, nchunks, block / A1FS_DIRTY_CHUNK);
+		if (chunk == nchunks) {
+			return end;
+		}
+		uint64_t chunk_start = chunk * A1FS_DIRTY_CHUNK;
+		uint64_t chunk_end = chunk_start + A1FS_DIRTY_CHUNK;
+		uint64_t limit = chunk_end < end ? chunk_end : end;
+		block = block > chunk_start ? block : chunk_start;
+		uint64_t found = bitmap_find_one(dm->bits, limit, block);
+		if (found < limit) {
+			return found;
+		}
+		if (block == chunk_start && (limit == chunk_end || limit == dm->nblocks)) {
+			// the whole chunk was looked at
+			bitmap_clear_range(dm->chunks, chunk, 1);
+		}
+		block = chunk_end;
+	}
+	return end;
+}
+
+/**
+ * Write blocks [block, end) of the image back. msync() waits until they are on
+ * stable storage; the block cache only hands them to the image file.
+ *
+ * @return  0 on success; -errno on error.
+ */
+static int write_run(dirtymap *dm, uint64_t block, uint64_t end)
+{
+	if (dm->cache) {
+		return bcache_flush(dm->cache, block, end - block);
+	}
+	return msync((char*)dm->image + block * A1FS_BLOCK_SIZE,
+	             (end - block) * A1FS_BLOCK_SIZE, MS_SYNC) == 0 ? 0 : -errno;
+}
+
+int dirtymap_flush(dirtymap *dm, uint64_t block, uint64_t count)
+{
+	uint64_t end = block + count;
+	int ret = 0;
+	bool written = false;
+	pthread_mutex_lock(&dm->lock);
+	while ((block = next_dirty(dm, block, end)) < end) {
+		uint64_t run_end = bitmap_find_zero(dm->bits, end, block);
+		bitmap_clear_range(dm->bits, block, run_end - block);
+		dm->ndirty -= run_end - block;
+		// writers may mark blocks of this run again while it is being written
+		pthread_mutex_unlock(&dm->lock);
+		int value = write_run(dm, block, run_end);
+		pthread_mutex_lock(&dm->lock);
+		if (value != 0) {
+			ret = value;
+			mark_locked(dm, block, run_end);
+			break;
+		}
+		written = true;
+		block = run_end;
+	}
+	if (dm->ndirty == 0) {
+		dm->since = 0;
+	}
+	pthread_mutex_unlock(&dm->lock);
+
+	// the image file may keep what the cache wrote in the device's write cache
+	if (ret == 0 && written && dm->cache) {
+		ret = bcache_sync(dm->cache);
+	}
+	return ret;
+}
+
+static void *writeback_thread(void *arg)
+{
+	dirtymap *dm = (dirtymap*)arg;
+
+	pthread_mutex_lock(&dm->lock);
+	while (!dm->stop) {
+		uint64_t now = now_ms();
+		uint64_t due = dm->ndirty > 0 ? dm->since + dm->max_age : now + dm->max_age;
+		if (dm->ndirty >= dm->max_dirty || (dm->ndirty > 0 && now >= due)) {
+			pthread_mutex_unlock(&dm->lock);
+			int value = dirtymap_flush(dm, 0, dm->nblocks);
+			pthread_mutex_lock(&dm->lock);
+			if (value == 0) {
+				continue;
+			}
+			// retry a failed writeback later rather than right away
+			due = now + dm->max_age;
+		}
+		struct timespec ts = {
+			.tv_sec = due / 1000,
+			.tv_nsec = (due % 1000) * 1000000,
+		};
+		pthread_cond_timedwait(&dm->wake, &dm->lock, &ts);
+	}
+	pthread_mutex_unlock(&dm->lock);
+	return NULL;
+}
+
+bool dirtymap_start_writeback(dirtymap *dm, uint64_t max_age, uint64_t max_dirty)
+{
+	dm->max_age = max_age;
+	dm->max_dirty = max_dirty > 0 ? max_dirty : 1;
+	if (pthread_create(&dm->thread, NULL, writeback_thread, dm) != 0) {
+		return false;
+	}
+	dm->started = true;
+	return true;
+}
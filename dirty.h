@@ -0,0 +1,115 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Dirty block tracking and writeback header file.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bcache.h"
+
+
+/** Default age in milliseconds after which dirty blocks are written back. */
+#define A1FS_WRITEBACK_MS 5000
+
+/** Default amount of dirty data in KB that starts a writeback. */
+#define A1FS_WRITEBACK_KB (64 * 1024)
+
+/** Number of blocks summarized by one bit of dirtymap.chunks. */
+#define A1FS_DIRTY_CHUNK 4096
+
+/**
+ * Blocks of the mapped image modified since they were last written back.
+ *
+ * Holds one bit per image block. Writers mark the blocks they modify; fsync()
+ * and the writeback thread write back only the runs of marked blocks in the
+ * range they flush instead of the whole image: with msync() if the image file
+ * is mapped, or through the block cache the image is served from. A run is unmarked before it is
+ * flushed, so blocks modified during the flush stay marked for the next one.
+ * A summary with one bit per A1FS_DIRTY_CHUNK blocks lets a flush of a large
+ * image skip the clean parts of the map. All operations are thread-safe.
+ */
+typedef struct dirtymap {
+	/** Protects the fields below. */
+	pthread_mutex_t lock;
+	/** Dirty bits. */
+	unsigned char *bits;
+	/**
+	 * Summary bits: set if a chunk of blocks may have dirty blocks; cleared
+	 * when a flush finds it has none.
+	 */
+	unsigned char *chunks;
+	/** Pointer to the start of the image. */
+	void *image;
+	/** Block cache the image is served from; NULL if the image file is mapped. */
+	bcache *cache;
+	/** Number of blocks in the image. */
+	uint64_t nblocks;
+	/** Number of dirty blocks. */
+	uint64_t ndirty;
+	/** When the oldest dirty block was marked, in ms (CLOCK_MONOTONIC). */
+	uint64_t since;
+
+	/** Writeback thread; runs if started is true. */
+	pthread_t thread;
+	bool started;
+	/** Tells the writeback thread to exit. */
+	bool stop;
+	/** Wakes up the writeback thread. */
+	pthread_cond_t wake;
+	/** Write back when the oldest dirty block is this old (ms). */
+	uint64_t max_age;
+	/** Write back when this many blocks are dirty. */
+	uint64_t max_dirty;
+} dirtymap;
+
+/**
+ * Initialize an empty dirty map.
+ *
+ * @param dm       map to initialize.
+ * @param image    pointer to the start of the image.
+ * @param nblocks  number of blocks in the image.
+ * @param cache    block cache the image is served from; NULL if it is mapped.
+ * @return         true on success; false if out of memory.
+ */
+bool dirtymap_init(dirtymap *dm, void *image, uint64_t nblocks, bcache *cache);
+
+/** Stop the writeback thread and free the memory held by the map. */
+void dirtymap_destroy(dirtymap *dm);
+
+/** Mark blocks [block, block + count) of the image dirty. */
+void dirtymap_mark(dirtymap *dm, uint64_t block, uint64_t count);
+
+/**
+ * Write back the dirty blocks in [block, block + count) and wait until they
+ * are on stable storage.
+ *
+ * @return  0 on success; -errno on error (the blocks not written stay dirty).
+ */
+int dirtymap_flush(dirtymap *dm, uint64_t block, uint64_t count);
+
+/**
+ * Start a thread that writes back all dirty blocks once the oldest of them is
+ * max_age ms old or max_dirty blocks are dirty.
+ *
+ * @return  true on success; false if the thread could not be created.
+ */
+bool dirtymap_start_writeback(dirtymap *dm, uint64_t max_age, uint64_t max_dirty);
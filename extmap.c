@@ -0,0 +1,163 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Extent offset index implementation.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extmap.h"
+
+
+#define EXTMAP_EMPTY UINT64_MAX
+
+bool extmap_init(extmap *em, size_t nslots, bool wide)
+{
+	em->slots = calloc(nslots, sizeof(extmap_slot));
+	if (!em->slots) {
+		return false;
+	}
+	em->nslots = nslots;
+	em->wide = wide;
+	for (size_t i = 0; i < nslots; i++) {
+		pthread_mutex_init(&em->slots[i].lock, NULL);
+		em->slots[i].key = EXTMAP_EMPTY;
+	}
+	return true;
+}
+
+/**
+ * Select the slot of a key. Fibonacci hashing keeps consecutive keys apart, and
+ * also keys with a power of two stride, such as the blocks of tree leaves that
+ * are allocated at regular intervals.
+ */
+static extmap_slot *slot_of(extmap *em, uint64_t key)
+{
+	return &em->slots[(key * 0x9e3779b97f4a7c15ull >> 32) % em->nslots];
+}
+
+void extmap_destroy(extmap *em)
+{
+	for (size_t i = 0; i < em->nslots; i++) {
+		pthread_mutex_destroy(&em->slots[i].lock);
+		free(em->slots[i].first);
+	}
+	free(em->slots);
+	em->slots = NULL;
+	em->nslots = 0;
+}
+
+/**
+ * Recompute the prefix sums of a slot starting from extent from.
+ *
+ * @return  true on success; false if out of memory (the slot is emptied).
+ */
+static bool slot_fill(extmap_slot *slot, const a1fs_extent *extents,
+                      uint32_t count, uint32_t from, bool wide)
+{
+	if (count + 1 > slot->capacity) {
+		uint32_t capacity = slot->capacity ? slot->capacity : 16;
+		while (capacity < count + 1) {
+			capacity *= 2;
+		}
+		uint64_t *first = realloc(slot->first, capacity * sizeof(uint64_t));
+		if (!first) {
+			slot->key = EXTMAP_EMPTY;
+			return false;
+		}
+		slot->first = first;
+		slot->capacity = capacity;
+	}
+
+	if (from == 0) {
+		slot->first[0] = 0;
+	}
+	for (uint32_t i = from; i < count; i++) {
+		slot->first[i + 1] = slot->first[i] + a1fs_extent_len(&extents[i], wide);
+	}
+	slot->count = count;
+	return true;
+}
+
+int extmap_find(extmap *em, uint64_t key, const a1fs_extent *extents,
+                uint32_t count, uint64_t lblk, uint64_t *first)
+{
+	extmap_slot *slot = slot_of(em, key);
+	int index = -1;
+
+	pthread_mutex_lock(&slot->lock);
+	if (slot->key != key) {
+		slot->key = key;
+		if (!slot_fill(slot, extents, count, 0, em->wide)) {
+			goto linear;
+		}
+	}
+	assert(slot->count == count);
+
+	if (lblk < slot->first[count]) {
+		// Last extent whose first block is not past lblk
+		uint32_t lo = 0, hi = count;
+		while (hi - lo > 1) {
+			uint32_t mid = lo + (hi - lo) / 2;
+			if (slot->first[mid] <= lblk) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+		index = lo;
+		*first = slot->first[lo];
+	}
+	pthread_mutex_unlock(&slot->lock);
+	return index;
+
+linear:
+	// Out of memory for the index; fall back to a linear scan
+	pthread_mutex_unlock(&slot->lock);
+	uint64_t start = 0;
+	for (uint32_t i = 0; i < count; start += a1fs_extent_len(&extents[i], em->wide), i++) {
+		if (lblk < start + a1fs_extent_len(&extents[i], em->wide)) {
+			*first = start;
+			return i;
+		}
+	}
+	return -1;
+}
+
+void extmap_update(extmap *em, uint64_t key, const a1fs_extent *extents,
+                   uint32_t count)
+{
+	extmap_slot *slot = slot_of(em, key);
+	pthread_mutex_lock(&slot->lock);
+	if (slot->key == key) {
+		// Only the old last extent and anything after it may have changed
+		uint32_t from = slot->count < count ? slot->count : count;
+		slot_fill(slot, extents, count, from > 0 ? from - 1 : 0, em->wide);
+	}
+	pthread_mutex_unlock(&slot->lock);
+}
+
+void extmap_forget(extmap *em, uint64_t key)
+{
+	extmap_slot *slot = slot_of(em, key);
+	pthread_mutex_lock(&slot->lock);
+	if (slot->key == key) {
+		slot->key = EXTMAP_EMPTY;
+	}
+	pthread_mutex_unlock(&slot->lock);
+}
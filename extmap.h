@@ -0,0 +1,106 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Extent offset index header file.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Default number of extent arrays whose index is cached at the same time. */
+#define A1FS_EXTMAP_SLOTS 1024
+
+/** Cached index of one extent array. */
+typedef struct extmap_slot {
+	/** Protects the fields below. */
+	pthread_mutex_t lock;
+	/** Key of the extent array the index belongs to; UINT64_MAX if the slot is empty. */
+	uint64_t key;
+	/** Number of extents indexed. */
+	uint32_t count;
+	/** Allocated length of the first array. */
+	uint32_t capacity;
+	/**
+	 * Prefix sums of extent lengths: first[i] is the logical block number of
+	 * the first block of extent i; first[count] is the total number of blocks.
+	 */
+	uint64_t *first;
+} extmap_slot;
+
+/**
+ * Extent offset index.
+ *
+ * Maps logical block numbers to extents with a binary search over the prefix
+ * sums of extent lengths. An extent array is identified by a key: the inode
+ * number for the extents of an inode, or a key made by the caller for each
+ * leaf of an extent tree. Indexes are built lazily on first use and live in a
+ * fixed number of slots selected by key; a key that maps to an occupied slot
+ * evicts the previous owner. All operations are thread-safe; callers must
+ * hold the lock of the inode that owns the extents (for reading in
+ * extmap_find(), for writing in extmap_update() and extmap_forget()).
+ */
+typedef struct extmap {
+	/** Slot array. */
+	extmap_slot *slots;
+	/** Number of slots. */
+	size_t nslots;
+	/** Whether the extents are wide (A1FS_FEATURE_64BIT). */
+	bool wide;
+} extmap;
+
+/**
+ * Initialize an empty index.
+ *
+ * @param em      index to initialize.
+ * @param nslots  number of extent arrays that can be indexed at the same time.
+ * @param wide    whether the extents are wide (see a1fs_extent).
+ * @return        true on success; false if out of memory.
+ */
+bool extmap_init(extmap *em, size_t nslots, bool wide);
+
+/** Free the memory held by the index. */
+void extmap_destroy(extmap *em);
+
+/**
+ * Find the extent that holds a logical block of an extent array.
+ *
+ * @param em       the index.
+ * @param key      key of the extent array.
+ * @param extents  the extent array.
+ * @param count    number of extents in the array.
+ * @param lblk     logical block number, relative to the start of the array.
+ * @param first    receives the logical block number of the extent's first block.
+ * @return         index of the extent; -1 if lblk is past the end of the array.
+ */
+int extmap_find(extmap *em, uint64_t key, const a1fs_extent *extents,
+                uint32_t count, uint64_t lblk, uint64_t *first);
+
+/**
+ * Bring a cached index up to date after extents were appended to, removed from,
+ * or resized at the end of the extent array. Only the tail is recomputed.
+ */
+void extmap_update(extmap *em, uint64_t key, const a1fs_extent *extents,
+                   uint32_t count);
+
+/** Drop the index of an extent array (e.g. when the inode is freed). */
+void extmap_forget(extmap *em, uint64_t key);
@@ -0,0 +1,314 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Free space map implementation.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "bitmap.h"
+#include "freemap.h"
+
+
+/** Tree indices. */
+enum { BY_START, BY_LEN, NTREES };
+
+struct freemap_node {
+	/** First free block. */
+	uint64_t start;
+	/** Number of free blocks. */
+	uint64_t count;
+	/** Left and right children in each tree. */
+	freemap_node *child[NTREES][2];
+	/** Height of the subtree in each tree. */
+	int height[NTREES];
+};
+
+static int compare(int t, const freemap_node *a, const freemap_node *b)
+{
+	if (t == BY_LEN && a->count != b->count) {
+		return a->count < b->count ? -1 : 1;
+	}
+	return a->start < b->start ? -1 : a->start > b->start;
+}
+
+static int height(int t, const freemap_node *n)
+{
+	return n ? n->height[t] : 0;
+}
+
+static void update(int t, freemap_node *n)
+{
+	int l = height(t, n->child[t][0]), r = height(t, n->child[t][1]);
+	n->height[t] = (l > r ? l : r) + 1;
+}
+
+/** Rotate the subtree at n so that its child on side dir becomes the root. */
+static freemap_node *rotate(int t, freemap_node *n, int dir)
+{
+	freemap_node *c = n->child[t][dir];
+	n->child[t][dir] = c->child[t][!dir];
+	c->child[t][!dir] = n;
+	update(t, n);
+	update(t, c);
+	return c;
+}
+
+static freemap_node *rebalance(int t, freemap_node *n)
+{
+	update(t, n);
+	int diff = height(t, n->child[t][1]) - height(t, n->child[t][0]);
+	if (diff > 1 || diff < -1) {
+		int dir = diff > 0;
+		freemap_node *c = n->child[t][dir];
+		if (height(t, c->child[t][!dir]) > height(t, c->child[t][dir])) {
+			n->child[t][dir] = rotate(t, c, !dir);
+		}
+		n = rotate(t, n, dir);
+	}
+	return n;
+}
+
+static freemap_node *insert(int t, freemap_node *root, freemap_node *n)
+{
+	if (!root) {
+		n->child[t][0] = n->child[t][1] = NULL;
+		n->height[t] = 1;
+		return n;
+	}
+	int dir = compare(t, n, root) > 0;
+	root->child[t][dir] = insert(t, root->child[t][dir], n);
+	return rebalance(t, root);
+}
+
+/** Detach the leftmost node of a subtree into *min. */
+static freemap_node *remove_min(int t, freemap_node *root, freemap_node **min)
+{
+	if (!root->child[t][0]) {
+		*min = root;
+		return root->child[t][1];
+	}
+	root->child[t][0] = remove_min(t, root->child[t][0], min);
+	return rebalance(t, root);
+}
+
+static freemap_node *erase(int t, freemap_node *root, freemap_node *n)
+{
+	assert(root);
+	int c = compare(t, n, root);
+	if (c != 0) {
+		root->child[t][c > 0] = erase(t, root->child[t][c > 0], n);
+		return rebalance(t, root);
+	}
+	if (!root->child[t][1]) {
+		return root->child[t][0];
+	}
+	freemap_node *min;
+	freemap_node *right = remove_min(t, root->child[t][1], &min);
+	min->child[t][0] = root->child[t][0];
+	min->child[t][1] = right;
+	return rebalance(t, min);
+}
+
+/** Return the free run with the greatest start that is not above block. */
+static freemap_node *floor_start(const freemap *fm, uint64_t block)
+{
+	freemap_node *n = fm->by_start, *best = NULL;
+	while (n) {
+		if (n->start <= block) {
+			best = n;
+			n = n->child[BY_START][1];
+		} else {
+			n = n->child[BY_START][0];
+		}
+	}
+	return best;
+}
+
+static void free_tree(freemap_node *n)
+{
+	if (n) {
+		free_tree(n->child[BY_START][0]);
+		free_tree(n->child[BY_START][1]);
+		free(n);
+	}
+}
+
+void freemap_destroy(freemap *fm)
+{
+	free_tree(fm->by_start);
+	fm->by_start = fm->by_len = NULL;
+	fm->valid = false;
+}
+
+/** Allocate a node for a new free run and insert it into the start tree. */
+static freemap_node *new_run(freemap *fm, uint64_t start, uint64_t count)
+{
+	freemap_node *n = malloc(sizeof(freemap_node));
+	if (!n) {
+		freemap_destroy(fm);
+		return NULL;
+	}
+	n->start = start;
+	n->count = count;
+	fm->by_start = insert(BY_START, fm->by_start, n);
+	return n;
+}
+
+bool freemap_init(freemap *fm, const unsigned char *bitmap, uint64_t nbits)
+{
+	fm->by_start = fm->by_len = NULL;
+	fm->valid = true;
+	uint64_t start = bitmap_find_zero(bitmap, nbits, 0);
+	while (start < nbits) {
+		uint64_t end = bitmap_find_one(bitmap, nbits, start);
+		freemap_node *n = new_run(fm, start, end - start);
+		if (!n) {
+			return false;
+		}
+		fm->by_len = insert(BY_LEN, fm->by_len, n);
+		start = bitmap_find_zero(bitmap, nbits, end);
+	}
+	return true;
+}
+
+bool freemap_scan(freemap *fm, const unsigned char *bitmap, uint64_t from, uint64_t to)
+{
+	uint64_t start = bitmap_find_zero(bitmap, to, from);
+	while (start < to && fm->valid) {
+		uint64_t end = bitmap_find_one(bitmap, to, start);
+		freemap_add(fm, start, end - start);
+		start = bitmap_find_zero(bitmap, to, end);
+	}
+	return fm->valid;
+}
+
+void freemap_add(freemap *fm, uint64_t start, uint64_t count)
+{
+	if (!fm->valid) {
+		return;
+	}
+	// Merge with the run that ends right before the freed blocks, if any
+	freemap_node *n = start > 0 ? floor_start(fm, start - 1) : NULL;
+	if (n && n->start + n->count == start) {
+		fm->by_len = erase(BY_LEN, fm->by_len, n);
+		n->count += count;
+	} else {
+		assert(!n || n->start + n->count < start);
+		n = new_run(fm, start, count);
+		if (!n) {
+			return;
+		}
+	}
+
+	// ... and with the run that starts right after them
+	freemap_node *next = floor_start(fm, start + count);
+	if (next && next->start == start + count) {
+		fm->by_start = erase(BY_START, fm->by_start, next);
+		fm->by_len = erase(BY_LEN, fm->by_len, next);
+		n->count += next->count;
+		free(next);
+	}
+	fm->by_len = insert(BY_LEN, fm->by_len, n);
+}
+
+void freemap_remove(freemap *fm, uint64_t start, uint64_t count)
+{
+	if (!fm->valid) {
+		return;
+	}
+	freemap_node *n = floor_start(fm, start);
+	assert(n && start + count <= n->start + n->count);
+	uint64_t end = n->start + n->count;
+
+	fm->by_len = erase(BY_LEN, fm->by_len, n);
+	if (n->start == start && n->count == count) {
+		fm->by_start = erase(BY_START, fm->by_start, n);
+		free(n);
+		return;
+	}
+	if (n->start == start) {
+		// Still ordered between the same neighbours in the start tree
+		n->start += count;
+		n->count -= count;
+	} else {
+		n->count = start - n->start;
+		if (start + count < end) {
+			freemap_node *tail = new_run(fm, start + count, end - start - count);
+			if (!tail) {
+				return;
+			}
+			fm->by_len = insert(BY_LEN, fm->by_len, tail);
+		}
+	}
+	fm->by_len = insert(BY_LEN, fm->by_len, n);
+}
+
+bool freemap_next(const freemap *fm, uint64_t block, uint64_t *start, uint64_t *count)
+{
+	assert(fm->valid);
+	freemap_node *n = floor_start(fm, block);
+	if (n && n->start + n->count > block) {
+		*start = block;
+		*count = n->start + n->count - block;
+		return true;
+	}
+
+	// The first run that starts after block
+	freemap_node *next = NULL;
+	n = fm->by_start;
+	while (n) {
+		if (n->start > block) {
+			next = n;
+			n = n->child[BY_START][0];
+		} else {
+			n = n->child[BY_START][1];
+		}
+	}
+	if (!next) {
+		return false;
+	}
+	*start = next->start;
+	*count = next->count;
+	return true;
+}
+
+bool freemap_best_fit(const freemap *fm, uint64_t length, uint64_t *start, uint64_t *count)
+{
+	assert(fm->valid);
+	freemap_node *n = fm->by_len, *best = NULL, *longest = NULL;
+	while (n) {
+		longest = n;
+		if (n->count >= length) {
+			best = n;
+			n = n->child[BY_LEN][0];
+		} else {
+			n = n->child[BY_LEN][1];
+		}
+	}
+	if (!best) {
+		// Every run is too short; longest is the rightmost node visited
+		best = longest;
+	}
+	if (!best) {
+		return false;
+	}
+	*start = best->start;
+	*count = best->count < length ? best->count : length;
+	return true;
+}
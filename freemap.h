@@ -0,0 +1,99 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Free space map header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** A run of free blocks; a node of both trees of a free space map. */
+typedef struct freemap_node freemap_node;
+
+/**
+ * In-memory map of the free data blocks.
+ *
+ * Free runs are kept in two balanced (AVL) trees: one ordered by start block,
+ * used to merge runs when blocks are freed, and one ordered by length, used for
+ * best-fit allocation. All operations are O(log n) in the number of free runs.
+ *
+ * The map is not thread-safe; callers serialize access with the lock that
+ * protects the data bitmap. If memory runs out while the map is updated it is
+ * discarded and marked invalid, and callers fall back to scanning the bitmap.
+ */
+typedef struct freemap {
+	/** Root of the tree ordered by start block. */
+	freemap_node *by_start;
+	/** Root of the tree ordered by (length, start block). */
+	freemap_node *by_len;
+	/** Whether the map reflects the bitmap. */
+	bool valid;
+} freemap;
+
+/**
+ * Build the map of a bitmap.
+ *
+ * @param fm      map to initialize.
+ * @param bitmap  MSB-first bitmap of used blocks (see bitmap.h).
+ * @param nbits   number of blocks.
+ * @return        true on success; false if out of memory (the map is invalid).
+ */
+bool freemap_init(freemap *fm, const unsigned char *bitmap, uint64_t nbits);
+
+/**
+ * Add the free runs of bits [from, to) of a bitmap to a map; a run next to one
+ * already in the map is merged with it. Used to build the map piecewise.
+ *
+ * @return  true on success; false if out of memory (the map is invalid).
+ */
+bool freemap_scan(freemap *fm, const unsigned char *bitmap, uint64_t from, uint64_t to);
+
+/** Free the memory held by the map; it becomes invalid. */
+void freemap_destroy(freemap *fm);
+
+/** Record that the given blocks, which were in use, are free. */
+void freemap_add(freemap *fm, uint64_t start, uint64_t count);
+
+/** Record that the given blocks, which were free, are in use. */
+void freemap_remove(freemap *fm, uint64_t start, uint64_t count);
+
+/**
+ * Find the first free block at or after block.
+ *
+ * @param fm     the map.
+ * @param block  block number to start at.
+ * @param start  receives the free block found.
+ * @param count  receives the number of free blocks from there to the end of
+ *               the free run.
+ * @return       true on success; false if no block at or after block is free.
+ */
+bool freemap_next(const freemap *fm, uint64_t block, uint64_t *start, uint64_t *count);
+
+/**
+ * Find free space for length blocks: the shortest free run that is at least
+ * length blocks long (the lowest one if there are several), or, if there is
+ * none, the longest free run. The map is not modified.
+ *
+ * @param fm      the map.
+ * @param length  number of blocks wanted.
+ * @param start   receives the first block of the run.
+ * @param count   receives the number of usable blocks (at most length).
+ * @return        true on success; false if no block is free.
+ */
+bool freemap_best_fit(const freemap *fm, uint64_t length, uint64_t *start, uint64_t *count);
@@ -16,22 +16,291 @@
  * CSC369 Assignment 1 - File system runtime context implementation.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "fs_ctx.h"
 
 
-bool fs_ctx_init(fs_ctx *fs, void *image, size_t size)
+/**
+ * Clear the bitmaps that mkfs.a1fs left uninitialized (see s_uninit); the root
+ * directory is the only inode in use and no data blocks are.
+ */
+static void init_bitmaps(fs_ctx *fs)
+{
+	a1fs_superblock *sb = fs->sb;
+	if (sb->s_uninit & A1FS_UNINIT_BLOCK_BITMAP) {
+		uint64_t count = sb->inode_bitmap - sb->dblock_bitmap;
+		memset((char*)fs->image + (size_t)sb->dblock_bitmap * A1FS_BLOCK_SIZE, 0, count * A1FS_BLOCK_SIZE);
+		dirtymap_mark(&fs->dirty, sb->dblock_bitmap, count);
+	}
+	if (sb->s_uninit & A1FS_UNINIT_INODE_BITMAP) {
+		uint64_t count = sb->inode_table - sb->inode_bitmap;
+		unsigned char *bitmap = (unsigned char*)fs->image + (size_t)sb->inode_bitmap * A1FS_BLOCK_SIZE;
+		memset(bitmap, 0, count * A1FS_BLOCK_SIZE);
+		bitmap[0] = 0x80;
+		dirtymap_mark(&fs->dirty, sb->inode_bitmap, count);
+	}
+	sb->s_uninit &= ~(A1FS_UNINIT_BLOCK_BITMAP | A1FS_UNINIT_INODE_BITMAP);
+	dirtymap_mark(&fs->dirty, 0, 1);
+}
+
+/** Runs of data blocks in use by files, collected by reclaim_blocks(). */
+typedef struct run_list {
+	block_run *runs;
+	size_t count;
+	size_t cap;
+	/** Out of memory. */
+	bool failed;
+} run_list;
+
+static void add_run(run_list *l, uint64_t start, uint64_t count)
+{
+	if (l->count == l->cap) {
+		size_t cap = l->cap ? l->cap * 2 : 1024;
+		block_run *runs = realloc(l->runs, cap * sizeof(block_run));
+		if (runs == NULL) {
+			l->failed = true;
+			return;
+		}
+		l->runs = runs;
+		l->cap = cap;
+	}
+	l->runs[l->count++] = (block_run){ start, count };
+}
+
+static void add_extent_runs(run_list *l, const a1fs_extent *ext, uint32_t n, bool wide)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		if (!a1fs_extent_hole(&ext[i], wide)) {
+			add_run(l, a1fs_extent_start(&ext[i], wide), a1fs_extent_len(&ext[i], wide));
+		}
+	}
+}
+
+/** Add the blocks of an extent tree node, of the nodes below it and of their extents. */
+static void add_node_runs(run_list *l, a1fs_blk_t blk, fs_ctx *fs)
+{
+	add_run(l, blk, 1);
+	if (blk >= fs_data_blocks(fs)) {
+		return;
+	}
+	a1fs_extent_node *node = fs_block(fs, blk);
+	if (node->levels == 0) {
+		add_extent_runs(l, a1fs_extent_leaf(node), node->count, fs_64bit(fs));
+		return;
+	}
+	for (uint32_t i = 0; i < node->count; i++) {
+		add_node_runs(l, a1fs_extent_index(node)[i].block, fs);
+	}
+}
+
+static int compare_runs(const void *a, const void *b)
+{
+	uint64_t x = ((const block_run*)a)->start;
+	uint64_t y = ((const block_run*)b)->start;
+	return (x > y) - (x < y);
+}
+
+/** Clear bitmap bits [start, start + count) and count the blocks as free. */
+static void free_run(fs_ctx *fs, unsigned char *bitmap, uint64_t start, uint64_t count)
+{
+	bitmap_clear_range(bitmap, start, count);
+	dirtymap_mark(&fs->dirty, fs->sb->dblock_bitmap + start / 8 / A1FS_BLOCK_SIZE,
+	              (start + count - 1) / 8 / A1FS_BLOCK_SIZE - start / 8 / A1FS_BLOCK_SIZE + 1);
+	if (fs_64bit(fs)) {
+		fs->sb->s_free_blocks_count64 += count;
+	} else {
+		fs->sb->s_free_blocks_count += count;
+	}
+	if (!fs_has_groups(fs)) {
+		return;
+	}
+	uint64_t per_group = fs->sb->s_blocks_per_group;
+	for (uint64_t b = start; b < start + count; ) {
+		uint64_t next = (b / per_group + 1) * per_group;
+		next = next < start + count ? next : start + count;
+		fs_group(fs, b / per_group)->free_blocks += next - b;
+		b = next;
+	}
+	dirtymap_mark(&fs->dirty, fs->sb->s_group_desc, fs->sb->dblock_bitmap - fs->sb->s_group_desc);
+}
+
+/**
+ * Free the data blocks that are marked used but belong to no file, which the
+ * blocks held for open files (see openfiles) become if the file system is not
+ * unmounted cleanly. The inodes in use are walked for the blocks of their
+ * extents, extent blocks and extent tree nodes, and the bits of all the other
+ * blocks are cleared. Groups that are entirely free are skipped.
+ *
+ * @return  number of blocks freed.
+ */
+static uint64_t reclaim_blocks(fs_ctx *fs)
+{
+	a1fs_superblock *sb = fs->sb;
+	bool wide = fs_64bit(fs);
+	run_list used = {0};
+	unsigned char *ino_bitmap = (unsigned char*)fs->image + (size_t)sb->inode_bitmap * A1FS_BLOCK_SIZE;
+	for (uint64_t ino = bitmap_find_one(ino_bitmap, sb->s_inodes_count, 0); ino < sb->s_inodes_count;
+	     ino = bitmap_find_one(ino_bitmap, sb->s_inodes_count, ino + 1)) {
+		a1fs_inode *inode = fs_inode(fs, ino);
+		if (inode->flags & A1FS_INODE_INLINE) {
+			continue;
+		}
+		if (inode->flags & A1FS_INODE_EXTENT_TREE) {
+			add_node_runs(&used, inode_extent_block(inode, fs), fs);
+			continue;
+		}
+		if (inode->indirect_block != -1) {
+			add_run(&used, inode_extent_block(inode, fs), 1);
+		}
+		add_extent_runs(&used, inode_extents(inode, fs), inode->count_extent, wide);
+	}
+	if (used.failed) {
+		free(used.runs);
+		return 0;
+	}
+	qsort(used.runs, used.count, sizeof(block_run), compare_runs);
+
+	unsigned char *bitmap = (unsigned char*)fs->image + (size_t)sb->dblock_bitmap * A1FS_BLOCK_SIZE;
+	uint64_t total = fs_data_blocks(fs);
+	uint64_t per_group = fs_has_groups(fs) ? sb->s_blocks_per_group : total;
+	uint64_t freed = 0;
+	size_t i = 0;
+	for (uint64_t from = 0; from < total; from += per_group) {
+		uint64_t to = from + per_group < total ? from + per_group : total;
+		if (fs_has_groups(fs) && fs_group(fs, from / per_group)->free_blocks == to - from) {
+			continue;
+		}
+		// the runs of set bits, minus the runs in use
+		uint64_t b = bitmap_find_one(bitmap, to, from);
+		while (b < to) {
+			while (i < used.count && used.runs[i].start + used.runs[i].count <= b) {
+				i++;
+			}
+			if (i < used.count && used.runs[i].start <= b) {
+				b = bitmap_find_one(bitmap, to, used.runs[i].start + used.runs[i].count);
+				continue;
+			}
+			uint64_t end = bitmap_find_zero(bitmap, to, b);
+			if (i < used.count && used.runs[i].start < end) {
+				end = used.runs[i].start;
+			}
+			free_run(fs, bitmap, b, end - b);
+			freed += end - b;
+			b = bitmap_find_one(bitmap, to, end);
+		}
+	}
+	free(used.runs);
+	if (freed > 0) {
+		dirtymap_mark(&fs->dirty, 0, 1);
+	}
+	return freed;
+}
+
+/**
+ * Build the free space map. With block groups, the groups that are entirely
+ * free are added without reading their part of the bitmap, so that mounting a
+ * large, mostly empty file system does not read the whole bitmap.
+ */
+static void init_freemap(fs_ctx *fs)
+{
+	unsigned char *bitmap = (unsigned char*)fs->image + (size_t)fs->sb->dblock_bitmap * A1FS_BLOCK_SIZE;
+	uint64_t total = fs_data_blocks(fs);
+	if (!fs_has_groups(fs)) {
+		freemap_init(&fs->freemap, bitmap, total);
+		return;
+	}
+	freemap_init(&fs->freemap, bitmap, 0);
+	uint64_t per_group = fs->sb->s_blocks_per_group;
+	for (uint32_t g = 0; g < fs->sb->s_groups_count && fs->freemap.valid; g++) {
+		uint64_t from = (uint64_t)g * per_group;
+		uint64_t to = from + per_group < total ? from + per_group : total;
+		if (fs_group(fs, g)->free_blocks == to - from) {
+			freemap_add(&fs->freemap, from, to - from);
+		} else {
+			freemap_scan(&fs->freemap, bitmap, from, to);
+		}
+	}
+}
+
+bool fs_ctx_init(fs_ctx *fs, void *image, size_t size, bcache *cache)
 {
 	fs->image = image;
 	fs->size = size;
+	fs->cache = cache;
 
 	//TODO: check if the file system image is valid and can be mounted,
 	//      and initialize its runtime state
 	fs->sb = (struct a1fs_superblock*)(image);
-	return true;
+	fs->inode_size = fs->sb->s_features & A1FS_FEATURE_INLINE_DATA ?
+	                 fs->sb->s_inode_size : sizeof(a1fs_inode);
+	// the superblock, group descriptors, bitmaps and inode table
+	if (cache && !bcache_pin(cache, fs->sb->s_first_data_block)) {
+		return false;
+	}
+
+	fs->n_inode_locks = fs->sb->s_inodes_count < A1FS_INODE_LOCKS ?
+	                    fs->sb->s_inodes_count : A1FS_INODE_LOCKS;
+	fs->inode_locks = malloc(fs->n_inode_locks * sizeof(pthread_rwlock_t));
+	if (!fs->inode_locks) {
+		return false;
+	}
+	for (size_t i = 0; i < fs->n_inode_locks; i++) {
+		pthread_rwlock_init(&fs->inode_locks[i], NULL);
+	}
+	pthread_mutex_init(&fs->ino_bitmap_lock, NULL);
+	pthread_mutex_init(&fs->dblock_bitmap_lock, NULL);
+	if (!dirtymap_init(&fs->dirty, image, size / A1FS_BLOCK_SIZE, cache)) {
+		return false;
+	}
+	if (fs->sb->s_uninit & (A1FS_UNINIT_BLOCK_BITMAP | A1FS_UNINIT_INODE_BITMAP)) {
+		init_bitmaps(fs);
+	}
+	bitmap_init();
+	if (fs->sb->s_state & A1FS_STATE_MOUNTED) {
+		uint64_t freed = reclaim_blocks(fs);
+		if (freed > 0) {
+			fprintf(stderr, "The file system was not unmounted cleanly; freed %llu unused blocks\n",
+			        (unsigned long long)freed);
+		}
+	}
+	// written back right away: from now on blocks may be held for open files
+	fs->sb->s_state |= A1FS_STATE_MOUNTED;
+	dirtymap_mark(&fs->dirty, 0, 1);
+	if (dirtymap_flush(&fs->dirty, 0, 1) != 0) {
+		return false;
+	}
+	// inode allocation falls back to scanning the bitmap without a summary
+	bitmap_summary_init(&fs->ino_summary, image + (size_t)fs->sb->inode_bitmap * A1FS_BLOCK_SIZE,
+	                    fs->sb->s_inodes_count);
+	// allocation falls back to scanning the bitmap if this runs out of memory
+	init_freemap(fs);
+
+	if (!dcache_init(&fs->dcache, A1FS_DCACHE_ENTRIES)) {
+		return false;
+	}
+	if (!ramap_init(&fs->readahead, A1FS_RA_SLOTS)) {
+		return false;
+	}
+	openfiles_init(&fs->open_files);
+	return extmap_init(&fs->extmap, A1FS_EXTMAP_SLOTS, fs_64bit(fs));
 }
 
 void fs_ctx_destroy(fs_ctx *fs)
 {
-	//TODO: cleanup any resources allocated in fs_ctx_init()
-	(void)fs;
+	dirtymap_destroy(&fs->dirty);
+	dcache_destroy(&fs->dcache);
+	extmap_destroy(&fs->extmap);
+	ramap_destroy(&fs->readahead);
+	openfiles_destroy(&fs->open_files);
+	for (size_t i = 0; i < fs->n_inode_locks; i++) {
+		pthread_rwlock_destroy(&fs->inode_locks[i]);
+	}
+	free(fs->inode_locks);
+	pthread_mutex_destroy(&fs->ino_bitmap_lock);
+	pthread_mutex_destroy(&fs->dblock_bitmap_lock);
+	freemap_destroy(&fs->freemap);
+	bitmap_summary_destroy(&fs->ino_summary);
 }
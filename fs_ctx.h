@@ -18,9 +18,19 @@
 
 #pragma once
 
+#include <pthread.h>
 #include <stddef.h>
 
+#include "a1fs.h"
+#include "bcache.h"
+#include "bitmap.h"
+#include "dcache.h"
+#include "dirty.h"
+#include "extmap.h"
+#include "freemap.h"
+#include "openfiles.h"
 #include "options.h"
+#include "readahead.h"
 
 
 /**
@@ -31,21 +41,68 @@ typedef struct fs_ctx {
 	void *image;
 	/** Image size in bytes. */
 	size_t size;
+	/** Block cache the image is served from; NULL if the image file is mapped. */
+	bcache *cache;
+	/**
+	 * Image file, read-only; file data is spliced from it to FUSE. -1 if the
+	 * image is served from a block cache, which may hold newer data.
+	 */
+	int fd;
+	/** Leave full blocks of zeros written to holes as holes. */
+	bool detect_zeroes;
+	/** Size of an inode (and its inline data area) in bytes. */
+	size_t inode_size;
 
 	//TODO: useful runtime state of the mounted file system should be cached
 	// here (NOT in global variables in a1fs.c)
 	struct a1fs_superblock *sb;
+	/** Cache of (directory, name) -> inode lookups. */
+	dcache dcache;
+	/** Index of logical block offsets into each file's extents. */
+	extmap extmap;
+	/** Sequential read streams, read ahead in the image mapping. */
+	ramap readahead;
+	/** Files with open handles and the blocks held for them. */
+	openfiles open_files;
+
+	/**
+	 * Inode reader/writer locks. Images with more than A1FS_INODE_LOCKS inodes
+	 * share each lock between the inodes with the same number modulo
+	 * n_inode_locks. Lock order: a directory before its entries; two unrelated
+	 * inodes in increasing lock index order (see inode_wrlock_pair()); inode
+	 * locks before the bitmap locks.
+	 */
+	pthread_rwlock_t *inode_locks;
+	/** Number of inode locks. */
+	size_t n_inode_locks;
+	/** Protects the inode bitmap and its summary. */
+	pthread_mutex_t ino_bitmap_lock;
+	/** Summary of the inode bitmap for finding a free inode. */
+	bitmap_summary ino_summary;
+	/** Protects the data block bitmap and the free space map. */
+	pthread_mutex_t dblock_bitmap_lock;
+	/** Free runs of data blocks, kept in sync with the data block bitmap. */
+	freemap freemap;
+	/** Blocks of the image modified since they were last written back. */
+	dirtymap dirty;
 } fs_ctx;
 
+/** Maximum number of inode locks. */
+#define A1FS_INODE_LOCKS 4096
+
+/** Allocation goal meaning "no preferred block". */
+#define A1FS_NO_GOAL UINT64_MAX
+
 /**
  * Initialize file system context.
  *
  * @param fs     pointer to the context to initialize.
  * @param image  pointer to the start of the image.
  * @param size   image size in bytes.
+ * @param cache  block cache the image is served from; NULL if it is mapped.
  * @return       true on success; false on failure (e.g. invalid superblock).
  */
-bool fs_ctx_init(fs_ctx *fs, void *image, size_t size);
+bool fs_ctx_init(fs_ctx *fs, void *image, size_t size, bcache *cache);
 
 /**
  * Destroy file system context.
@@ -53,3 +110,177 @@ bool fs_ctx_init(fs_ctx *fs, void *image, size_t size);
  * Must cleanup all the resources created in fs_ctx_init().
  */
 void fs_ctx_destroy(fs_ctx *fs);
+
+/** Whether block numbers are 64 bits long (wide extents). */
+static inline bool fs_64bit(fs_ctx *fs)
+{
+	return (fs->sb->s_features & A1FS_FEATURE_64BIT) != 0;
+}
+
+/** Number of data blocks. */
+static inline uint64_t fs_data_blocks(fs_ctx *fs)
+{
+	return fs_64bit(fs) ? fs->sb->s_data_blocks_count64 : fs->sb->data_block_count;
+}
+
+/** Maximum size of a file in bytes. */
+static inline uint64_t fs_max_file_size(fs_ctx *fs)
+{
+	return a1fs_max_file_blocks(fs_64bit(fs)) * A1FS_BLOCK_SIZE;
+}
+
+/** Number of free data blocks. */
+static inline uint64_t fs_free_blocks(fs_ctx *fs)
+{
+	// statfs() reads the free counts without taking the bitmap locks
+	return fs_64bit(fs) ? __atomic_load_n(&fs->sb->s_free_blocks_count64, __ATOMIC_RELAXED) :
+	                      __atomic_load_n(&fs->sb->s_free_blocks_count, __ATOMIC_RELAXED);
+}
+
+/** Get a pointer to data block blk (numbered from the start of the data region). */
+static inline void *fs_block(fs_ctx *fs, a1fs_blk_t blk)
+{
+	return (char*)fs->image +
+	       (size_t)(fs->sb->s_first_data_block + blk) * A1FS_BLOCK_SIZE;
+}
+
+/** Get a pointer to inode number ino in the inode table. */
+static inline a1fs_inode *fs_inode(fs_ctx *fs, a1fs_ino_t ino)
+{
+	return (a1fs_inode*)((char*)fs->image +
+	                     (size_t)fs->sb->inode_table * A1FS_BLOCK_SIZE +
+	                     (size_t)ino * fs->inode_size);
+}
+
+/** Number of bytes of file data an inode can hold inline; 0 if none. */
+static inline size_t fs_inline_size(fs_ctx *fs)
+{
+	return fs->inode_size - sizeof(a1fs_inode);
+}
+
+/** Get the inline data area of an inode (see A1FS_INODE_INLINE). */
+static inline void *inode_inline(a1fs_inode *inode)
+{
+	return inode + 1;
+}
+
+/** Number of extents that fit in an inode (see a1fs_inode.extents). */
+static inline uint32_t fs_inode_extents(fs_ctx *fs)
+{
+	return (fs->inode_size - offsetof(a1fs_inode, extents)) / sizeof(a1fs_extent);
+}
+
+/** Block number of the extent block of an inode; indirect_block must not be -1. */
+static inline a1fs_blk_t inode_extent_block(a1fs_inode *inode, fs_ctx *fs)
+{
+	a1fs_blk_t hi = fs_64bit(fs) ? inode->flags >> A1FS_INODE_BLOCK_HI_SHIFT : 0;
+	return hi << 31 | (uint32_t)inode->indirect_block;
+}
+
+/** Set the extent block of an inode; blk is -1 if it has none. */
+static inline void inode_set_extent_block(a1fs_inode *inode, a1fs_blk_t blk, fs_ctx *fs)
+{
+	if (fs_64bit(fs)) {
+		inode->flags &= ~(UINT32_MAX << A1FS_INODE_BLOCK_HI_SHIFT);
+		if (blk != (a1fs_blk_t)-1) {
+			inode->flags |= (uint32_t)(blk >> 31) << A1FS_INODE_BLOCK_HI_SHIFT;
+			blk &= INT32_MAX;
+		}
+	}
+	inode->indirect_block = (int32_t)blk;
+}
+
+/** Get the extent array of an inode: in the inode or in its extent block. */
+static inline a1fs_extent *inode_extents(a1fs_inode *inode, fs_ctx *fs)
+{
+	return inode->indirect_block == -1 ? inode->extents : fs_block(fs, inode_extent_block(inode, fs));
+}
+
+/** Number of extents the current extent array of an inode can hold. */
+static inline uint32_t inode_max_extents(a1fs_inode *inode, fs_ctx *fs)
+{
+	return inode->indirect_block == -1 ? fs_inode_extents(fs) : A1FS_BLOCK_SIZE / sizeof(a1fs_extent);
+}
+
+/** Mark the blocks of the image that hold bytes [p, p + len) dirty. */
+static inline void fs_mark_dirty(fs_ctx *fs, const void *p, size_t len)
+{
+	size_t off = (const char*)p - (const char*)fs->image;
+	uint64_t first = off / A1FS_BLOCK_SIZE;
+	dirtymap_mark(&fs->dirty, first, (off + len - 1) / A1FS_BLOCK_SIZE - first + 1);
+}
+
+/** Mark data blocks [blk, blk + count) dirty. */
+static inline void fs_mark_blocks_dirty(fs_ctx *fs, a1fs_blk_t blk, uint64_t count)
+{
+	dirtymap_mark(&fs->dirty, fs->sb->s_first_data_block + (uint64_t)blk, count);
+}
+
+/** Whether the file system is divided into block groups. */
+static inline bool fs_has_groups(fs_ctx *fs)
+{
+	return (fs->sb->s_features & A1FS_FEATURE_GROUPS) != 0;
+}
+
+/** Whether directories hold variable length entries (a1fs_dirent). */
+static inline bool fs_compact_dirs(fs_ctx *fs)
+{
+	return (fs->sb->s_features & A1FS_FEATURE_COMPACT_DIRS) != 0;
+}
+
+/** Get the descriptor of block group g. */
+static inline a1fs_group_desc *fs_group(fs_ctx *fs, uint32_t g)
+{
+	return (a1fs_group_desc*)((char*)fs->image +
+	                          (size_t)fs->sb->s_group_desc * A1FS_BLOCK_SIZE) + g;
+}
+
+/** Get the reader/writer lock that protects inode number ino. */
+static inline pthread_rwlock_t *fs_inode_lock(fs_ctx *fs, a1fs_ino_t ino)
+{
+	return &fs->inode_locks[ino % fs->n_inode_locks];
+}
+
+static inline void inode_rdlock(fs_ctx *fs, a1fs_ino_t ino)
+{
+	pthread_rwlock_rdlock(fs_inode_lock(fs, ino));
+}
+
+static inline void inode_wrlock(fs_ctx *fs, a1fs_ino_t ino)
+{
+	pthread_rwlock_wrlock(fs_inode_lock(fs, ino));
+}
+
+static inline void inode_unlock(fs_ctx *fs, a1fs_ino_t ino)
+{
+	pthread_rwlock_unlock(fs_inode_lock(fs, ino));
+}
+
+/**
+ * Lock two inodes for writing, in lock order. The inodes may share a lock.
+ */
+static inline void inode_wrlock_pair(fs_ctx *fs, a1fs_ino_t a, a1fs_ino_t b)
+{
+	pthread_rwlock_t *la = fs_inode_lock(fs, a);
+	pthread_rwlock_t *lb = fs_inode_lock(fs, b);
+	if (la == lb) {
+		pthread_rwlock_wrlock(la);
+	} else if (la < lb) {
+		pthread_rwlock_wrlock(la);
+		pthread_rwlock_wrlock(lb);
+	} else {
+		pthread_rwlock_wrlock(lb);
+		pthread_rwlock_wrlock(la);
+	}
+}
+
+/** Unlock two inodes locked with inode_wrlock_pair(). */
+static inline void inode_unlock_pair(fs_ctx *fs, a1fs_ino_t a, a1fs_ino_t b)
+{
+	pthread_rwlock_t *la = fs_inode_lock(fs, a);
+	pthread_rwlock_t *lb = fs_inode_lock(fs, b);
+	pthread_rwlock_unlock(la);
+	if (la != lb) {
+		pthread_rwlock_unlock(lb);
+	}
+}
@@ -16,8 +16,15 @@
  * CSC369 Assignment 1 - File mapping helper implementation.
  */
 
+// fallocate()
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -26,6 +33,60 @@
 #include "util.h"
 
 
+bool image_size(int fd, size_t block_size, size_t *size)
+{
+	struct stat s;
+	if (fstat(fd, &s) < 0) {
+		perror("fstat");
+		return false;
+	}
+
+	uint64_t bytes = s.st_size;
+	if (S_ISBLK(s.st_mode)) {
+		// st_size is 0 for devices; a partial last block is left unused
+		if (ioctl(fd, BLKGETSIZE64, &bytes) < 0) {
+			perror("BLKGETSIZE64");
+			return false;
+		}
+		bytes -= bytes % block_size;
+	}
+
+	// Check that the file size is valid
+	if (bytes == 0) {
+		fprintf(stderr, "Image file is empty\n");
+		return false;
+	}
+	if (bytes % block_size != 0) {
+		fprintf(stderr, "Image file size is not a multiple of block size\n");
+		return false;
+	}
+	*size = bytes;
+	return true;
+}
+
+/**
+ * Reserve size bytes of address space at a HUGE_PAGE_SIZE boundary, to be
+ * mapped over with MAP_FIXED.
+ *
+ * @return  start of the range; NULL on failure.
+ */
+static void *reserve_aligned(size_t size)
+{
+	size_t span = size + HUGE_PAGE_SIZE;
+	char *addr = mmap(NULL, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+	// give back the slack on both sides of the aligned range
+	char *start = (char*)align_up((size_t)addr, HUGE_PAGE_SIZE);
+	if (start > addr) {
+		munmap(addr, start - addr);
+	}
+	munmap(start + size, addr + span - (start + size));
+	return start;
+}
+
 void *map_file(const char *path, size_t block_size, size_t *size)
 {
 	// Open the file for reading and writing
@@ -36,32 +97,24 @@ void *map_file(const char *path, size_t block_size, size_t *size)
 	}
 
 	void *addr = NULL;
-	// Get file size
-	struct stat s;
-	if (fstat(fd, &s) < 0) {
-		perror("fstat");
+	size_t bytes;
+	if (!image_size(fd, block_size, &bytes)) {
 		goto end;
 	}
 
-	// Check that the file size is valid
-	if (s.st_size == 0) {
-		fprintf(stderr, "Image file is empty\n");
-		goto end;
-	}
-	if (s.st_size % block_size != 0) {
-		fprintf(stderr, "Image file size is not a multiple of block size\n");
+	// Map file contents into memory
+	addr = reserve_aligned(bytes);
+	if (!addr) {
 		goto end;
 	}
-
-	// Map file contents into memory
-	addr = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (addr == MAP_FAILED) {
+	if (mmap(addr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
 		perror("mmap");
+		munmap(addr, bytes);
 		addr = NULL;
 		goto end;
 	}
 	assert(is_aligned((size_t)addr, block_size));
-	*size = s.st_size;
+	*size = bytes;
 
 end:
 	//NOTE: memory mapping keeps a reference to the open file; can safely close
@@ -69,3 +122,16 @@ end:
 	close(fd);
 	return addr;
 }
+
+bool zero_range(const char *path, size_t offset, size_t len)
+{
+	int fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		perror(path);
+		return false;
+	}
+	bool zeroed = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0 ||
+	              fallocate(fd, FALLOC_FL_ZERO_RANGE, offset, len) == 0;
+	close(fd);
+	return zeroed;
+}
@@ -18,13 +18,26 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 
 
+/**
+ * Get the size of an open image file or block device and check that it is a
+ * valid image size: a non-zero multiple of block_size. The size of a block
+ * device is rounded down to a multiple of block_size.
+ *
+ * @return  true on success; false on failure (the error is printed).
+ */
+bool image_size(int fd, size_t block_size, size_t *size);
+
 /**
  * Map the whole file into memory for reading and writing.
  *
- * File size must be a non-zero multiple of the block_size.
+ * File size must be a non-zero multiple of the block_size. The file may be a
+ * block device; its size is then taken from the device and rounded down to a
+ * multiple of block_size. The mapping starts at a HUGE_PAGE_SIZE boundary, so
+ * huge-page-aligned ranges of the file can be mapped with huge pages.
  *
  * @param path        image file path.
  * @param block_size  file system block size.
@@ -33,3 +46,16 @@
  *                    NULL on failure.
  */
 void *map_file(const char *path, size_t block_size, size_t *size);
+
+/**
+ * Zero a range of an image file or block device without writing it. The range
+ * is deallocated (a hole in a file, discarded on a device) where that is
+ * guaranteed to read back as zeros, or else converted to zeros by the file
+ * system or device.
+ *
+ * @param path    image file or block device path.
+ * @param offset  start of the range in bytes.
+ * @param len     length of the range in bytes.
+ * @return        true on success; false if neither is supported.
+ */
+bool zero_range(const char *path, size_t offset, size_t len);
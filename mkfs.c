@@ -16,6 +16,7 @@
  * CSC369 Assignment 1 - a1fs formatting tool.
  */
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,6 +28,7 @@
 
 #include "a1fs.h"
 #include "map.h"
+#include "util.h"
 
 
 /** Command line options. */
@@ -42,6 +44,18 @@ typedef struct mkfs_opts {
 	bool force;
 	/** Zero out image contents. */
 	bool zero;
+	/** Use hashed indexes for large directories. */
+	bool dir_index;
+	/** Store directory entries in variable length records. */
+	bool compact_dirs;
+	/** Data blocks per block group; 0 for no block groups. */
+	size_t blocks_per_group;
+	/** Inode size in bytes; 0 for sizeof(a1fs_inode). */
+	size_t inode_size;
+	/** Start the data region at a huge page boundary. */
+	bool align;
+	/** Use 64-bit block numbers. */
+	bool wide;
 
 } mkfs_opts;
 
@@ -55,7 +69,20 @@ Options:\n\
     -i num  number of inodes; required argument\n\
     -h      print help and exit\n\
     -f      force format - overwrite existing a1fs file system\n\
-    -z      zero out image contents\n\
+    -z      zero out image contents (by punching them out of the file or\n\
+            discarding them on a device where possible)\n\
+    -d      use hashed indexes for large directories\n\
+    -c      store directory entries in records sized to their names rather\n\
+            than in fixed 256 byte slots\n\
+    -g num  divide the image into block groups of num data blocks (a multiple\n\
+            of 64); files are placed near their directory\n\
+    -I size inode size in bytes (a power of 2, default 64); files that fit\n\
+            in the space after the inode fields are stored in the inode\n\
+    -a      start the data region at a 2 MB boundary of the image, so that\n\
+            it can be mapped with huge pages (leaves up to 2 MB unused)\n\
+    -b      use 64-bit block numbers; required if the image has 2^32 or more\n\
+            data blocks (16 TB), limits extents to 2^23 blocks (32 GB); with\n\
+            -g, mounting reads only the bitmap of the groups in use\n\
 ";
 
 static void print_help(FILE *f, const char *progname)
@@ -67,13 +94,33 @@ static void print_help(FILE *f, const char *progname)
 static bool parse_args(int argc, char *argv[], mkfs_opts *opts)
 {
 	char o;
-	while ((o = getopt(argc, argv, "i:hfvz")) != -1) {
+	while ((o = getopt(argc, argv, "i:hfvzdcg:I:ab")) != -1) {
 		switch (o) {
 			case 'i': opts->n_inodes = strtoul(optarg, NULL, 10); break;
 
 			case 'h': opts->help  = true; return true;// skip other arguments
 			case 'f': opts->force = true; break;
 			case 'z': opts->zero  = true; break;
+			case 'd': opts->dir_index = true; break;
+			case 'c': opts->compact_dirs = true; break;
+			case 'a': opts->align = true; break;
+			case 'b': opts->wide = true; break;
+			case 'g':
+				opts->blocks_per_group = strtoul(optarg, NULL, 10);
+				if (opts->blocks_per_group == 0 || opts->blocks_per_group % 64 != 0 ||
+				    opts->blocks_per_group > UINT32_MAX) {
+					fprintf(stderr, "Invalid number of blocks per group\n");
+					return false;
+				}
+				break;
+			case 'I':
+				opts->inode_size = strtoul(optarg, NULL, 10);
+				if (opts->inode_size < sizeof(a1fs_inode) || opts->inode_size > A1FS_BLOCK_SIZE ||
+				    (opts->inode_size & (opts->inode_size - 1)) != 0) {
+					fprintf(stderr, "Invalid inode size\n");
+					return false;
+				}
+				break;
 
 			case '?': return false;
 			default : assert(false);
@@ -86,7 +133,7 @@ static bool parse_args(int argc, char *argv[], mkfs_opts *opts)
 	}
 	opts->img_path = argv[optind];
 
-	if (!opts->n_inodes) {
+	if (!opts->n_inodes || opts->n_inodes > UINT32_MAX) {
 		fprintf(stderr, "Missing or invalid number of inodes\n");
 		return false;
 	}
@@ -106,6 +153,51 @@ static bool a1fs_is_present(void *image)
 }
 
 
+/** A slice of the image for one thread to zero. */
+typedef struct zero_job {
+	char *start;
+	size_t len;
+} zero_job;
+
+static void *zero_worker(void *arg)
+{
+	zero_job *job = arg;
+	memset(job->start, 0, job->len);
+	return NULL;
+}
+
+/** Maximum number of threads that zero the image. */
+#define MKFS_ZERO_THREADS 64
+
+/**
+ * Zero out the whole image. Without writing it if the file or device allows;
+ * otherwise the mapping is cleared by one thread per CPU.
+ */
+static void zero_image(void *image, size_t size, const char *path)
+{
+	if (zero_range(path, 0, size)) {
+		return;
+	}
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t nthreads = ncpu < 1 ? 1 : ncpu > MKFS_ZERO_THREADS ? MKFS_ZERO_THREADS : (size_t)ncpu;
+	size_t slice = (size / nthreads + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE * A1FS_BLOCK_SIZE;
+	pthread_t threads[MKFS_ZERO_THREADS];
+	zero_job jobs[MKFS_ZERO_THREADS];
+	size_t started = 0;
+	for (size_t off = 0; off < size; off += slice, started++) {
+		jobs[started].start = (char*)image + off;
+		jobs[started].len = size - off < slice ? size - off : slice;
+		if (pthread_create(&threads[started], NULL, zero_worker, &jobs[started]) != 0) {
+			// clear the rest here
+			memset(jobs[started].start, 0, size - off);
+			break;
+		}
+	}
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
 /**
  * Format the image into a1fs.
  *
@@ -125,60 +217,148 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 	(void)size;
 	(void)opts;
 	//total number of blocks
-	unsigned int total_block = size/A1FS_BLOCK_SIZE;
+	uint64_t total_block = size/A1FS_BLOCK_SIZE;
 	//total number of inodes
-	unsigned int total_inodes = opts->n_inodes;
+	uint64_t total_inodes = opts->n_inodes;
+	//size of an inode, including the inline data area
+	uint64_t inode_size = opts->inode_size ? opts->inode_size : sizeof(a1fs_inode);
 	//number of inodes per block
-	unsigned int inodes_per_block = A1FS_BLOCK_SIZE/sizeof(a1fs_inode);
+	uint64_t inodes_per_block = A1FS_BLOCK_SIZE/inode_size;
 	//bits per block
-	unsigned int bits_per_block = A1FS_BLOCK_SIZE*8;
+	uint64_t bits_per_block = A1FS_BLOCK_SIZE*8;
 
 	//number of blocks needed for inode bitmap
-	unsigned int num_ino_bitmap = (total_inodes)/(bits_per_block) + (((total_inodes) % (bits_per_block)) != 0);
+	uint64_t num_ino_bitmap = (total_inodes)/(bits_per_block) + (((total_inodes) % (bits_per_block)) != 0);
 	//number of blocks needed for inode tables
-	unsigned int num_ino_table = (total_inodes)/(inodes_per_block) + (((total_inodes) % inodes_per_block) != 0);
+	uint64_t num_ino_table = (total_inodes)/(inodes_per_block) + (((total_inodes) % inodes_per_block) != 0);
+	//number of blocks needed for the group descriptor table (enough for the
+	//groups of the whole image, the data region is a bit smaller)
+	uint64_t num_group_desc = 0;
+	if (opts->blocks_per_group) {
+		uint64_t max_groups = (total_block + opts->blocks_per_group - 1) / opts->blocks_per_group;
+		num_group_desc = (max_groups * sizeof(a1fs_group_desc) + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+	}
+	if (1 + num_group_desc + num_ino_bitmap + num_ino_table >= total_block) {
+		fprintf(stderr, "Image is too small\n");
+		return false;
+	}
 	//number of blocks left after allocating the inode bitmap, super block, and inode bitmap.
-	unsigned int num_block_left = total_block - 1 - num_ino_bitmap - num_ino_table;
+	uint64_t num_block_left = total_block - 1 - num_group_desc - num_ino_bitmap - num_ino_table;
 	//number of blocks needed for data block bitmap
-	int num_dblock_bitmap = num_block_left / (1 + bits_per_block);
+	uint64_t num_dblock_bitmap = num_block_left / (1 + bits_per_block);
 	//get ceiling
 	num_dblock_bitmap += num_block_left % (1 + bits_per_block) > 1;
+	//number of unused blocks between the inode table and the data region; the
+	//bitmap was sized for the data region without them, so it is big enough
+	uint64_t num_pad = 0;
+	if (opts->align) {
+		uint64_t blocks_per_page = HUGE_PAGE_SIZE / A1FS_BLOCK_SIZE;
+		uint64_t meta = 1 + num_group_desc + num_dblock_bitmap + num_ino_bitmap + num_ino_table;
+		num_pad = (blocks_per_page - meta % blocks_per_page) % blocks_per_page;
+		if (num_pad >= num_block_left - num_dblock_bitmap) {
+			fprintf(stderr, "Image is too small to align the data region\n");
+			return false;
+		}
+	}
 	//number of blocks needed for data block
-	unsigned int num_dblock = num_block_left - num_dblock_bitmap;
+	uint64_t num_dblock = num_block_left - num_dblock_bitmap - num_pad;
 	//number of free inodes count, used 1 for root directory
-	unsigned int free_inodes_count = (total_inodes) - 1;
-	unsigned int free_blocks_count = total_block - (1 + num_ino_bitmap + num_dblock_bitmap + num_ino_table);
+	uint64_t free_inodes_count = (total_inodes) - 1;
+	uint64_t free_blocks_count = num_dblock;
+
+	// metadata blocks are numbered in 32 bits, and so are data blocks unless
+	// they are wide, where the last 40-bit block number marks holes
+	size_t meta_blocks = 1 + num_group_desc + num_dblock_bitmap + num_ino_bitmap + num_ino_table + num_pad;
+	if (meta_blocks > UINT32_MAX || num_dblock > (opts->wide ? A1FS_EXTENT_HOLE_64 : UINT32_MAX)) {
+		fprintf(stderr, opts->wide ? "Image is too large\n" :
+		                "Image is too large for 32-bit block numbers; use -b\n");
+		return false;
+	}
+
+	// everything between the superblock and the data region must read as
+	// zeros; if the image cannot be zeroed without writing it, the bitmaps are
+	// cleared at the first mount and inodes when they are allocated
+	uint32_t uninit = 0;
+	if (!opts->zero && !zero_range(opts->img_path, A1FS_BLOCK_SIZE, (meta_blocks - 1) * A1FS_BLOCK_SIZE)) {
+		uninit = A1FS_UNINIT_BLOCK_BITMAP | A1FS_UNINIT_INODE_BITMAP | A1FS_UNINIT_INODE_TABLE;
+	}
 
 	struct a1fs_superblock *sb = (struct a1fs_superblock*)(image);
 	sb->magic = A1FS_MAGIC;
 	sb->size = size;
-	sb->dblock_bitmap = 1;
-	sb->inode_bitmap = 1 + num_dblock_bitmap;
-	sb->inode_table = 1 + num_dblock_bitmap + num_ino_bitmap;
-	sb->s_first_data_block = 1 + num_dblock_bitmap + num_ino_bitmap + num_ino_table;
+	sb->s_group_desc = num_group_desc ? 1 : 0;
+	sb->dblock_bitmap = 1 + num_group_desc;
+	sb->inode_bitmap = sb->dblock_bitmap + num_dblock_bitmap;
+	sb->inode_table = sb->inode_bitmap + num_ino_bitmap;
+	sb->s_first_data_block = sb->inode_table + num_ino_table + num_pad;
 	sb->s_block_size = A1FS_BLOCK_SIZE;
 	sb->s_inodes_count = total_inodes;
-	sb->data_block_count = num_dblock;
-	sb->s_free_blocks_count = free_blocks_count;
+	sb->data_block_count = opts->wide ? 0 : num_dblock;
+	sb->s_free_blocks_count = opts->wide ? 0 : free_blocks_count;
+	sb->s_data_blocks_count64 = opts->wide ? num_dblock : 0;
+	sb->s_free_blocks_count64 = opts->wide ? free_blocks_count : 0;
 	sb->s_free_inodes_count = free_inodes_count;
+	sb->s_features = opts->dir_index ? A1FS_FEATURE_DIR_INDEX : 0;
+	sb->s_inode_size = inode_size;
+	if (inode_size > sizeof(a1fs_inode)) {
+		sb->s_features |= A1FS_FEATURE_INLINE_DATA;
+	}
+	if (opts->compact_dirs) {
+		sb->s_features |= A1FS_FEATURE_COMPACT_DIRS;
+	}
+	if (opts->wide) {
+		sb->s_features |= A1FS_FEATURE_64BIT;
+	}
+	sb->s_uninit = uninit;
+	sb->s_state = 0;
+	sb->s_groups_count = 0;
+	sb->s_blocks_per_group = 0;
+	sb->s_inodes_per_group = 0;
+
+	// split data blocks and inodes into groups; the root directory is in group 0
+	if (opts->blocks_per_group) {
+		uint64_t groups = (num_dblock + opts->blocks_per_group - 1) / opts->blocks_per_group;
+		uint64_t inodes_per_group = (total_inodes + groups - 1) / groups;
+		if (groups > UINT32_MAX) {
+			fprintf(stderr, "Too many block groups\n");
+			return false;
+		}
+		sb->s_features |= A1FS_FEATURE_GROUPS;
+		sb->s_groups_count = groups;
+		sb->s_blocks_per_group = opts->blocks_per_group;
+		sb->s_inodes_per_group = inodes_per_group;
+
+		a1fs_group_desc *gd = image + (size_t)sb->s_group_desc * A1FS_BLOCK_SIZE;
+		memset(gd, 0, num_group_desc * A1FS_BLOCK_SIZE);
+		for (uint64_t g = 0; g < groups; g++) {
+			uint64_t first_block = g * opts->blocks_per_group;
+			uint64_t first_inode = g * inodes_per_group;
+			gd[g].free_blocks = num_dblock - first_block < opts->blocks_per_group ?
+			                    num_dblock - first_block : opts->blocks_per_group;
+			gd[g].free_inodes = first_inode >= total_inodes ? 0 :
+			                    total_inodes - first_inode < inodes_per_group ?
+			                    total_inodes - first_inode : inodes_per_group;
+		}
+		gd[0].free_inodes--;
+		gd[0].used_dirs = 1;
+	}
 
 	// initialize root directory
-	unsigned char *dblock_bitmap_arr = image + sb->dblock_bitmap * A1FS_BLOCK_SIZE;
-	unsigned char *inode_bitmap_arr = image + sb->inode_bitmap * A1FS_BLOCK_SIZE;
-	memset(dblock_bitmap_arr, 0, num_dblock_bitmap * A1FS_BLOCK_SIZE);
-	memset(inode_bitmap_arr, 0, num_ino_bitmap * A1FS_BLOCK_SIZE);
+	unsigned char *inode_bitmap_arr = image + (size_t)sb->inode_bitmap * A1FS_BLOCK_SIZE;
 
 	// initialize the first index of inode bitmap array to be 1000 0000
 	inode_bitmap_arr[0] = 1 << 7;
 
 	struct a1fs_inode *inode_root;
-	inode_root = (struct a1fs_inode*)(image + A1FS_BLOCK_SIZE * sb->inode_table);
+	inode_root = (struct a1fs_inode*)(image + (size_t)sb->inode_table * A1FS_BLOCK_SIZE);
+	memset(inode_root, 0, inode_size);
 	inode_root->mode = S_IFDIR | 0777;
 	inode_root->links = 2;
 	inode_root->size = 0;
 	clock_gettime(CLOCK_REALTIME, &(inode_root->mtime));
 	inode_root->inode_num = 0;
 	inode_root->count_extent = 0;
+	inode_root->flags = 0;
 	// set the pointer to block to -1 if it is invalid (empty)
 	inode_root->indirect_block = -1;
 	return true;
@@ -214,7 +394,7 @@ int main(int argc, char *argv[])
 	}
 
 	if (opts.zero) {
-		memset(image, 0, size);
+		zero_image(image, size, opts.img_path);
 	}
 	if (!mkfs(image, size, &opts)) {
 		fprintf(stderr, "Failed to format the image\n");
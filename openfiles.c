@@ -0,0 +1,128 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Open file table implementation.
+ */
+
+#include <stdlib.h>
+
+#include "openfiles.h"
+
+
+void openfiles_init(openfiles *of)
+{
+	pthread_mutex_init(&of->lock, NULL);
+	of->files = NULL;
+	of->nfiles = 0;
+	of->cap = 0;
+}
+
+void openfiles_destroy(openfiles *of)
+{
+	for (size_t i = 0; i < of->nfiles; i++) {
+		free(of->files[i].held);
+	}
+	free(of->files);
+	of->files = NULL;
+	of->nfiles = 0;
+	of->cap = 0;
+	pthread_mutex_destroy(&of->lock);
+}
+
+/** Find the entry of a file (caller holds of->lock); NULL if it is not open. */
+static open_file *find_file(openfiles *of, a1fs_ino_t ino)
+{
+	for (size_t i = 0; i < of->nfiles; i++) {
+		if (of->files[i].ino == ino) {
+			return &of->files[i];
+		}
+	}
+	return NULL;
+}
+
+bool openfiles_open(openfiles *of, a1fs_ino_t ino)
+{
+	bool ok = true;
+	pthread_mutex_lock(&of->lock);
+	open_file *f = find_file(of, ino);
+	if (f == NULL) {
+		if (of->nfiles == of->cap) {
+			size_t cap = of->cap ? of->cap * 2 : 16;
+			open_file *files = realloc(of->files, cap * sizeof(open_file));
+			if (files == NULL) {
+				ok = false;
+				goto end;
+			}
+			of->files = files;
+			of->cap = cap;
+		}
+		f = &of->files[of->nfiles++];
+		*f = (open_file){ .ino = ino };
+	}
+	f->handles++;
+
+end:
+	pthread_mutex_unlock(&of->lock);
+	return ok;
+}
+
+size_t openfiles_release(openfiles *of, a1fs_ino_t ino, block_run **held)
+{
+	size_t n = 0;
+	*held = NULL;
+	pthread_mutex_lock(&of->lock);
+	open_file *f = find_file(of, ino);
+	if (f != NULL && --f->handles == 0) {
+		*held = f->held;
+		n = f->nheld;
+		// the last entry takes the place of the removed one
+		*f = of->files[--of->nfiles];
+	}
+	pthread_mutex_unlock(&of->lock);
+	return n;
+}
+
+bool openfiles_hold(openfiles *of, a1fs_ino_t ino, uint64_t start, uint64_t count)
+{
+	bool held = false;
+	pthread_mutex_lock(&of->lock);
+	open_file *f = find_file(of, ino);
+	if (f == NULL) {
+		goto end;
+	}
+	// blocks are cut off the end of a file, so runs often continue the last one
+	if (f->nheld > 0 && f->held[f->nheld - 1].start == start + count) {
+		f->held[f->nheld - 1].start = start;
+		f->held[f->nheld - 1].count += count;
+		held = true;
+		goto end;
+	}
+	if (f->nheld == f->held_cap) {
+		size_t cap = f->held_cap ? f->held_cap * 2 : 8;
+		block_run *runs = realloc(f->held, cap * sizeof(block_run));
+		if (runs == NULL) {
+			goto end;
+		}
+		f->held = runs;
+		f->held_cap = cap;
+	}
+	f->held[f->nheld++] = (block_run){ start, count };
+	held = true;
+
+end:
+	pthread_mutex_unlock(&of->lock);
+	return held;
+}
@@ -0,0 +1,108 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Open file table header file.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** A run of data blocks. */
+typedef struct block_run {
+	/** First block. */
+	uint64_t start;
+	/** Number of blocks. */
+	uint64_t count;
+} block_run;
+
+/** An open file. */
+typedef struct open_file {
+	/** Inode number. */
+	a1fs_ino_t ino;
+	/** Number of open handles. */
+	uint32_t handles;
+	/** Data blocks cut off the file while it was open, not freed yet. */
+	block_run *held;
+	/** Number of runs in held. */
+	size_t nheld;
+	/** Allocated length of held. */
+	size_t held_cap;
+} open_file;
+
+/**
+ * Table of the files that have open handles.
+ *
+ * File reads hand out ranges of the image file that libfuse reads only after
+ * the read returns (see a1fs_read_buf()), but always before the handle the
+ * read came through is released. The blocks a file loses while it is open are
+ * therefore held here instead of being freed, and are only given back to the
+ * caller to free once the last handle of the file is released; they cannot be
+ * allocated to another file while a reply may still be read from them. Held
+ * blocks stay marked used in the bitmap; if the file system is not unmounted
+ * cleanly they are left belonging to no file, and the next mount frees them
+ * (see A1FS_STATE_MOUNTED). The table is expected to be small and is searched
+ * linearly. All operations are thread-safe.
+ */
+typedef struct openfiles {
+	/** Protects the fields below. */
+	pthread_mutex_t lock;
+	/** Open files. */
+	open_file *files;
+	/** Number of open files. */
+	size_t nfiles;
+	/** Allocated length of files. */
+	size_t cap;
+} openfiles;
+
+/** Initialize an empty table. */
+void openfiles_init(openfiles *of);
+
+/** Free the memory held by the table (any held blocks are forgotten). */
+void openfiles_destroy(openfiles *of);
+
+/**
+ * Record a new handle of a file.
+ *
+ * @return  true on success; false if out of memory.
+ */
+bool openfiles_open(openfiles *of, a1fs_ino_t ino);
+
+/**
+ * Drop a handle of a file.
+ *
+ * @param of    the table.
+ * @param ino   inode number of the file.
+ * @param held  receives the blocks held for the file if this was its last
+ *              handle (the caller frees them and the array with free()); NULL
+ *              otherwise.
+ * @return      number of runs in *held.
+ */
+size_t openfiles_release(openfiles *of, a1fs_ino_t ino, block_run **held);
+
+/**
+ * Hold blocks that a file loses until its last handle is released.
+ *
+ * @return  true if the blocks are held; false if the file is not open (or the
+ *          table is out of memory), in which case the caller frees them now.
+ */
+bool openfiles_hold(openfiles *of, a1fs_ino_t ino, uint64_t start, uint64_t count);
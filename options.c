@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "dirty.h"
 #include "options.h"
 
 
@@ -27,10 +28,19 @@
 // See fuse_opt.h in libfuse source code for details.
 
 #define A1FS_OPT(t, p) { t, offsetof(a1fs_opts, p), 1 }
+#define A1FS_OPT_VAL(t, p) { t, offsetof(a1fs_opts, p), 0 }
 
 static const struct fuse_opt opt_spec[] = {
 	A1FS_OPT("-h"    , help),
 	A1FS_OPT("--help", help),
+	A1FS_OPT_VAL("max_read=%u" , max_read),
+	A1FS_OPT_VAL("max_write=%u", max_write),
+	A1FS_OPT("detect_zeroes", detect_zeroes),
+	A1FS_OPT("pin_meta", pin_meta),
+	A1FS_OPT("hugepages", hugepages),
+	A1FS_OPT_VAL("writeback_ms=%u", writeback_ms),
+	A1FS_OPT_VAL("writeback_kb=%u", writeback_kb),
+	A1FS_OPT_VAL("cache_mb=%u", cache_mb),
 	FUSE_OPT_END
 };
 
@@ -38,12 +48,29 @@ static const char *help_str = "\
 Usage: %s image mountpoint [options]\n\
 \n\
 Mount a1fs image file under mount point directory. Use fusermount(1) to \n\
-unmount. Only single-threaded mount is supported; -s FUSE option is implied.\n\
+unmount. Requests are served by multiple threads unless the -s FUSE option\n\
+is given.\n\
 \n\
 general options:\n\
     -o opt,[opt...]        mount options\n\
     -h   --help            print help\n\
 \n\
+a1fs options:\n\
+    -o max_read=N          maximum size of read requests (default: %u)\n\
+    -o max_write=N         maximum size of write requests (default: %u)\n\
+    -o detect_zeroes       keep full blocks of zeros written to holes sparse\n\
+    -o pin_meta            fault in and lock the superblock, bitmaps and inode\n\
+                           table into memory at mount\n\
+    -o hugepages           map the data region with huge pages where possible\n\
+                           (see mkfs.a1fs -a)\n\
+    -o writeback_ms=N      write back dirty data older than N ms (default: %u)\n\
+    -o writeback_kb=N      write back once N KB are dirty (default: %u)\n\
+    -o cache_mb=N          serve the image from a cache of N MB (at least 1)\n\
+                           of data blocks in user space, read and written\n\
+                           with O_DIRECT, instead of mapping it; metadata is\n\
+                           cached besides and never evicted (pin_meta and\n\
+                           hugepages do not apply); needs userfaultfd(2)\n\
+\n\
 ";
 
 // Callback for fuse_opt_parse()
@@ -68,7 +95,9 @@ bool a1fs_opt_parse(struct fuse_args *args, a1fs_opts *opts)
 
 	//NOTE: printing to stderr to keep it consistent with FUSE
 	if (opts->help) {
-		fprintf(stderr, help_str, args->argv[0]);
+		fprintf(stderr, help_str, args->argv[0],
+		        A1FS_DEFAULT_MAX_IO, A1FS_DEFAULT_MAX_IO,
+		        A1FS_WRITEBACK_MS, A1FS_WRITEBACK_KB);
 		fuse_opt_add_arg(args, "-ho");
 	}
 	if (!opts->help && !opts->img_path) {
@@ -76,13 +105,27 @@ bool a1fs_opt_parse(struct fuse_args *args, a1fs_opts *opts)
 		return false;
 	}
 
-	// Only single-threaded mount is supported
-	fuse_opt_add_arg(args, "-s");
-	// Limit the size of reads and writes to 4K
-	fuse_opt_add_arg(args, "-o");
-	fuse_opt_add_arg(args, "max_read=4096");
+	// Reads and writes may span any number of blocks; let the kernel send
+	// large requests instead of splitting them into pages
+	if (!opts->max_read) {
+		opts->max_read = A1FS_DEFAULT_MAX_IO;
+	}
+	if (!opts->max_write) {
+		opts->max_write = A1FS_DEFAULT_MAX_IO;
+	}
+	if (!opts->writeback_ms) {
+		opts->writeback_ms = A1FS_WRITEBACK_MS;
+	}
+	if (!opts->writeback_kb) {
+		opts->writeback_kb = A1FS_WRITEBACK_KB;
+	}
+	// File data moves between the image and the kernel through pipes rather
+	// than through the FUSE buffers where the kernel supports it
+	char opt[96];
+	snprintf(opt, sizeof(opt), "big_writes,splice_read,splice_write,max_read=%u,max_write=%u",
+	         opts->max_read, opts->max_write);
 	fuse_opt_add_arg(args, "-o");
-	fuse_opt_add_arg(args, "max_write=4096");
+	fuse_opt_add_arg(args, opt);
 
 	return true;
 }
@@ -23,12 +23,31 @@
 #include <fuse_opt.h>
 
 
+/** Default limit on the size of read and write requests. */
+#define A1FS_DEFAULT_MAX_IO (128 * 1024)
+
 /** a1fs command line options. */
 typedef struct a1fs_opts {
 	/** a1fs image file path. */
 	const char *img_path;
 	/** Print help and exit. FUSE option. */
 	int help;
+	/** Maximum size of a read request in bytes. */
+	unsigned int max_read;
+	/** Maximum size of a write request in bytes. */
+	unsigned int max_write;
+	/** Do not store full blocks of zeros written to holes. */
+	int detect_zeroes;
+	/** Fault in and lock the metadata blocks into memory at mount. */
+	int pin_meta;
+	/** Ask for transparent huge pages for the data region. */
+	int hugepages;
+	/** Write back dirty blocks once the oldest is this many ms old. */
+	unsigned int writeback_ms;
+	/** Write back dirty blocks once this many KB are dirty. */
+	unsigned int writeback_kb;
+	/** Serve the image from a block cache of this many MB; 0 to map it. */
+	unsigned int cache_mb;
 
 } a1fs_opts;
 
@@ -0,0 +1,90 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+
+/**
+ * CSC369 Assignment 1 - Sequential read detection implementation.
+ */
+
+#include <stdlib.h>
+
+#include "readahead.h"
+
+
+#define RAMAP_EMPTY ((a1fs_ino_t)-1)
+
+bool ramap_init(ramap *ra, size_t nslots)
+{
+	ra->slots = calloc(nslots, sizeof(ramap_slot));
+	if (!ra->slots) {
+		return false;
+	}
+	ra->nslots = nslots;
+	for (size_t i = 0; i < nslots; i++) {
+		pthread_mutex_init(&ra->slots[i].lock, NULL);
+		ra->slots[i].ino = RAMAP_EMPTY;
+	}
+	return true;
+}
+
+void ramap_destroy(ramap *ra)
+{
+	for (size_t i = 0; i < ra->nslots; i++) {
+		pthread_mutex_destroy(&ra->slots[i].lock);
+	}
+	free(ra->slots);
+	ra->slots = NULL;
+	ra->nslots = 0;
+}
+
+void ramap_access(ramap *ra, a1fs_ino_t ino, uint64_t offset, size_t size,
+                  uint64_t ahead[2], uint64_t behind[2])
+{
+	ramap_slot *slot = &ra->slots[ino % ra->nslots];
+	uint64_t end = offset + size;
+	ahead[0] = ahead[1] = 0;
+	behind[0] = behind[1] = 0;
+
+	pthread_mutex_lock(&slot->lock);
+	if (slot->ino != ino || offset != slot->next) {
+		// a new stream starts here
+		slot->ino = ino;
+		slot->run = 0;
+		slot->window = A1FS_RA_INIT;
+		slot->ahead = end;
+		slot->behind = offset;
+	} else if (slot->run < A1FS_RA_MIN_RUN) {
+		slot->run++;
+	}
+	slot->next = end;
+
+	// start the next window once the reader is within half a window of the
+	// end of the current one, so that it never waits for the disk
+	if (slot->run >= A1FS_RA_MIN_RUN && end + slot->window / 2 >= slot->ahead) {
+		ahead[0] = slot->ahead > end ? slot->ahead : end;
+		ahead[1] = ahead[0] + slot->window;
+		slot->ahead = ahead[1];
+		if (slot->window < A1FS_RA_MAX) {
+			slot->window *= 2;
+		}
+	}
+	// keep one window behind the reader for short backward seeks
+	if (slot->run >= A1FS_RA_MIN_RUN && offset >= slot->behind + 2 * slot->window) {
+		behind[0] = slot->behind;
+		behind[1] = offset - slot->window;
+		slot->behind = behind[1];
+	}
+	pthread_mutex_unlock(&slot->lock);
+}
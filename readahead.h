@@ -0,0 +1,104 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+
+/**
+ * CSC369 Assignment 1 - Sequential read detection header file.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Default number of files whose read pattern is tracked at the same time. */
+#define A1FS_RA_SLOTS 256
+
+/** Number of reads continuing a stream before it is read ahead. */
+#define A1FS_RA_MIN_RUN 2
+
+/** First readahead window in bytes; doubled on each window up to the maximum. */
+#define A1FS_RA_INIT (128 * 1024)
+
+/** Largest readahead window in bytes. */
+#define A1FS_RA_MAX (16 * 1024 * 1024)
+
+/** Read pattern of one file. */
+typedef struct ramap_slot {
+	/** Protects the fields below. */
+	pthread_mutex_t lock;
+	/** Inode number the slot belongs to; (a1fs_ino_t)-1 if the slot is empty. */
+	a1fs_ino_t ino;
+	/** Offset right after the last read; a read there continues the stream. */
+	uint64_t next;
+	/** Number of reads in a row that continued the stream. */
+	uint32_t run;
+	/** Size of the next readahead window in bytes. */
+	uint64_t window;
+	/** End of the range already read ahead. */
+	uint64_t ahead;
+	/** End of the range behind the reader already released. */
+	uint64_t behind;
+} ramap_slot;
+
+/**
+ * Per-file sequential read detection.
+ *
+ * Tracks the last read of each file and the length of the current run of
+ * reads that each start where the previous one ended. Once a run is long
+ * enough, reads are answered with a range to read ahead that starts at the
+ * end of the previous one and grows geometrically, and with a range behind the
+ * reader that a one-pass scan will not read again. Files map to a fixed number
+ * of slots selected by inode number; a file that maps to an occupied slot
+ * evicts the previous owner. All operations are thread-safe.
+ */
+typedef struct ramap {
+	/** Slot array. */
+	ramap_slot *slots;
+	/** Number of slots. */
+	size_t nslots;
+} ramap;
+
+/**
+ * Initialize an empty map.
+ *
+ * @param ra      map to initialize.
+ * @param nslots  number of files that can be tracked at the same time.
+ * @return        true on success; false if out of memory.
+ */
+bool ramap_init(ramap *ra, size_t nslots);
+
+/** Free the memory held by the map. */
+void ramap_destroy(ramap *ra);
+
+/**
+ * Record a read of bytes [offset, offset + size) of a file.
+ *
+ * @param ra      the map.
+ * @param ino     inode number of the file.
+ * @param offset  first byte read.
+ * @param size    number of bytes read.
+ * @param ahead   receives the byte range to read ahead: [ahead[0], ahead[1]);
+ *                empty if nothing needs to be read ahead.
+ * @param behind  receives the byte range behind the reader to release:
+ *                [behind[0], behind[1]); empty if there is none.
+ */
+void ramap_access(ramap *ra, a1fs_ino_t ino, uint64_t offset, size_t size,
+                  uint64_t ahead[2], uint64_t behind[2]);
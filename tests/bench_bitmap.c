@@ -0,0 +1,123 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Bitmap search benchmark.
+ *
+ * Measures how long it takes to find a free bit in a bitmap of 2^30 bits (a
+ * 4 TB image) as it fills up, with bitmap_find_zero() and with the bit at a
+ * time loop that the allocators used before it. Two layouts are measured:
+ * "prefix", where the used bits are all at the start (as after allocating
+ * from the start of an empty image) and the search starts at bit 0; and
+ * "random", where each bit is used with the given probability and the search
+ * starts at a random bit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../bitmap.h"
+
+
+#define NBITS (1ull << 30)
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rnd(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/** The search as the allocators did it before the bitmap module. */
+static uint64_t find_zero_bitwise(const unsigned char *bitmap, uint64_t nbits, uint64_t from)
+{
+	for (uint64_t i = from; i < nbits; i++) {
+		if (!(bitmap[i / 8] & (1 << (7 - i % 8)))) {
+			return i;
+		}
+	}
+	return nbits;
+}
+
+/** Average time of a search in ns; the searches start at the given bits. */
+static double measure(uint64_t (*find)(const unsigned char*, uint64_t, uint64_t),
+                      const unsigned char *bitmap, const uint64_t *from, int n)
+{
+	// the searches must not overlap: the CPU would run ahead into the next one
+	// while waiting for the bitmap to be read from memory
+	volatile uint64_t last = 0;
+	double t = now();
+	for (int i = 0; i < n; i++) {
+		last = find(bitmap, NBITS, from[i] ^ (last & 1));
+#if defined(__x86_64__)
+		__builtin_ia32_lfence();
+#endif
+	}
+	return (now() - t) / n * 1e9;
+}
+
+int main(void)
+{
+	static const double fullness[] = { 0.0, 0.5, 0.9, 0.99, 0.999 };
+	unsigned char *bitmap = aligned_alloc(64, NBITS / 8);
+	uint64_t from[1000];
+	uint64_t s = 88172645463325252ull;
+	bitmap_init();
+
+	printf("%-8s %9s %14s %14s\n", "layout", "fullness", "bitwise (ns)", "by word (ns)");
+	for (size_t f = 0; f < sizeof(fullness) / sizeof(fullness[0]); f++) {
+		// used bits at the start, one search from bit 0
+		uint64_t used = (uint64_t)(NBITS * fullness[f]);
+		memset(bitmap, 0, NBITS / 8);
+		bitmap_set_range(bitmap, 0, used);
+		memset(from, 0, sizeof(from));
+		// a bitwise search through half of the bitmap takes a second already
+		int n = used > 0 ? 1 : 1000;
+		double bitwise = measure(find_zero_bitwise, bitmap, from, n);
+		double by_word = measure(bitmap_find_zero, bitmap, from, n);
+		printf("%-8s %8.1f%% %14.0f %14.0f\n", "prefix", fullness[f] * 100, bitwise, by_word);
+
+		// used bits spread out, searches from random bits
+		memset(bitmap, 0, NBITS / 8);
+		uint64_t threshold = (uint64_t)(fullness[f] * 65536);
+		for (uint64_t i = 0; i < NBITS / 64; i++) {
+			uint64_t w = 0;
+			for (int b = 0; b < 64; b++) {
+				w = w << 1 | (rnd(&s) % 65536 < threshold);
+			}
+			memcpy(bitmap + i * 8, &w, 8);
+		}
+		for (int i = 0; i < 1000; i++) {
+			from[i] = rnd(&s) % NBITS;
+		}
+		// both searches read the same words; read them once before timing
+		measure(bitmap_find_zero, bitmap, from, 1000);
+		bitwise = measure(find_zero_bitwise, bitmap, from, 1000);
+		by_word = measure(bitmap_find_zero, bitmap, from, 1000);
+		printf("%-8s %8.1f%% %14.0f %14.0f\n", "random", fullness[f] * 100, bitwise, by_word);
+	}
+	free(bitmap);
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - File creation benchmark.
+ *
+ * Marks the given share of the inodes of an image as used, from the start of
+ * the inode table (as if that many files had been created), then measures the
+ * rate of creating files: with the summary of the inode bitmap that a mount
+ * builds, and with the summary dropped so that free inodes are found by
+ * scanning the bitmap. The inodes marked used are not valid files; the image
+ * is only good for this benchmark afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../bitmap.h"
+#include "fstest.h"
+
+
+/** Number of files created per measurement. */
+#define CREATES 20000
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Create files /d/<prefix><i>; returns the time per file in us. */
+static double create_files(const char *prefix)
+{
+	char path[64];
+	double t = now();
+	for (int i = 0; i < CREATES; i++) {
+		sprintf(path, "/d/%s%d", prefix, i);
+		if (fstest_create(path, S_IFREG | 0644) != 0) {
+			fprintf(stderr, "Failed to create %s\n", path);
+			exit(1);
+		}
+	}
+	return (now() - t) / CREATES * 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s image used-percent\n", argv[0]);
+		return 2;
+	}
+	double used = atof(argv[2]) / 100;
+	a1fs_opts opts = { .img_path = argv[1] };
+	fs_ctx *fs = fstest_mount(&opts);
+	if (fs == NULL) {
+		fprintf(stderr, "Failed to mount %s\n", argv[1]);
+		return 1;
+	}
+	uint32_t ninodes = fs->sb->s_inodes_count;
+	uint32_t nused = (uint32_t)(ninodes * used);
+	if (nused > 1) {
+		// inode 0 is the root directory
+		unsigned char *bitmap = (unsigned char*)fs->image + (size_t)fs->sb->inode_bitmap * A1FS_BLOCK_SIZE;
+		bitmap_set_range(bitmap, 1, nused - 1);
+		fs->sb->s_free_inodes_count -= nused - 1;
+		fs_mark_dirty(fs, bitmap, nused / 8 + 1);
+		fs_mark_dirty(fs, fs->sb, sizeof(*fs->sb));
+	}
+	if (fstest_ops->mkdir("/d", S_IFDIR | 0755) != 0) {
+		fprintf(stderr, "Failed to create /d\n");
+		return 1;
+	}
+	// mount again so that the summary is built from the new bitmap
+	fstest_unmount(fs);
+	fs = fstest_mount(&opts);
+	if (fs == NULL) {
+		fprintf(stderr, "Failed to mount %s again\n", argv[1]);
+		return 1;
+	}
+
+	double summary = create_files("s");
+	bitmap_summary_destroy(&fs->ino_summary);
+	double scan = create_files("b");
+	printf("%u inodes, %.0f%% used: create %.2f us/file with the summary, %.2f us/file by bitmap scan\n",
+	       ninodes, used * 100, summary, scan);
+	fstest_unmount(fs);
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Extent offset index benchmark.
+ *
+ * Builds a fragmented file by writing it one block at a time, taking turns
+ * with a filler file, so that each block of the file is an extent of its own.
+ * Then measures the latency of reading single blocks at random offsets: with
+ * the offset index, and with the index dropped before each read, so that the
+ * lookup sums the extent lengths from the start of the extent array (in the
+ * inode or in an extent tree leaf), as it did before the index. Rebuilding
+ * the index sums all the lengths of the array, where the old lookup stopped
+ * at the extent found, so the second figure is an upper bound.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fstest.h"
+
+
+/** Number of reads per measurement. */
+#define READS 100000
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_block(const char *path, char *buf, uint64_t i)
+{
+	struct fuse_file_info fi = {0};
+	int ret = fstest_ops->open(path, &fi);
+	if (ret == 0) {
+		ret = fstest_ops->write(path, buf, A1FS_BLOCK_SIZE, i * A1FS_BLOCK_SIZE, &fi);
+		fstest_ops->release(path, &fi);
+	}
+	if (ret != A1FS_BLOCK_SIZE) {
+		fprintf(stderr, "%s: write of block %llu: %d\n", path, (unsigned long long)i, ret);
+		exit(1);
+	}
+}
+
+/** Number of runs of consecutive data blocks in the first n blocks of a file. */
+static unsigned count_extents(fs_ctx *fs, const char *path, unsigned n)
+{
+	unsigned count = 0;
+	int64_t prev = -1;
+	for (unsigned i = 0; i < n; i++) {
+		int64_t blk = fstest_block(fs, path, (uint64_t)i * A1FS_BLOCK_SIZE);
+		if (blk != prev + 1) {
+			count++;
+		}
+		prev = blk;
+	}
+	return count;
+}
+
+/** Read random blocks of a file; returns the time per read in us. */
+static double read_blocks(fs_ctx *fs, const char *path, unsigned n, bool indexed)
+{
+	char buf[A1FS_BLOCK_SIZE];
+	uint64_t s = 0x9e3779b97f4a7c15ull;
+	struct fuse_file_info fi = {0};
+	if (fstest_ops->open(path, &fi) != 0) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		exit(1);
+	}
+	double t = now();
+	for (int i = 0; i < READS; i++) {
+		s = s * 6364136223846793005ull + 1442695040888963407ull;
+		uint64_t off = (s >> 33) % n * A1FS_BLOCK_SIZE;
+		if (!indexed) {
+			// the next lookup rebuilds the index from the extent lengths
+			fs->extmap.slots[0].key = UINT64_MAX;
+		}
+		int ret = fstest_ops->read(path, buf, sizeof(buf), off, &fi);
+		if (ret != sizeof(buf)) {
+			fprintf(stderr, "%s: read at %llu: %d\n", path, (unsigned long long)off, ret);
+			exit(1);
+		}
+	}
+	t = (now() - t) / READS * 1e6;
+	fstest_ops->release(path, &fi);
+	return t;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s image extents\n", argv[0]);
+		return 2;
+	}
+	unsigned n = atoi(argv[2]);
+	if (n == 0) {
+		fprintf(stderr, "The number of extents must be positive\n");
+		return 2;
+	}
+	a1fs_opts opts = { .img_path = argv[1] };
+	fs_ctx *fs = fstest_mount(&opts);
+	if (fs == NULL) {
+		fprintf(stderr, "Failed to mount %s\n", argv[1]);
+		return 1;
+	}
+	if (fstest_create("/f", S_IFREG | 0644) != 0 || fstest_create("/g", S_IFREG | 0644) != 0) {
+		fprintf(stderr, "Failed to create the files\n");
+		return 1;
+	}
+	char buf[A1FS_BLOCK_SIZE] = {1};
+	for (unsigned i = 0; i < n; i++) {
+		write_block("/f", buf, i);
+		write_block("/g", buf, i);
+	}
+	unsigned extents = count_extents(fs, "/f", n);
+	if (extents != n) {
+		fprintf(stderr, "/f has %u extents, not %u\n", extents, n);
+		return 1;
+	}
+
+	double indexed = read_blocks(fs, "/f", n, true);
+	// one slot, emptied before each read, so that no index is ever reused
+	extmap_destroy(&fs->extmap);
+	if (!extmap_init(&fs->extmap, 1, fs_64bit(fs))) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	double linear = read_blocks(fs, "/f", n, false);
+	printf("%u extents: random 4 KB read %.2f us with the offset index, %.2f us by summing extents\n",
+	       n, indexed, linear);
+	fstest_unmount(fs);
+	return 0;
+}
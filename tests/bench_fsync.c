@@ -0,0 +1,117 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - fsync benchmark.
+ *
+ * Writes 64 KB to a file and to a number of other files, then measures the
+ * time to make the file durable: with fsync, which writes back only the dirty
+ * blocks of the file, and with an msync of the whole image, which is what an
+ * fsync has to do without dirty range tracking. Rounds of the two alternate,
+ * and everything is written back between rounds. The background writeback is
+ * set up so that it does not run during the benchmark. The image should be on
+ * a file system backed by a disk (msync does nothing on tmpfs).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "fstest.h"
+
+
+/** Number of rounds of each kind. */
+#define ROUNDS 20
+/** Size of the write to each file. */
+#define WRITE_SIZE (64 * 1024)
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_file(const char *path, char *buf)
+{
+	int ret = fstest_ops->write(path, buf, WRITE_SIZE, 0, NULL);
+	if (ret != WRITE_SIZE) {
+		fprintf(stderr, "%s: write: %d\n", path, ret);
+		exit(1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s image other-files\n", argv[0]);
+		return 2;
+	}
+	int nother = atoi(argv[2]);
+	a1fs_opts opts = {
+		.img_path = argv[1],
+		.writeback_ms = 1000000,
+		.writeback_kb = 1u << 30,
+	};
+	fs_ctx *fs = fstest_mount(&opts);
+	if (fs == NULL) {
+		fprintf(stderr, "Failed to mount %s\n", argv[1]);
+		return 1;
+	}
+	char path[64];
+	if (fstest_create("/t", S_IFREG | 0644) != 0) {
+		fprintf(stderr, "Failed to create /t\n");
+		return 1;
+	}
+	for (int i = 0; i < nother; i++) {
+		sprintf(path, "/o%d", i);
+		if (fstest_create(path, S_IFREG | 0644) != 0) {
+			fprintf(stderr, "Failed to create %s\n", path);
+			return 1;
+		}
+	}
+
+	char *buf = malloc(WRITE_SIZE);
+	memset(buf, 'a', WRITE_SIZE);
+	double tracked = 0, full = 0;
+	for (int r = 0; r < 2 * ROUNDS; r++) {
+		buf[0] = (char)r;
+		write_file("/t", buf);
+		for (int i = 0; i < nother; i++) {
+			sprintf(path, "/o%d", i);
+			write_file(path, buf);
+		}
+		double t = now();
+		int ret = r % 2 ? msync(fs->image, fs->size, MS_SYNC)
+		                : fstest_ops->fsync("/t", 0, NULL);
+		if (ret != 0) {
+			fprintf(stderr, "%s failed: %d\n", r % 2 ? "msync" : "fsync", ret);
+			return 1;
+		}
+		*(r % 2 ? &full : &tracked) += now() - t;
+		// leave nothing dirty for the next round
+		if (dirtymap_flush(&fs->dirty, 0, fs->size / A1FS_BLOCK_SIZE) != 0) {
+			fprintf(stderr, "Failed to write back the image\n");
+			return 1;
+		}
+	}
+	printf("%d other dirty files: fsync %.2f ms with range tracking, %.2f ms by msync of the image\n",
+	       nother, tracked / ROUNDS * 1e3, full / ROUNDS * 1e3);
+	free(buf);
+	fstest_unmount(fs);
+	return 0;
+}
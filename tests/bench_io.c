@@ -0,0 +1,131 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Sequential I/O benchmark.
+ *
+ * Like dd: writes a file from start to end in requests of a given size, then
+ * reads it back the same way with read_buf, copying the reply into a user
+ * buffer as FUSE would. Each request size given (e.g. 4096 and 131072, the
+ * old and the new max_read/max_write) gets its own file, removed afterwards.
+ * The operations are called in process, so the time of a FUSE round trip per
+ * request (two context switches and a copy through /dev/fuse) is not
+ * included; with a mount, that cost is paid 32 times more often with 4 KB
+ * requests than with 128 KB ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fstest.h"
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Write the whole file in requests of bs bytes; returns the time in s. */
+static double write_file(const char *path, char *buf, size_t bs, uint64_t size,
+                         struct fuse_file_info *fi)
+{
+	double t = now();
+	for (uint64_t off = 0; off < size; off += bs) {
+		int ret = fstest_ops->write(path, buf, bs, off, fi);
+		if (ret != (int)bs) {
+			fprintf(stderr, "%s: write at %llu: %d\n", path, (unsigned long long)off, ret);
+			exit(1);
+		}
+	}
+	return now() - t;
+}
+
+/** Read the whole file in requests of bs bytes; returns the time in s. */
+static double read_file(const char *path, char *buf, size_t bs, uint64_t size,
+                        struct fuse_file_info *fi)
+{
+	double t = now();
+	for (uint64_t off = 0; off < size; off += bs) {
+		struct fuse_bufvec *bv;
+		int ret = fstest_ops->read_buf(path, &bv, bs, off, fi);
+		if (ret != 0) {
+			fprintf(stderr, "%s: read_buf at %llu: %d\n", path, (unsigned long long)off, ret);
+			exit(1);
+		}
+		struct fuse_bufvec dst = FUSE_BUFVEC_INIT(bs);
+		dst.buf[0].mem = buf;
+		if (fuse_buf_copy(&dst, bv, 0) != (ssize_t)bs) {
+			fprintf(stderr, "%s: short read at %llu\n", path, (unsigned long long)off);
+			exit(1);
+		}
+		for (size_t i = 0; i < bv->count; i++) {
+			if (!(bv->buf[i].flags & FUSE_BUF_IS_FD)) {
+				free(bv->buf[i].mem);
+			}
+		}
+		free(bv);
+	}
+	return now() - t;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 4) {
+		fprintf(stderr, "Usage: %s image size-MB request-size...\n", argv[0]);
+		return 2;
+	}
+	uint64_t size = strtoull(argv[2], NULL, 10) << 20;
+	a1fs_opts opts = { .img_path = argv[1] };
+	fs_ctx *fs = fstest_mount(&opts);
+	if (fs == NULL) {
+		fprintf(stderr, "Failed to mount %s\n", argv[1]);
+		return 1;
+	}
+
+	for (int i = 3; i < argc; i++) {
+		size_t bs = strtoul(argv[i], NULL, 10);
+		if (bs == 0 || size % bs != 0) {
+			fprintf(stderr, "Request size %s must divide the file size\n", argv[i]);
+			return 2;
+		}
+		char path[64];
+		sprintf(path, "/f%zu", bs);
+		struct fuse_file_info fi = {0};
+		int ret = fstest_create(path, S_IFREG | 0644);
+		if (ret == 0) {
+			ret = fstest_ops->open(path, &fi);
+		}
+		if (ret != 0) {
+			fprintf(stderr, "%s: create/open: %d\n", path, ret);
+			return 1;
+		}
+		char *buf = malloc(bs);
+		memset(buf, 0xa5, bs);
+		double w = write_file(path, buf, bs, size, &fi);
+		double r = read_file(path, buf, bs, size, &fi);
+		fstest_ops->release(path, &fi);
+		fstest_ops->unlink(path);
+		free(buf);
+		printf("%llu MB in %zu-byte requests (%llu each way): write %.0f MB/s, read %.0f MB/s\n",
+		       (unsigned long long)(size >> 20), bs, (unsigned long long)(size / bs),
+		       (size >> 20) / w, (size >> 20) / r);
+	}
+	fstest_unmount(fs);
+	return 0;
+}
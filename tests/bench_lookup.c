@@ -0,0 +1,102 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Directory lookup benchmark.
+ *
+ * Fills a directory with the given number of files and measures the latency of
+ * looking names up in its blocks (bypassing the directory entry cache), for
+ * the directory format of the image: linear, or hashed with mkfs.a1fs -d.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fstest.h"
+
+
+/** Number of names looked up per measurement. */
+#define LOOKUPS 100000
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s image entries\n", argv[0]);
+		return 2;
+	}
+	long n = atol(argv[2]);
+	a1fs_opts opts = { .img_path = argv[1] };
+	fs_ctx *fs = fstest_mount(&opts);
+	if (fs == NULL) {
+		fprintf(stderr, "Failed to mount %s\n", argv[1]);
+		return 1;
+	}
+
+	if (fstest_ops->mkdir("/d", S_IFDIR | 0755) != 0) {
+		fprintf(stderr, "Failed to create /d\n");
+		return 1;
+	}
+	char path[64];
+	double t = now();
+	for (long i = 0; i < n; i++) {
+		sprintf(path, "/d/file%08ld", i);
+		if (fstest_create(path, S_IFREG | 0644) != 0) {
+			fprintf(stderr, "Failed to create %s\n", path);
+			return 1;
+		}
+	}
+	double create = now() - t;
+
+	// names in random order, so that consecutive lookups share nothing
+	size_t nlookups = LOOKUPS;
+	char **names = malloc(nlookups * sizeof(char*));
+	uint64_t s = 88172645463325252ull;
+	for (size_t i = 0; i < nlookups; i++) {
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		names[i] = malloc(16);
+		sprintf(names[i], "file%08ld", (long)(s % n));
+	}
+	// linear lookups in large directories are slow; measure fewer of them
+	if (!(fs->sb->s_features & A1FS_FEATURE_DIR_INDEX) && n > 1000) {
+		nlookups = nlookups * 1000 / n > 100 ? nlookups * 1000 / n : 100;
+	}
+	t = now();
+	long found = fstest_lookup(fs, "/d", names, nlookups);
+	double lookup = now() - t;
+	if (found != (long)nlookups) {
+		fprintf(stderr, "Found %ld of %zu names\n", found, nlookups);
+		return 1;
+	}
+
+	printf("%s, %8ld entries: lookup %10.0f ns, create %7.2f us/file\n",
+	       fs->sb->s_features & A1FS_FEATURE_DIR_INDEX ? "hashed" : "linear", n,
+	       lookup / nlookups * 1e9, create / n * 1e6);
+	for (size_t i = 0; i < LOOKUPS; i++) {
+		free(names[i]);
+	}
+	free(names);
+	fstest_unmount(fs);
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Large image test.
+ *
+ * Runs on an empty sparse image of more than 2^32 data blocks formatted with
+ * mkfs.a1fs -b. Two files are preallocated to take up the first 2^32 blocks
+ * and more, so that the data of the next file lands past block 2^32; that file
+ * is written at its start and at an offset past 2^32 blocks, with a hole in
+ * between. The data is read back and the image is checked with fstest_check()
+ * before and after mounting the image again. The file is then truncated to the
+ * maximum file size, and once all the files are removed the free block count
+ * must be back where it started.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fstest.h"
+
+
+/** Size preallocated by each of the two filler files (10 TiB). */
+#define FILL_SIZE (10ull << 40)
+/** Offset of the far write: past 2^32 blocks, not block aligned. */
+#define FAR_OFFSET ((1ull << 32) * A1FS_BLOCK_SIZE + 12345)
+/** Size of each write. */
+#define WRITE_SIZE (64 * 1024)
+
+static int failed;
+
+#define FAIL(...) do { fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); failed = 1; } while (0)
+
+static unsigned char pattern(uint64_t off)
+{
+	return (unsigned char)((off / 7 * 40503u + off) % 255 + 1);
+}
+
+static void write_range(const char *path, uint64_t off)
+{
+	unsigned char *buf = malloc(WRITE_SIZE);
+	for (size_t i = 0; i < WRITE_SIZE; i++) {
+		buf[i] = pattern(off + i);
+	}
+	struct fuse_file_info fi = {0};
+	int ret = fstest_ops->open(path, &fi);
+	if (ret == 0) {
+		ret = fstest_ops->write(path, (char*)buf, WRITE_SIZE, off, &fi);
+		fstest_ops->release(path, &fi);
+	}
+	if (ret != WRITE_SIZE) {
+		FAIL("%s: write at %llu: %d", path, (unsigned long long)off, ret);
+	}
+	free(buf);
+}
+
+/** Read a range of a file; it must hold its pattern, or zeros if zero is set. */
+static void check_range(const char *path, uint64_t off, bool zero)
+{
+	unsigned char *buf = malloc(WRITE_SIZE);
+	struct fuse_file_info fi = {0};
+	int ret = fstest_ops->open(path, &fi);
+	if (ret == 0) {
+		ret = fstest_ops->read(path, (char*)buf, WRITE_SIZE, off, &fi);
+		fstest_ops->release(path, &fi);
+	}
+	if (ret != WRITE_SIZE) {
+		FAIL("%s: read at %llu: %d", path, (unsigned long long)off, ret);
+	} else {
+		for (size_t i = 0; i < WRITE_SIZE; i++) {
+			if (buf[i] != (zero ? 0 : pattern(off + i))) {
+				FAIL("%s: wrong byte at %llu", path, (unsigned long long)(off + i));
+				break;
+			}
+		}
+	}
+	free(buf);
+}
+
+/** Check the data block of a byte of a file: past 2^32, or a hole (-ENXIO). */
+static void check_block(fs_ctx *fs, const char *path, uint64_t off, bool hole)
+{
+	int64_t blk = fstest_block(fs, path, off);
+	if (hole ? blk != -ENXIO : blk < (int64_t)(1ull << 32)) {
+		FAIL("%s: offset %llu is in block %lld", path, (unsigned long long)off, (long long)blk);
+	}
+}
+
+static void check_data(fs_ctx *fs)
+{
+	check_block(fs, "/c", 0, false);
+	check_block(fs, "/c", FAR_OFFSET, false);
+	check_block(fs, "/c", FAR_OFFSET / 2, true);
+	check_range("/c", 0, false);
+	check_range("/c", FAR_OFFSET, false);
+	check_range("/c", FAR_OFFSET / 2, true);
+	struct stat st;
+	int ret = fstest_ops->getattr("/c", &st);
+	if (ret != 0 || (uint64_t)st.st_size != FAR_OFFSET + WRITE_SIZE) {
+		FAIL("/c: getattr: %d, size %lld", ret, (long long)st.st_size);
+	}
+	if (fstest_check(fs) != 0) {
+		failed = 1;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s image\n", argv[0]);
+		return 2;
+	}
+	a1fs_opts opts = { .img_path = argv[1] };
+	fs_ctx *fs = fstest_mount(&opts);
+	if (fs == NULL) {
+		fprintf(stderr, "Failed to mount %s\n", argv[1]);
+		return 1;
+	}
+	if (!fs_64bit(fs) || fs_data_blocks(fs) <= 2 * FILL_SIZE / A1FS_BLOCK_SIZE + (1ull << 20)) {
+		fprintf(stderr, "%s must be formatted with -b and hold more than 20 TiB\n", argv[1]);
+		return 1;
+	}
+	uint64_t free_blocks = fs_free_blocks(fs);
+
+	const char *fillers[] = { "/a", "/b" };
+	for (int i = 0; i < 2; i++) {
+		int ret = fstest_create(fillers[i], S_IFREG | 0644);
+		if (ret == 0) {
+			ret = fstest_ops->fallocate(fillers[i], 0, 0, FILL_SIZE, NULL);
+		}
+		if (ret != 0) {
+			fprintf(stderr, "%s: create/fallocate: %d\n", fillers[i], ret);
+			return 1;
+		}
+	}
+	int ret = fstest_create("/c", S_IFREG | 0644);
+	if (ret != 0) {
+		fprintf(stderr, "/c: create: %d\n", ret);
+		return 1;
+	}
+	write_range("/c", 0);
+	write_range("/c", FAR_OFFSET);
+	check_data(fs);
+
+	fstest_unmount(fs);
+	fs = fstest_mount(&opts);
+	if (fs == NULL) {
+		fprintf(stderr, "Failed to mount %s again\n", argv[1]);
+		return 1;
+	}
+	check_data(fs);
+
+	// the largest file is all hole extents; one byte more is too large
+	ret = fstest_ops->truncate("/c", fs_max_file_size(fs) + 1);
+	if (ret != -EFBIG) {
+		FAIL("/c: truncate past the maximum size: %d", ret);
+	}
+	ret = fstest_ops->truncate("/c", fs_max_file_size(fs));
+	if (ret != 0) {
+		FAIL("/c: truncate to the maximum size: %d", ret);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		fstest_ops->unlink(fillers[i]);
+	}
+	fstest_ops->unlink("/c");
+	if (fs_free_blocks(fs) != free_blocks) {
+		FAIL("%llu free blocks after removing all files, %llu before creating them",
+		     (unsigned long long)fs_free_blocks(fs), (unsigned long long)free_blocks);
+	}
+	if (fstest_check(fs) != 0) {
+		failed = 1;
+	}
+	fstest_unmount(fs);
+	return failed;
+}
@@ -0,0 +1,531 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - In-process test support and image checker.
+ *
+ * a1fs.c is built into the tests as is; its main() is renamed so that the
+ * tests can have their own.
+ */
+
+#define main a1fs_main
+#include "../a1fs.c"
+#undef main
+
+#include <stdarg.h>
+
+#include "fstest.h"
+
+
+const struct fuse_operations *fstest_ops = &a1fs_ops;
+
+/** Context of every call; private_data is the image mounted by fstest_mount(). */
+static struct fuse_context context;
+
+/** Replaces the libfuse function; there is no FUSE session in the tests. */
+struct fuse_context *fuse_get_context(void)
+{
+	return &context;
+}
+
+fs_ctx *fstest_mount(a1fs_opts *opts)
+{
+	if (!opts->writeback_ms) {
+		opts->writeback_ms = A1FS_WRITEBACK_MS;
+	}
+	if (!opts->writeback_kb) {
+		opts->writeback_kb = A1FS_WRITEBACK_KB;
+	}
+	fs_ctx *fs = calloc(1, sizeof(fs_ctx));
+	if (fs == NULL) {
+		return NULL;
+	}
+	if (!a1fs_init(fs, opts)) {
+		free(fs);
+		return NULL;
+	}
+	context.private_data = fs;
+	return fs;
+}
+
+void fstest_unmount(fs_ctx *fs)
+{
+	a1fs_destroy(fs);
+	context.private_data = NULL;
+	free(fs);
+}
+
+void fstest_crash(fs_ctx *fs)
+{
+	fs_ctx_destroy(fs);
+	if (fs->cache) {
+		bcache_flush(fs->cache, 0, fs->size / A1FS_BLOCK_SIZE);
+		bcache_close(fs->cache);
+		free(fs->cache);
+	} else {
+		close(fs->fd);
+		munmap(fs->image, fs->size);
+	}
+	context.private_data = NULL;
+	free(fs);
+}
+
+int fstest_create(const char *path, mode_t mode)
+{
+	struct fuse_file_info fi = {0};
+	int ret = a1fs_ops.create(path, mode, &fi);
+	if (ret == 0) {
+		a1fs_ops.release(path, &fi);
+	}
+	return ret;
+}
+
+long fstest_lookup(fs_ctx *fs, const char *dir, char *const *names, size_t n)
+{
+	a1fs_inode *inode;
+	int ret = lookup_inode(dir, fs, &inode);
+	if (ret != 0) {
+		return ret;
+	}
+	long found = 0;
+	inode_rdlock(fs, inode->inode_num);
+	for (size_t i = 0; i < n; i++) {
+		int ino;
+		found += lookup_dentry(inode, names[i], &ino, fs) != NULL;
+	}
+	inode_unlock(fs, inode->inode_num);
+	return found;
+}
+
+int64_t fstest_block(fs_ctx *fs, const char *path, uint64_t off)
+{
+	a1fs_inode *inode;
+	int ret = lookup_inode(path, fs, &inode);
+	if (ret != 0) {
+		return ret;
+	}
+	int64_t blk = -ENXIO;
+	inode_rdlock(fs, inode->inode_num);
+	if (!(inode->flags & A1FS_INODE_INLINE)) {
+		ext_path ep;
+		uint64_t first;
+		a1fs_extent *e = extent_find(inode, off / A1FS_BLOCK_SIZE, &ep, &first, fs);
+		if (e != NULL && !a1fs_extent_hole(e, fs_64bit(fs))) {
+			blk = a1fs_extent_start(e, fs_64bit(fs)) + (off / A1FS_BLOCK_SIZE - first);
+		}
+	}
+	inode_unlock(fs, inode->inode_num);
+	return blk;
+}
+
+
+/** A run of data blocks in use and the inode that uses it. */
+typedef struct claim {
+	uint64_t start;
+	uint64_t count;
+	/** Inode number; UINT32_MAX for blocks held for an open file. */
+	a1fs_ino_t ino;
+} claim;
+
+/** State of a check. */
+typedef struct check_ctx {
+	fs_ctx *fs;
+	claim *claims;
+	size_t nclaims;
+	size_t cap;
+	/** Number of times each inode is reached from the root. */
+	uint32_t *refs;
+	/** Number of subdirectories of each directory. */
+	uint32_t *subdirs;
+	unsigned long errors;
+} check_ctx;
+
+/** Report a problem. */
+static void problem(check_ctx *c, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	fprintf(stderr, "fsck: ");
+	vfprintf(stderr, fmt, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	c->errors++;
+}
+
+static void add_claim(check_ctx *c, uint64_t start, uint64_t count, a1fs_ino_t ino)
+{
+	if (start >= fs_data_blocks(c->fs) || count > fs_data_blocks(c->fs) - start) {
+		problem(c, "inode %u: blocks [%lu, +%lu) are outside the data region",
+		        ino, (unsigned long)start, (unsigned long)count);
+		return;
+	}
+	if (c->nclaims == c->cap) {
+		c->cap = c->cap ? c->cap * 2 : 1024;
+		c->claims = realloc(c->claims, c->cap * sizeof(claim));
+		if (c->claims == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	c->claims[c->nclaims++] = (claim){ start, count, ino };
+}
+
+/** Claim the data blocks of an array of extents; returns the blocks covered. */
+static uint64_t check_extents(check_ctx *c, a1fs_inode *inode, a1fs_extent *ext, uint32_t n)
+{
+	bool wide = fs_64bit(c->fs);
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		uint64_t len = a1fs_extent_len(&ext[i], wide);
+		if (len == 0) {
+			problem(c, "inode %u: extent %u is empty", inode->inode_num, i);
+		}
+		if (!a1fs_extent_hole(&ext[i], wide)) {
+			add_claim(c, a1fs_extent_start(&ext[i], wide), len, inode->inode_num);
+		}
+		total += len;
+	}
+	return total;
+}
+
+/**
+ * Check an extent tree node and the nodes below it.
+ *
+ * @param first   logical block the node is expected to start at.
+ * @param levels  expected number of levels below the node.
+ * @param nexts   incremented by the number of extents in the leaves.
+ * @return        number of blocks covered by the node.
+ */
+static uint64_t check_node(check_ctx *c, a1fs_inode *inode, a1fs_blk_t blk, uint64_t first,
+                           uint32_t levels, uint64_t *nexts)
+{
+	add_claim(c, blk, 1, inode->inode_num);
+	if (blk >= fs_data_blocks(c->fs)) {
+		return 0;
+	}
+	a1fs_extent_node *node = fs_block(c->fs, blk);
+	if (node->levels != levels) {
+		problem(c, "inode %u: node %lu has %u levels below, expected %u",
+		        inode->inode_num, (unsigned long)blk, node->levels, levels);
+		return 0;
+	}
+	if (node->levels == 0) {
+		if (node->count > A1FS_EXTENT_LEAF_LIMIT) {
+			problem(c, "inode %u: leaf %lu has %u extents", inode->inode_num, (unsigned long)blk, node->count);
+			return 0;
+		}
+		*nexts += node->count;
+		return check_extents(c, inode, a1fs_extent_leaf(node), node->count);
+	}
+	if (node->count == 0 || node->count > A1FS_EXTENT_INDEX_LIMIT) {
+		problem(c, "inode %u: index node %lu has %u entries", inode->inode_num, (unsigned long)blk, node->count);
+		return 0;
+	}
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < node->count; i++) {
+		a1fs_extent_idx *e = &a1fs_extent_index(node)[i];
+		// the key of the first entry is that of the node itself
+		if (i > 0 && e->lblk != first + total) {
+			problem(c, "inode %u: index node %lu entry %u starts at %lu, expected %lu",
+			        inode->inode_num, (unsigned long)blk, i, (unsigned long)e->lblk,
+			        (unsigned long)(first + total));
+		}
+		total += check_node(c, inode, e->block, first + total, node->levels - 1, nexts);
+	}
+	return total;
+}
+
+/** Check the extents of an inode in use and claim its blocks. */
+static void check_inode(check_ctx *c, a1fs_inode *inode)
+{
+	fs_ctx *fs = c->fs;
+	if (inode->flags & A1FS_INODE_INLINE) {
+		if (inode->count_extent != 0 || inode->indirect_block != -1 ||
+		    inode->size > fs_inline_size(fs)) {
+			problem(c, "inode %u: inline file with extents or too large", inode->inode_num);
+		}
+		return;
+	}
+	uint64_t nexts = 0;
+	uint64_t nblocks;
+	if (inode->flags & A1FS_INODE_EXTENT_TREE) {
+		a1fs_blk_t root = inode_extent_block(inode, fs);
+		uint32_t levels = root < fs_data_blocks(fs) ? ((a1fs_extent_node*)fs_block(fs, root))->levels : 0;
+		nblocks = check_node(c, inode, root, 0, levels, &nexts);
+	} else {
+		if (inode->indirect_block != -1) {
+			add_claim(c, inode_extent_block(inode, fs), 1, inode->inode_num);
+		}
+		if (inode->count_extent > inode_max_extents(inode, fs)) {
+			problem(c, "inode %u: %u extents do not fit", inode->inode_num, inode->count_extent);
+			return;
+		}
+		nexts = inode->count_extent;
+		nblocks = check_extents(c, inode, inode_extents(inode, fs), inode->count_extent);
+	}
+	if (nexts != inode->count_extent) {
+		problem(c, "inode %u: %lu extents, count_extent %u", inode->inode_num,
+		        (unsigned long)nexts, inode->count_extent);
+	}
+	if (nblocks < ceiling(inode->size, A1FS_BLOCK_SIZE)) {
+		problem(c, "inode %u: %lu blocks for %lu bytes", inode->inode_num,
+		        (unsigned long)nblocks, (unsigned long)inode->size);
+	}
+}
+
+static int compare_claim(const void *a, const void *b)
+{
+	const claim *x = a;
+	const claim *y = b;
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/**
+ * Compare the data block bitmap with the claimed blocks, and the free block
+ * counts with the bitmap.
+ */
+static void check_block_bitmap(check_ctx *c)
+{
+	fs_ctx *fs = c->fs;
+	const unsigned char *bitmap = (unsigned char*)fs->image + (size_t)fs->sb->dblock_bitmap * A1FS_BLOCK_SIZE;
+	uint64_t nbits = fs_data_blocks(fs);
+
+	qsort(c->claims, c->nclaims, sizeof(claim), compare_claim);
+	for (size_t i = 1; i < c->nclaims; i++) {
+		claim *prev = &c->claims[i - 1];
+		if (c->claims[i].start < prev->start + prev->count) {
+			problem(c, "block %lu is used by inodes %d and %d", (unsigned long)c->claims[i].start,
+			        (int)prev->ino, (int)c->claims[i].ino);
+		}
+	}
+
+	// walk the runs of set bits and the claims side by side
+	uint32_t ngroups = fs_has_groups(fs) ? fs->sb->s_groups_count : 0;
+	uint64_t *used = calloc(ngroups + 1, sizeof(uint64_t));
+	uint64_t total = 0;
+	size_t i = 0;
+	for (uint64_t pos = bitmap_find_one(bitmap, nbits, 0); pos < nbits; ) {
+		uint64_t end = bitmap_find_zero(bitmap, nbits, pos);
+		total += end - pos;
+		for (uint64_t b = pos; ngroups > 0 && b < end; ) {
+			uint64_t next = (b / fs->sb->s_blocks_per_group + 1) * fs->sb->s_blocks_per_group;
+			next = next < end ? next : end;
+			used[b / fs->sb->s_blocks_per_group] += next - b;
+			b = next;
+		}
+		uint64_t at = pos;
+		while (i < c->nclaims && c->claims[i].start < end) {
+			if (c->claims[i].start > at) {
+				problem(c, "blocks [%lu, %lu) are allocated but not used",
+				        (unsigned long)at, (unsigned long)c->claims[i].start);
+			} else if (c->claims[i].start < pos) {
+				problem(c, "inode %d: blocks from %lu are used but free in the bitmap",
+				        (int)c->claims[i].ino, (unsigned long)c->claims[i].start);
+			}
+			uint64_t claim_end = c->claims[i].start + c->claims[i].count;
+			if (claim_end > end) {
+				problem(c, "inode %d: blocks [%lu, %lu) are used but free in the bitmap",
+				        (int)c->claims[i].ino, (unsigned long)end, (unsigned long)claim_end);
+			}
+			at = claim_end > at ? claim_end : at;
+			i++;
+		}
+		if (at < end) {
+			problem(c, "blocks [%lu, %lu) are allocated but not used", (unsigned long)at, (unsigned long)end);
+		}
+		pos = end < nbits ? bitmap_find_one(bitmap, nbits, end) : nbits;
+	}
+	for (; i < c->nclaims; i++) {
+		problem(c, "inode %d: blocks [%lu, +%lu) are used but free in the bitmap", (int)c->claims[i].ino,
+		        (unsigned long)c->claims[i].start, (unsigned long)c->claims[i].count);
+	}
+
+	if (fs_free_blocks(fs) != nbits - total) {
+		problem(c, "superblock: %lu free blocks, bitmap has %lu",
+		        (unsigned long)fs_free_blocks(fs), (unsigned long)(nbits - total));
+	}
+	for (uint32_t g = 0; g < ngroups; g++) {
+		uint64_t start = (uint64_t)g * fs->sb->s_blocks_per_group;
+		uint64_t size = nbits - start < fs->sb->s_blocks_per_group ? nbits - start : fs->sb->s_blocks_per_group;
+		if (fs_group(fs, g)->free_blocks != size - used[g]) {
+			problem(c, "group %u: %u free blocks, bitmap has %lu", g, fs_group(fs, g)->free_blocks,
+			        (unsigned long)(size - used[g]));
+		}
+	}
+	free(used);
+}
+
+/** An entry collected from a directory listing. */
+typedef struct listed {
+	char name[A1FS_NAME_MAX];
+	a1fs_ino_t ino;
+	mode_t type;
+} listed;
+
+typedef struct listing {
+	listed *entries;
+	size_t n;
+	size_t cap;
+} listing;
+
+static int collect(void *buf, const char *name, const struct stat *st, off_t off)
+{
+	(void)off;
+	listing *l = buf;
+	if (st == NULL) {
+		return 0;// "." and ".."
+	}
+	if (l->n == l->cap) {
+		l->cap = l->cap ? l->cap * 2 : 64;
+		l->entries = realloc(l->entries, l->cap * sizeof(listed));
+		if (l->entries == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	listed *e = &l->entries[l->n++];
+	strncpy(e->name, name, A1FS_NAME_MAX - 1);
+	e->name[A1FS_NAME_MAX - 1] = '\0';
+	e->ino = st->st_ino;
+	e->type = st->st_mode & S_IFMT;
+	return 0;
+}
+
+/** Follow the entries of a directory and of the directories below it. */
+static void check_dir(check_ctx *c, const char *path, a1fs_ino_t dir_ino)
+{
+	fs_ctx *fs = c->fs;
+	listing l = {0};
+	int ret = a1fs_ops.readdir(path, &l, collect, 0, NULL);
+	if (ret != 0) {
+		problem(c, "%s: readdir failed: %d", path, ret);
+		return;
+	}
+	const unsigned char *bitmap = (unsigned char*)fs->image + (size_t)fs->sb->inode_bitmap * A1FS_BLOCK_SIZE;
+	for (size_t i = 0; i < l.n; i++) {
+		listed *e = &l.entries[i];
+		char child[A1FS_PATH_MAX];
+		snprintf(child, sizeof(child), "%s/%s", strcmp(path, "/") == 0 ? "" : path, e->name);
+		if (e->ino >= fs->sb->s_inodes_count || !(bitmap[e->ino / 8] & (0x80 >> (e->ino % 8)))) {
+			problem(c, "%s: entry for inode %u, which is not in use", child, e->ino);
+			continue;
+		}
+		a1fs_inode *inode = fs_inode(fs, e->ino);
+		if (e->type != 0 && e->type != (inode->mode & S_IFMT)) {
+			problem(c, "%s: entry type %o, inode mode %o", child, e->type, inode->mode);
+		}
+		c->refs[e->ino]++;
+		if (S_ISDIR(inode->mode)) {
+			c->subdirs[dir_ino]++;
+			// a directory reached again is linked twice; do not loop
+			if (c->refs[e->ino] == 1) {
+				check_dir(c, child, e->ino);
+			}
+		}
+	}
+	free(l.entries);
+}
+
+unsigned long fstest_check(fs_ctx *fs)
+{
+	check_ctx c = { .fs = fs };
+	uint32_t ninodes = fs->sb->s_inodes_count;
+	c.refs = calloc(ninodes, sizeof(uint32_t));
+	c.subdirs = calloc(ninodes, sizeof(uint32_t));
+	if (c.refs == NULL || c.subdirs == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+
+	// inodes in use and the blocks they use
+	const unsigned char *bitmap = (unsigned char*)fs->image + (size_t)fs->sb->inode_bitmap * A1FS_BLOCK_SIZE;
+	uint32_t ngroups = fs_has_groups(fs) ? fs->sb->s_groups_count : 0;
+	uint32_t *group_used = calloc(ngroups + 1, sizeof(uint32_t));
+	uint32_t *group_dirs = calloc(ngroups + 1, sizeof(uint32_t));
+	uint32_t used = 0;
+	for (a1fs_ino_t ino = 0; ino < ninodes; ino++) {
+		if (!(bitmap[ino / 8] & (0x80 >> (ino % 8)))) {
+			continue;
+		}
+		used++;
+		a1fs_inode *inode = fs_inode(fs, ino);
+		if (inode->inode_num != ino) {
+			problem(&c, "inode %u: inode_num is %u", ino, inode->inode_num);
+		}
+		if (!S_ISREG(inode->mode) && !S_ISDIR(inode->mode)) {
+			problem(&c, "inode %u: mode %o", ino, inode->mode);
+			continue;
+		}
+		if (ngroups > 0) {
+			group_used[ino / fs->sb->s_inodes_per_group]++;
+			group_dirs[ino / fs->sb->s_inodes_per_group] += S_ISDIR(inode->mode);
+		}
+		check_inode(&c, inode);
+	}
+	pthread_mutex_lock(&fs->open_files.lock);
+	for (size_t i = 0; i < fs->open_files.nfiles; i++) {
+		open_file *f = &fs->open_files.files[i];
+		for (size_t j = 0; j < f->nheld; j++) {
+			add_claim(&c, f->held[j].start, f->held[j].count, UINT32_MAX);
+		}
+	}
+	pthread_mutex_unlock(&fs->open_files.lock);
+	check_block_bitmap(&c);
+
+	if (fs->sb->s_free_inodes_count != ninodes - used) {
+		problem(&c, "superblock: %u free inodes, bitmap has %u", fs->sb->s_free_inodes_count, ninodes - used);
+	}
+	for (uint32_t g = 0; g < ngroups; g++) {
+		uint32_t size = ninodes - g * fs->sb->s_inodes_per_group;
+		size = size < fs->sb->s_inodes_per_group ? size : fs->sb->s_inodes_per_group;
+		a1fs_group_desc *gd = fs_group(fs, g);
+		if (gd->free_inodes != size - group_used[g]) {
+			problem(&c, "group %u: %u free inodes, bitmap has %u", g, gd->free_inodes, size - group_used[g]);
+		}
+		if (gd->used_dirs != group_dirs[g]) {
+			problem(&c, "group %u: %u directories, found %u", g, gd->used_dirs, group_dirs[g]);
+		}
+	}
+
+	// links
+	a1fs_inode *root;
+	if (lookup_inode("/", fs, &root) != 0) {
+		problem(&c, "no root directory");
+	} else {
+		c.refs[root->inode_num]++;
+		check_dir(&c, "/", root->inode_num);
+	}
+	for (a1fs_ino_t ino = 0; ino < ninodes; ino++) {
+		if (!(bitmap[ino / 8] & (0x80 >> (ino % 8)))) {
+			continue;
+		}
+		a1fs_inode *inode = fs_inode(fs, ino);
+		if (c.refs[ino] == 0) {
+			problem(&c, "inode %u is in use but not linked", ino);
+		} else if (S_ISDIR(inode->mode) && (c.refs[ino] != 1 || inode->links != 2 + c.subdirs[ino])) {
+			problem(&c, "directory %u: %u links, %u entries and %u subdirectories",
+			        ino, inode->links, c.refs[ino], c.subdirs[ino]);
+		} else if (S_ISREG(inode->mode) && inode->links != c.refs[ino]) {
+			problem(&c, "file %u: %u links, %u entries", ino, inode->links, c.refs[ino]);
+		}
+	}
+
+	free(group_used);
+	free(group_dirs);
+	free(c.claims);
+	free(c.refs);
+	free(c.subdirs);
+	return c.errors;
+}
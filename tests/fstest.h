@@ -0,0 +1,106 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - In-process test support header file.
+ *
+ * The tests call the a1fs file operations directly, without FUSE or a mount,
+ * on a scratch image, and check the image afterwards.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <fuse.h>
+
+#include "../fs_ctx.h"
+#include "../options.h"
+
+
+/** The a1fs file operations. */
+extern const struct fuse_operations *fstest_ops;
+
+/**
+ * Mount an image for the calling process, as a1fs would with the given options
+ * (img_path must be set; the defaults are used for options left at 0).
+ *
+ * @return  the file system context; NULL on failure.
+ */
+fs_ctx *fstest_mount(a1fs_opts *opts);
+
+/** Write back and unmount the image mounted by fstest_mount(). */
+void fstest_unmount(fs_ctx *fs);
+
+/**
+ * Drop the image mounted by fstest_mount() as if a1fs was killed: the image
+ * keeps whatever was stored in the mapping, but the unmount does not run. A
+ * block cache is written back first, as if a1fs was killed right after.
+ */
+void fstest_crash(fs_ctx *fs);
+
+/**
+ * Create a file and release its handle right away, like creat() followed by
+ * close().
+ *
+ * @return  0 on success; -errno on error.
+ */
+int fstest_create(const char *path, mode_t mode);
+
+/**
+ * Look names up in a directory, in the directory blocks themselves rather than
+ * in the directory entry cache.
+ *
+ * @param fs     the mounted image.
+ * @param dir    path of the directory.
+ * @param names  names to look up.
+ * @param n      number of names.
+ * @return       number of names found; -errno if dir cannot be looked up.
+ */
+long fstest_lookup(fs_ctx *fs, const char *dir, char *const *names, size_t n);
+
+/**
+ * Find the data block that holds a byte of a file.
+ *
+ * @param fs    the mounted image.
+ * @param path  path to the file.
+ * @param off   offset of the byte in the file.
+ * @return      block number; -ENXIO if off is in a hole or past the last block
+ *              of the file (or the file is stored in its inode); other -errno
+ *              if path cannot be looked up.
+ */
+int64_t fstest_block(fs_ctx *fs, const char *path, uint64_t off);
+
+/**
+ * Check the consistency of a mounted image; operations must not be running.
+ *
+ * Walks all the inodes in use and checks that:
+ *   - the data block bitmap marks exactly the blocks of their extents and
+ *     extent tree nodes (and the blocks held for open files), each block is
+ *     used once, and the extent trees are well formed;
+ *   - the free block and inode counts in the superblock and in the block
+ *     group descriptors, and the directory counts of the groups, match the
+ *     bitmaps and inodes;
+ *   - every directory entry names an inode in use, every inode in use is
+ *     reached from the root exactly as many times as its link count says.
+ *
+ * Each problem found is printed to stderr.
+ *
+ * @return  number of problems found.
+ */
+unsigned long fstest_check(fs_ctx *fs);
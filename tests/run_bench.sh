@@ -0,0 +1,66 @@
+#!/bin/bash
+# Run the benchmarks on scratch images.
+# Usage: tests/run_bench.sh  (from the top directory, after make)
+
+set -e
+
+img=$(mktemp /tmp/a1fs-bench.XXXXXX)
+trap 'rm -f "$img"' EXIT
+
+# Formats an empty image: mkfs <size> <mkfs.a1fs options...>
+mkfs() {
+	truncate -s 0 "$img"
+	truncate -s "$1" "$img"
+	shift
+	./mkfs.a1fs "$@" "$img" > /dev/null
+}
+
+echo "== Directory lookups"
+for n in 1000 100000 1000000; do
+	mkfs 2G -i 1100000 -d
+	tests/bench_lookup "$img" $n
+done
+# filling a linear directory takes time quadratic in its size (about a
+# minute for 100000 entries), so the largest one is left out
+for n in 1000 10000 100000; do
+	mkfs 1G -i 110000
+	tests/bench_lookup "$img" $n
+done
+
+echo "== Bitmap search"
+tests/bench_bitmap
+
+echo "== File creation"
+mkfs 1G -i 10000000 -c -d
+tests/bench_create "$img" 90
+
+echo "== Reads of a fragmented file"
+for n in 64 512 4096; do
+	mkfs 1G -i 16
+	tests/bench_extmap "$img" $n
+done
+
+echo "== fsync"
+for n in 0 16 128; do
+	mkfs 256M -i 1000
+	tests/bench_fsync "$img" $n
+done
+
+echo "== Sequential I/O"
+mkfs 1G -i 16
+tests/bench_io "$img" 512 4096 131072
+# the same through a mount with dd, where each request is a FUSE round trip
+if command -v fusermount > /dev/null && [ -c /dev/fuse ]; then
+	mnt=$(mktemp -d /tmp/a1fs-mnt.XXXXXX)
+	for bs in 4096 131072; do
+		mkfs 1G -i 16
+		./a1fs "$img" "$mnt" -o max_read=$bs,max_write=$bs
+		echo "max_read=max_write=$bs:"
+		dd if=/dev/zero of="$mnt/f" bs=1M count=512 conv=fsync 2>&1 | tail -n 1
+		dd if="$mnt/f" of=/dev/null bs=1M 2>&1 | tail -n 1
+		fusermount -u "$mnt"
+	done
+	rmdir "$mnt"
+else
+	echo "(no fusermount or /dev/fuse: dd through a mount skipped)"
+fi
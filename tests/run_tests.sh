@@ -0,0 +1,59 @@
+#!/bin/bash
+# Run the in-process tests on scratch images in every image format.
+# Usage: tests/run_tests.sh  (from the top directory, after make)
+
+set -e
+
+THREADS=${THREADS:-8}
+ITERATIONS=${ITERATIONS:-4000}
+
+img=$(mktemp /tmp/a1fs-test.XXXXXX)
+trap 'rm -f "$img"' EXIT
+
+for cfg in "" "-d" "-c" "-c -d" "-I 256" "-g 1024 -I 128 -d" "-b" "-b -c -d -g 1024 -I 256"; do
+	truncate -s 0 "$img"
+	truncate -s 64M "$img"
+	./mkfs.a1fs -i 1024 $cfg "$img" > /dev/null
+	if ! tests/stress "$img" "$THREADS" "$ITERATIONS"; then
+		echo "FAIL: stress, mkfs options '$cfg'"
+		exit 1
+	fi
+	echo "ok: stress, mkfs options '$cfg'"
+done
+
+# The same with the image served from a 1 MB block cache (-o cache_mb), so that
+# blocks are evicted all the time; the cache needs userfaultfd(2)
+if [ "$(id -u)" = 0 ] || [ "$(cat /proc/sys/vm/unprivileged_userfaultfd 2> /dev/null)" = 1 ]; then
+	for cfg in "" "-b -c -d -g 1024 -I 256"; do
+		truncate -s 0 "$img"
+		truncate -s 64M "$img"
+		./mkfs.a1fs -i 1024 $cfg "$img" > /dev/null
+		if ! tests/stress "$img" "$THREADS" "$ITERATIONS" 1; then
+			echo "FAIL: stress with a block cache, mkfs options '$cfg'"
+			exit 1
+		fi
+		echo "ok: stress with a block cache, mkfs options '$cfg'"
+	done
+else
+	echo "skip: stress with a block cache, userfaultfd is not allowed"
+fi
+
+# A sparse image of 2^34 data blocks (64 TiB); it needs a file system that
+# allows such files, e.g. tmpfs (ext4 stops at 16 TiB). Set BIG_DIR to
+# another directory to use, or to an empty string to skip this test.
+BIG_DIR=${BIG_DIR-/dev/shm}
+if [ -n "$BIG_DIR" ]; then
+	big=$(mktemp "$BIG_DIR/a1fs-big.XXXXXX")
+	trap 'rm -f "$img" "$big"' EXIT
+	if ! truncate -s 64T "$big" 2> /dev/null; then
+		echo "skip: big, cannot make a 64 TiB file in $BIG_DIR"
+	else
+		./mkfs.a1fs -i 1024 -b -g 33554432 "$big" > /dev/null
+		if ! tests/big "$big"; then
+			echo "FAIL: big"
+			exit 1
+		fi
+		echo "ok: big"
+	fi
+	rm -f "$big"
+fi
@@ -0,0 +1,343 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019, 2021 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Concurrent stress test.
+ *
+ * Several threads create, write, read, truncate and unlink files (and make and
+ * remove directories) in a few shared directories of a freshly formatted
+ * image, then the image is checked with fstest_check(), written back, mounted
+ * again and checked once more. Last, the files are truncated while open and
+ * the image is dropped without an unmount; the mount after that "crash" must
+ * free the blocks held for the open files. With a cache size given, the image
+ * is served from a block cache of that size (-o cache_mb) instead of mapped.
+ *
+ * The threads lock what the kernel and libfuse would: a directory is locked
+ * around operations that add or remove its entries, and a name is locked
+ * exclusively while it is created or removed and shared while its file is used.
+ * Everything else runs concurrently, including several writers of one file.
+ *
+ * Every byte written at offset off of a file is pattern(gen, off), where gen
+ * is fixed when the file is created, so a read must return either that or
+ * zeros no matter how the writes, truncates and reads of the file interleave.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fstest.h"
+
+
+/** Shared directories. */
+#define NDIRS 4
+/** Names per directory. */
+#define NNAMES 64
+/** Largest offset written, apart from the occasional far one. */
+#define MAX_OFFSET (1 << 20)
+/** Largest write. */
+#define MAX_WRITE (64 * 1024)
+
+typedef enum { NAME_FREE, NAME_FILE, NAME_DIR } name_state;
+
+typedef struct name {
+	pthread_rwlock_t lock;
+	name_state state;
+	/** Data pattern of the file. */
+	uint32_t gen;
+} name;
+
+typedef struct dir {
+	pthread_mutex_t lock;
+	name names[NNAMES];
+} dir;
+
+static dir dirs[NDIRS];
+static uint32_t next_gen;
+static int iterations;
+static volatile int failed;
+
+#define FAIL(...) do { fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); failed = 1; } while (0)
+
+static unsigned int rnd(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return (unsigned int)(*s >> 11);
+}
+
+static unsigned char pattern(uint32_t gen, uint64_t off)
+{
+	return (unsigned char)((gen * 2654435761u + off / 7 * 40503u + off) % 255 + 1);
+}
+
+static void name_path(char *buf, int d, int k, name_state state)
+{
+	sprintf(buf, "/s%d/%c%d", d, state == NAME_DIR ? 'd' : 'f', k);
+}
+
+/** Read a range of a file and check that it holds its pattern or zeros. */
+static void check_read(const char *path, uint32_t gen, off_t off, size_t size, struct fuse_file_info *fi)
+{
+	unsigned char *buf = malloc(size);
+	struct fuse_bufvec *bv;
+	int ret = fstest_ops->read_buf(path, &bv, size, off, fi);
+	if (ret != 0) {
+		FAIL("%s: read_buf at %ld: %d", path, (long)off, ret);
+		free(buf);
+		return;
+	}
+	size_t got = fuse_buf_size(bv);
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+	dst.buf[0].mem = buf;
+	if (got > size || fuse_buf_copy(&dst, bv, 0) != (ssize_t)got) {
+		FAIL("%s: bad read_buf reply at %ld", path, (long)off);
+	}
+	// fuse_buf_copy() has advanced idx past the buffers it copied
+	for (size_t i = 0; i < bv->count; i++) {
+		if (!(bv->buf[i].flags & FUSE_BUF_IS_FD)) {
+			free(bv->buf[i].mem);
+		}
+	}
+	free(bv);
+	for (size_t i = 0; i < got && !failed; i++) {
+		if (buf[i] != 0 && buf[i] != pattern(gen, off + i)) {
+			FAIL("%s: byte %ld is %d, expected %d or 0", path, (long)(off + i), buf[i],
+			     pattern(gen, off + i));
+		}
+	}
+	free(buf);
+}
+
+/** Write, read and truncate a file through an open handle. */
+static void use_file(const char *path, uint32_t gen, uint64_t *s)
+{
+	struct fuse_file_info fi = {0};
+	int ret = fstest_ops->open(path, &fi);
+	if (ret != 0) {
+		FAIL("%s: open: %d", path, ret);
+		return;
+	}
+	unsigned char *buf = malloc(MAX_WRITE);
+	int n = 1 + rnd(s) % 4;
+	for (int i = 0; i < n && !failed; i++) {
+		off_t off = rnd(s) % MAX_OFFSET;
+		if (rnd(s) % 64 == 0) {
+			off += (off_t)(rnd(s) % 64) << 20;
+		}
+		size_t size = 1 + rnd(s) % MAX_WRITE;
+		switch (rnd(s) % 4) {
+			case 0:
+			case 1:
+				for (size_t j = 0; j < size; j++) {
+					buf[j] = pattern(gen, off + j);
+				}
+				ret = fstest_ops->write(path, (char*)buf, size, off, &fi);
+				if (ret != (int)size && ret != -ENOSPC) {
+					FAIL("%s: write of %zu at %ld: %d", path, size, (long)off, ret);
+				}
+				break;
+			case 2:
+				check_read(path, gen, off, size, &fi);
+				break;
+			case 3:
+				ret = fstest_ops->truncate(path, rnd(s) % 2 ? off : off / 16);
+				if (ret != 0 && ret != -ENOSPC) {
+					FAIL("%s: truncate: %d", path, ret);
+				}
+				break;
+		}
+	}
+	free(buf);
+	fstest_ops->release(path, &fi);
+}
+
+static void *worker(void *arg)
+{
+	uint64_t s = 0x9e3779b97f4a7c15ull * ((uintptr_t)arg + 1);
+	char path[64];
+	for (int it = 0; it < iterations && !failed; it++) {
+		int d = rnd(&s) % NDIRS;
+		int k = rnd(&s) % NNAMES;
+		dir *dp = &dirs[d];
+		name *np = &dp->names[k];
+		int op = rnd(&s) % 8;
+		if (op < 5) {
+			// use the file, if there is one
+			pthread_rwlock_rdlock(&np->lock);
+			if (np->state == NAME_FILE) {
+				name_path(path, d, k, NAME_FILE);
+				use_file(path, np->gen, &s);
+			}
+			pthread_rwlock_unlock(&np->lock);
+			continue;
+		}
+
+		// create or remove the name
+		pthread_rwlock_wrlock(&np->lock);
+		pthread_mutex_lock(&dp->lock);
+		int ret = 0;
+		if (np->state == NAME_FREE) {
+			bool is_dir = rnd(&s) % 8 == 0;
+			name_path(path, d, k, is_dir ? NAME_DIR : NAME_FILE);
+			ret = is_dir ? fstest_ops->mkdir(path, S_IFDIR | 0755) : fstest_create(path, S_IFREG | 0644);
+			if (ret == 0) {
+				np->state = is_dir ? NAME_DIR : NAME_FILE;
+				np->gen = __atomic_add_fetch(&next_gen, 1, __ATOMIC_RELAXED);
+			}
+		} else {
+			name_path(path, d, k, np->state);
+			ret = np->state == NAME_DIR ? fstest_ops->rmdir(path) : fstest_ops->unlink(path);
+			if (ret == 0) {
+				np->state = NAME_FREE;
+			}
+		}
+		if (ret != 0 && ret != -ENOSPC) {
+			FAIL("%s: create/remove: %d", path, ret);
+		}
+		pthread_mutex_unlock(&dp->lock);
+		pthread_rwlock_unlock(&np->lock);
+	}
+	return NULL;
+}
+
+/** Check the whole contents of every file. */
+static void check_files(void)
+{
+	char path[64];
+	for (int d = 0; d < NDIRS; d++) {
+		for (int k = 0; k < NNAMES; k++) {
+			name *np = &dirs[d].names[k];
+			if (np->state != NAME_FILE) {
+				continue;
+			}
+			name_path(path, d, k, NAME_FILE);
+			struct stat st;
+			int ret = fstest_ops->getattr(path, &st);
+			if (ret != 0) {
+				FAIL("%s: getattr: %d", path, ret);
+				continue;
+			}
+			struct fuse_file_info fi = {0};
+			fstest_ops->open(path, &fi);
+			for (off_t off = 0; off < st.st_size; off += MAX_WRITE) {
+				check_read(path, np->gen, off, MAX_WRITE, &fi);
+			}
+			fstest_ops->release(path, &fi);
+		}
+	}
+}
+
+/**
+ * Truncate every file to nothing through an open handle, so that its blocks
+ * are held, and drop the image without unmounting it; the next mount must free
+ * the blocks.
+ *
+ * @return  the image mounted again; NULL on failure.
+ */
+static fs_ctx *crash_with_open_files(fs_ctx *fs, a1fs_opts *opts)
+{
+	static struct fuse_file_info handles[NDIRS][NNAMES];
+	char path[64];
+	for (int d = 0; d < NDIRS; d++) {
+		for (int k = 0; k < NNAMES; k++) {
+			if (dirs[d].names[k].state != NAME_FILE) {
+				continue;
+			}
+			name_path(path, d, k, NAME_FILE);
+			int ret = fstest_ops->open(path, &handles[d][k]);
+			if (ret == 0) {
+				ret = fstest_ops->truncate(path, 0);
+			}
+			if (ret != 0) {
+				FAIL("%s: open/truncate: %d", path, ret);
+			}
+		}
+	}
+	fstest_crash(fs);
+	return fstest_mount(opts);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 4 && argc != 5) {
+		fprintf(stderr, "Usage: %s image threads iterations [cache-MB]\n", argv[0]);
+		return 2;
+	}
+	int nthreads = atoi(argv[2]);
+	iterations = atoi(argv[3]);
+
+	a1fs_opts opts = { .img_path = argv[1], .cache_mb = argc == 5 ? atoi(argv[4]) : 0 };
+	fs_ctx *fs = fstest_mount(&opts);
+	if (fs == NULL) {
+		fprintf(stderr, "Failed to mount %s\n", argv[1]);
+		return 1;
+	}
+	char path[64];
+	for (int d = 0; d < NDIRS; d++) {
+		pthread_mutex_init(&dirs[d].lock, NULL);
+		for (int k = 0; k < NNAMES; k++) {
+			pthread_rwlock_init(&dirs[d].names[k].lock, NULL);
+		}
+		sprintf(path, "/s%d", d);
+		if (fstest_ops->mkdir(path, S_IFDIR | 0755) != 0) {
+			fprintf(stderr, "Failed to create %s\n", path);
+			return 1;
+		}
+	}
+
+	pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+	for (int t = 0; t < nthreads; t++) {
+		pthread_create(&threads[t], NULL, worker, (void*)(uintptr_t)t);
+	}
+	for (int t = 0; t < nthreads; t++) {
+		pthread_join(threads[t], NULL);
+	}
+	free(threads);
+	if (failed) {
+		return 1;
+	}
+
+	check_files();
+	unsigned long errors = fstest_check(fs);
+	fstest_unmount(fs);
+	if (errors == 0 && !failed) {
+		// what was written back must be just as consistent
+		fs = fstest_mount(&opts);
+		if (fs == NULL) {
+			fprintf(stderr, "Failed to mount %s again\n", argv[1]);
+			return 1;
+		}
+		check_files();
+		errors = fstest_check(fs);
+		if (errors == 0 && !failed) {
+			fs = crash_with_open_files(fs, &opts);
+			if (fs == NULL) {
+				fprintf(stderr, "Failed to mount %s after a crash\n", argv[1]);
+				return 1;
+			}
+			errors = fstest_check(fs);
+		}
+		fstest_unmount(fs);
+	}
+	if (errors != 0 || failed) {
+		fprintf(stderr, "%lu problems found\n", errors);
+		return 1;
+	}
+	return 0;
+}
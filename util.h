@@ -23,6 +23,9 @@
 #include <stddef.h>
 
 
+/** Size of a transparent huge page (x86-64 PMD mapping). */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 /** Check if x is a power of 2. */
 static inline bool is_powerof2(size_t x)
 {